@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+"""Measure how the compile time and memory of each pass scale with input size.
+
+For every size of the sweep, gen-module.py emits a module and every pass runs
+on it alone through `opt -time-passes`. The pass time is the "Total" row of
+the pass execution timing report, i.e. the pass plus the analyses it asks
+for. Parsing is not included. The peak RSS is the one of the whole opt
+process. The report is a JSON document:
+
+  {"sweep": "blocks", "sizes": [...], "base": {...}, "passes": [
+    {"pass": "cff", "points": [{"size": 1000, "seconds": 0.01,
+                                "peak_rss_kb": 51200}, ...],
+     "time_exponent": 1.02, "rss_exponent": 0.4}, ...]}
+
+The exponents are the least-squares slopes of log(value) over log(size): 1
+is linear, 2 quadratic. With --max-exponent, the exit status is 1 if the time
+exponent of any pass exceeds it, which catches an accidentally quadratic
+pass before it reaches real builds.
+
+Usage: compile-bench.py --plugin <libObfuscatorPass> [options]
+"""
+
+import argparse
+import json
+import math
+import os
+import re
+import subprocess
+import sys
+
+# Pipeline name, and -passes value
+PASSES = [
+    ("cff", "function(cff)"),
+    ("mba-sub", "function(mba-sub)"),
+    ("mba", "function(mba)"),
+    ("opcode-counter", "function(print<opcode-counter>)"),
+    ("opcode-counter-module", "print<opcode-counter-module>"),
+]
+
+GEN_MODULE = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                          "gen-module.py")
+
+# "   0.0011 ( 42.4%) ... 0.0049 ( 76.7%)  Total", the wall time comes last
+TIMING_ROW = re.compile(r"^\s*((?:[\d.]+ \(\s*[\d.]+%\)\s+)+)(?:\d+\s+)?(.*)$")
+
+
+def pass_seconds(report):
+    in_passes = False
+    for line in report.splitlines():
+        if "Pass execution timing report" in line:
+            in_passes = True
+        match = TIMING_ROW.match(line)
+        if in_passes and match and match.group(2).strip() == "Total":
+            return float(re.findall(r"([\d.]+) \(", match.group(1))[-1])
+    return 0.0
+
+
+def run_opt(args, module, passes, work_dir):
+    # opt appends to -info-output-file
+    timing = os.path.join(work_dir, "time-passes.txt")
+    if os.path.exists(timing):
+        os.remove(timing)
+
+    cmd = [args.opt, "-load", args.plugin, "-load-pass-plugin", args.plugin,
+           "-passes=" + passes, "-disable-verify", "-disable-output",
+           "-time-passes", "-info-output-file=" + timing]
+    cmd += args.opt_arg + [module]
+
+    proc = subprocess.Popen(cmd, stdout=subprocess.DEVNULL,
+                            stderr=subprocess.DEVNULL)
+    _, status, usage = os.wait4(proc.pid, 0)
+    if not os.WIFEXITED(status) or os.WEXITSTATUS(status) != 0:
+        raise RuntimeError("opt failed: " + " ".join(cmd))
+
+    with open(timing) as f:
+        seconds = pass_seconds(f.read())
+    # ru_maxrss is in KiB on Linux, in bytes on Darwin
+    rss_kb = usage.ru_maxrss
+    if sys.platform == "darwin":
+        rss_kb //= 1024
+    return seconds, rss_kb
+
+
+def slope(points, key):
+    xs = [math.log(p["size"]) for p in points if p[key] > 0]
+    ys = [math.log(p[key]) for p in points if p[key] > 0]
+    if len(xs) < 2:
+        return None
+    mean_x = sum(xs) / len(xs)
+    mean_y = sum(ys) / len(ys)
+    var = sum((x - mean_x) ** 2 for x in xs)
+    if var == 0:
+        return None
+    cov = sum((x - mean_x) * (y - mean_y) for x, y in zip(xs, ys))
+    return round(cov / var, 3)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Compile-time scaling of the obfuscation passes")
+    parser.add_argument("--plugin", required=True,
+                        help="path to libObfuscatorPass")
+    parser.add_argument("--opt", default="opt")
+    parser.add_argument("--opt-arg", action="append", default=[],
+                        help="extra opt option, e.g. -cff-max-cases=64")
+    parser.add_argument("--pass", dest="passes", action="append",
+                        choices=[p for p, _ in PASSES],
+                        help="only measure these passes (default: all)")
+    parser.add_argument("--sweep", default="blocks",
+                        choices=["functions", "blocks", "fanout", "depth"],
+                        help="gen-module.py parameter to scale")
+    parser.add_argument("--sizes", default="1000,2000,4000,8000,16000",
+                        help="comma separated values of the swept parameter")
+    parser.add_argument("--functions", type=int, default=1)
+    parser.add_argument("--blocks", type=int, default=1000)
+    parser.add_argument("--fanout", type=int, default=4)
+    parser.add_argument("--depth", type=int, default=1)
+    parser.add_argument("--repeat", type=int, default=3,
+                        help="keep the fastest of that many runs")
+    parser.add_argument("--work-dir", default="compile-bench-work")
+    parser.add_argument("--output", help="JSON report (default: stdout)")
+    parser.add_argument("--max-exponent", type=float, default=0.0,
+                        help="fail above this time exponent (0 = report only)")
+    args = parser.parse_args()
+
+    sizes = [int(s) for s in args.sizes.split(",")]
+    base = {"functions": args.functions, "blocks": args.blocks,
+            "fanout": args.fanout, "depth": args.depth}
+    selected = args.passes or [p for p, _ in PASSES]
+    os.makedirs(args.work_dir, exist_ok=True)
+
+    points = {name: [] for name in selected}
+    for size in sizes:
+        params = dict(base, **{args.sweep: size})
+        module = os.path.join(args.work_dir, "module-%d.ll" % size)
+        with open(module, "w") as f:
+            subprocess.run([sys.executable, GEN_MODULE] +
+                           ["--%s=%d" % kv for kv in params.items()],
+                           stdout=f, check=True)
+
+        for name, passes in PASSES:
+            if name not in selected:
+                continue
+
+            runs = [run_opt(args, module, passes, args.work_dir)
+                    for _ in range(args.repeat)]
+            seconds = min(r[0] for r in runs)
+            rss_kb = min(r[1] for r in runs)
+            points[name].append({"size": size, "seconds": seconds,
+                                 "peak_rss_kb": rss_kb})
+            sys.stderr.write("%-22s %-8d %8.4fs %8d KiB\n"
+                             % (name, size, seconds, rss_kb))
+
+    failed = False
+    results = []
+    for name in selected:
+        time_exponent = slope(points[name], "seconds")
+        if (args.max_exponent > 0 and time_exponent is not None and
+                time_exponent > args.max_exponent):
+            failed = True
+        results.append({
+            "pass": name,
+            "points": points[name],
+            "time_exponent": time_exponent,
+            "rss_exponent": slope(points[name], "peak_rss_kb"),
+        })
+        sys.stderr.write("%-22s time ~ n^%s\n" % (name, time_exponent))
+
+    report = {"sweep": args.sweep, "sizes": sizes, "base": base,
+              "opt_args": args.opt_arg, "passes": results}
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(report, f, indent=2)
+            f.write("\n")
+    else:
+        json.dump(report, sys.stdout, indent=2)
+        sys.stdout.write("\n")
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+"""Emit a synthetic -O0 style module to benchmark the passes at scale.
+
+Every function is a chain of units until it has about <blocks> basic blocks.
+A unit is a nest of <depth> loops (a header, latch and exit block per level)
+around a switch with <fanout> cases, each case doing a few integer operations
+(add, sub, mul, xor, and, or) on a stack slot. With a fan-out of 0 the switch
+is a single straight-line block.
+
+All the values live in allocas, as in clang -O0 output, so the module can be
+fed to cff directly.
+
+Usage: gen-module.py [--functions N] [--blocks N] [--fanout N] [--depth N]
+"""
+
+import argparse
+import sys
+
+
+def emit_unit(out, u, fanout, depth, succ):
+    # Loop headers, outermost first
+    for level in range(depth):
+        body = "h%d_%d" % (u, level + 1) if level + 1 < depth else "s%d" % u
+        out.append("h%d_%d:" % (u, level))
+        out.append("  %%iv%d_%d = load i32, ptr %%i%d, align 4"
+                   % (u, level, level))
+        out.append("  %%ic%d_%d = icmp slt i32 %%iv%d_%d, %%n"
+                   % (u, level, u, level))
+        out.append("  br i1 %%ic%d_%d, label %%%s, label %%x%d_%d"
+                   % (u, level, body, u, level))
+
+    merge_succ = "l%d_%d" % (u, depth - 1) if depth > 0 else succ
+    out.append("s%d:" % u)
+    out.append("  %%sv%d = load i32, ptr %%ret, align 4" % u)
+    if fanout > 0:
+        out.append("  %%sk%d = urem i32 %%sv%d, %d" % (u, u, fanout + 1))
+        cases = " ".join("i32 %d, label %%c%d_%d" % (k, u, k)
+                         for k in range(fanout))
+        out.append("  switch i32 %%sk%d, label %%m%d [ %s ]" % (u, u, cases))
+        for k in range(fanout):
+            name = "%d_%d" % (u, k)
+            out.append("c%s:" % name)
+            out.append("  %%cv%s = load i32, ptr %%ret, align 4" % name)
+            out.append("  %%ca%s = add i32 %%cv%s, %d" % (name, name, k + 1))
+            out.append("  %%cs%s = sub i32 %%ca%s, %%n" % (name, name))
+            out.append("  %%cm%s = mul i32 %%cs%s, 3" % (name, name))
+            out.append("  %%cx%s = xor i32 %%cm%s, %%cv%s" % (name, name, name))
+            out.append("  store i32 %%cx%s, ptr %%ret, align 4" % name)
+            out.append("  br label %%m%d" % u)
+    else:
+        out.append("  %%sa%d = sub i32 %%sv%d, %%n" % (u, u))
+        out.append("  %%so%d = or i32 %%sa%d, %d" % (u, u, u))
+        out.append("  %%sx%d = and i32 %%so%d, %%sv%d" % (u, u, u))
+        out.append("  store i32 %%sx%d, ptr %%ret, align 4" % u)
+        out.append("  br label %%m%d" % u)
+    out.append("m%d:" % u)
+    out.append("  br label %%%s" % merge_succ)
+
+    # Latches and exits, innermost first
+    for level in reversed(range(depth)):
+        out.append("l%d_%d:" % (u, level))
+        out.append("  %%lv%d_%d = load i32, ptr %%i%d, align 4"
+                   % (u, level, level))
+        out.append("  %%ln%d_%d = add nsw i32 %%lv%d_%d, 1"
+                   % (u, level, u, level))
+        out.append("  store i32 %%ln%d_%d, ptr %%i%d, align 4"
+                   % (u, level, level))
+        out.append("  br label %%h%d_%d" % (u, level))
+        exit_succ = "l%d_%d" % (u, level - 1) if level > 0 else succ
+        out.append("x%d_%d:" % (u, level))
+        out.append("  store i32 0, ptr %%i%d, align 4" % level)
+        out.append("  br label %%%s" % exit_succ)
+
+
+def emit_function(out, f, blocks, fanout, depth):
+    unit_blocks = 3 * depth + 2 + fanout
+    num_units = max(1, blocks // unit_blocks)
+
+    out.append("define dso_local i32 @f%d(i32 noundef %%n) {" % f)
+    out.append("entry:")
+    out.append("  %ret = alloca i32, align 4")
+    for level in range(depth):
+        out.append("  %%i%d = alloca i32, align 4" % level)
+    out.append("  store i32 %d, ptr %%ret, align 4" % f)
+    for level in range(depth):
+        out.append("  store i32 0, ptr %%i%d, align 4" % level)
+    out.append("  br label %%%s" % ("h0_0" if depth > 0 else "s0"))
+    for u in range(num_units):
+        succ = "exit"
+        if u + 1 < num_units:
+            succ = "h%d_0" % (u + 1) if depth > 0 else "s%d" % (u + 1)
+        emit_unit(out, u, fanout, depth, succ)
+    out.append("exit:")
+    out.append("  %r = load i32, ptr %ret, align 4")
+    out.append("  ret i32 %r")
+    out.append("}")
+    out.append("")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--functions", type=int, default=1)
+    parser.add_argument("--blocks", type=int, default=1000,
+                        help="approximate basic blocks per function")
+    parser.add_argument("--fanout", type=int, default=4,
+                        help="cases per switch (0 = no switch)")
+    parser.add_argument("--depth", type=int, default=1,
+                        help="loop nest depth around each switch")
+    args = parser.parse_args()
+
+    out = []
+    for f in range(args.functions):
+        emit_function(out, f, args.blocks, args.fanout, args.depth)
+    sys.stdout.write("\n".join(out))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BUF_SIZE 4096
+#define TABLE_SIZE (1 << 14)
+
+static unsigned fnv1a(const unsigned char *buf, int len) {
+  unsigned h = 2166136261u;
+  for (int i = 0; i < len; i++) {
+    h ^= buf[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static unsigned mix(unsigned h) {
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+int main(int argc, char *argv[]) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 24000;
+  static unsigned char buf[BUF_SIZE];
+  static unsigned keys[TABLE_SIZE];
+  static unsigned vals[TABLE_SIZE];
+  unsigned found = 0;
+
+  for (int i = 0; i < BUF_SIZE; i++) {
+    buf[i] = (unsigned char)(i * 7 + 3);
+  }
+
+  for (int r = 0; r < rounds; r++) {
+    buf[r % BUF_SIZE] ^= (unsigned char)r;
+    unsigned h = fnv1a(buf, BUF_SIZE);
+
+    // Open addressing insert and lookup
+    unsigned key = mix(h) | 1u;
+    unsigned slot = key & (TABLE_SIZE - 1);
+    while (keys[slot] != 0 && keys[slot] != key) {
+      slot = (slot + 1) & (TABLE_SIZE - 1);
+    }
+    keys[slot] = key;
+    vals[slot] += (unsigned)r;
+
+    unsigned probe = mix(h ^ (unsigned)r) | 1u;
+    slot = probe & (TABLE_SIZE - 1);
+    while (keys[slot] != 0) {
+      if (keys[slot] == probe) {
+        found += vals[slot];
+        break;
+      }
+      slot = (slot + 1) & (TABLE_SIZE - 1);
+    }
+    found ^= h;
+  }
+
+  printf("%u\n", found);
+  return 0;
+}
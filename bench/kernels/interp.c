@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+enum Op { PUSH, LOAD, STORE, ADD, SUB, MUL, MOD, LT, JZ, JMP, HALT };
+
+struct Insn {
+  enum Op op;
+  int arg;
+};
+
+// sum = 0; i = 0; while (i < n) { sum = (sum + i * i) % 1000003; i = i + 1; }
+static const struct Insn program[] = {
+    {PUSH, 0},  {STORE, 0}, {PUSH, 0},  {STORE, 1},     {LOAD, 1},
+    {LOAD, 2},  {LT, 0},    {JZ, 22},   {LOAD, 0},      {LOAD, 1},
+    {LOAD, 1},  {MUL, 0},   {ADD, 0},   {PUSH, 1000003}, {MOD, 0},
+    {STORE, 0}, {LOAD, 1},  {PUSH, 1},  {ADD, 0},       {STORE, 1},
+    {JMP, 4},   {HALT, 0},  {HALT, 0},
+};
+
+static long run(const struct Insn *code, long n) {
+  long stack[16];
+  long vars[3] = {0, 0, n};
+  int sp = 0;
+  int pc = 0;
+
+  for (;;) {
+    const struct Insn *insn = &code[pc++];
+    switch (insn->op) {
+    case PUSH:
+      stack[sp++] = insn->arg;
+      break;
+    case LOAD:
+      stack[sp++] = vars[insn->arg];
+      break;
+    case STORE:
+      vars[insn->arg] = stack[--sp];
+      break;
+    case ADD:
+      sp--;
+      stack[sp - 1] += stack[sp];
+      break;
+    case SUB:
+      sp--;
+      stack[sp - 1] -= stack[sp];
+      break;
+    case MUL:
+      sp--;
+      stack[sp - 1] *= stack[sp];
+      break;
+    case MOD:
+      sp--;
+      stack[sp - 1] %= stack[sp];
+      break;
+    case LT:
+      sp--;
+      stack[sp - 1] = stack[sp - 1] < stack[sp];
+      break;
+    case JZ:
+      if (stack[--sp] == 0) {
+        pc = insn->arg;
+      }
+      break;
+    case JMP:
+      pc = insn->arg;
+      break;
+    case HALT:
+      return vars[0];
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  long n = argc > 1 ? atol(argv[1]) : 3000000;
+  printf("%ld\n", run(program, n));
+  return 0;
+}
@@ -0,0 +1,45 @@
+// The test/input programs with a main(), run over and over
+#include <stdio.h>
+#include <stdlib.h>
+
+#define main basic_main
+#include "../../test/input/basic.c"
+#undef main
+
+#define main do_while_main
+#include "../../test/input/do-while.c"
+#undef main
+
+#define main for_main
+#include "../../test/input/for.c"
+#undef main
+
+#define main while_main
+#include "../../test/input/while.c"
+#undef main
+
+#define main mbasub_basic_main
+#include "../../test/input/mbasub-basic.c"
+#undef main
+
+int main(int argc, char *argv[]) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 300000;
+  char a[12], b[12], c[12], d[12];
+  char *mba_argv[] = {argv[0], a, b, c, d, NULL};
+  unsigned sum = 0;
+
+  for (int r = 0; r < rounds; r++) {
+    sprintf(a, "%d", r);
+    sprintf(b, "%d", r * 3);
+    sprintf(c, "%d", r ^ 0x5a5a);
+    sprintf(d, "%d", -r);
+    sum += (unsigned)basic_main(1, argv);
+    sum += (unsigned)do_while_main();
+    sum += (unsigned)for_main();
+    sum += (unsigned)while_main();
+    sum += (unsigned)mbasub_basic_main(5, mba_argv);
+  }
+
+  printf("%u\n", sum);
+  return 0;
+}
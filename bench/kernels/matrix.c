@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N 160
+
+static int a[N][N], b[N][N], c[N][N];
+
+int main(int argc, char *argv[]) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 40;
+  unsigned sum = 0;
+
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < N; j++) {
+      a[i][j] = (i * 31 + j * 17) % 101 - 50;
+      b[i][j] = (i * 13 - j * 7) % 97;
+    }
+  }
+
+  for (int r = 0; r < rounds; r++) {
+    for (int i = 0; i < N; i++) {
+      for (int j = 0; j < N; j++) {
+        int acc = 0;
+        for (int k = 0; k < N; k++) {
+          acc += a[i][k] * b[k][j];
+        }
+        c[i][j] = acc;
+      }
+    }
+    for (int i = 0; i < N; i++) {
+      for (int j = 0; j < N; j++) {
+        sum = sum * 31 + (unsigned)c[i][j];
+        a[i][j] = c[i][j] % 101;
+      }
+    }
+  }
+
+  printf("%u\n", sum);
+  return 0;
+}
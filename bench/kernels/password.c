@@ -0,0 +1,36 @@
+// test/input/switch.c and test/input/if-else.c over many candidate strings
+#include <stdio.h>
+#include <stdlib.h>
+
+#define check_password check_password_switch
+#include "../../test/input/switch.c"
+#undef check_password
+
+#define check_password check_password_if_else
+#include "../../test/input/if-else.c"
+#undef check_password
+
+int main(int argc, char *argv[]) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 2000;
+  static const char alphabet[] = "LMFAOX";
+  char passwd[6] = {0};
+  unsigned hits = 0;
+
+  for (int r = 0; r < rounds; r++) {
+    // Every string of length 3 and 5 over the alphabet
+    for (int n = 0; n < 6 * 6 * 6 * 6 * 6; n++) {
+      int v = n;
+      for (int i = 0; i < 5; i++) {
+        passwd[i] = alphabet[v % 6];
+        v /= 6;
+      }
+      hits += check_password_switch(passwd, 5);
+      hits += check_password_switch(passwd, 3);
+      hits += check_password_if_else(passwd, 5);
+      hits += check_password_if_else(passwd, (r & 1) ? 5 : 4);
+    }
+  }
+
+  printf("%u\n", hits);
+  return 0;
+}
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N (1 << 16)
+
+static unsigned lcg(unsigned *state) {
+  *state = *state * 1103515245u + 12345u;
+  return *state >> 8;
+}
+
+static void insertion_sort(int *a, int lo, int hi) {
+  for (int i = lo + 1; i <= hi; i++) {
+    int v = a[i];
+    int j = i - 1;
+    while (j >= lo && a[j] > v) {
+      a[j + 1] = a[j];
+      j--;
+    }
+    a[j + 1] = v;
+  }
+}
+
+static void quick_sort(int *a, int lo, int hi) {
+  while (hi - lo > 16) {
+    int pivot = a[lo + (hi - lo) / 2];
+    int i = lo, j = hi;
+    while (i <= j) {
+      while (a[i] < pivot) {
+        i++;
+      }
+      while (a[j] > pivot) {
+        j--;
+      }
+      if (i <= j) {
+        int t = a[i];
+        a[i] = a[j];
+        a[j] = t;
+        i++;
+        j--;
+      }
+    }
+    if (j - lo < hi - i) {
+      quick_sort(a, lo, j);
+      lo = i;
+    } else {
+      quick_sort(a, i, hi);
+      hi = j;
+    }
+  }
+  insertion_sort(a, lo, hi);
+}
+
+int main(int argc, char *argv[]) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 40;
+  static int a[N];
+  unsigned state = 42;
+  unsigned long sum = 0;
+
+  for (int r = 0; r < rounds; r++) {
+    for (int i = 0; i < N; i++) {
+      a[i] = (int)(lcg(&state) % 1000000);
+    }
+    quick_sort(a, 0, N - 1);
+    for (int i = 1; i < N; i++) {
+      if (a[i - 1] > a[i]) {
+        printf("unsorted\n");
+        return 1;
+      }
+    }
+    sum += (unsigned)a[N / 2] + (unsigned)a[N - 1];
+  }
+
+  printf("%lu\n", sum);
+  return 0;
+}
@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+"""Measure the runtime cost of the obfuscation passes.
+
+Every kernel is compiled once per variant: without obfuscation, with each pass
+alone and with all of them. Each build then goes through the same opt -O<n>
+pipeline, llc and the C compiler as the linker. Every binary is run
+<repeat> times and compared against the output of the original build. The
+report is a JSON document:
+
+  {"opt_level": "O2", "repeat": 3, "opt_args": [...], "results": [
+    {"kernel": "sort", "variant": "cff", "text_bytes": 4321,
+     "wall_seconds": 0.42, "instructions": 1234567890,
+     "overhead": 1.8, "output_matches": true}, ...]}
+
+"wall_seconds" is the best of the runs. "instructions" is the count of
+user-space instructions retired, read with `perf stat`. It is null when perf
+is missing or cannot open the counter. "overhead" is the ratio to the
+original build, over instructions when counted and over wall time otherwise.
+
+With --max-overhead, the exit status is 1 if any variant exceeds that ratio
+or changes the output of a kernel, so CI can hold obfuscation settings to a
+regression budget.
+
+Usage: run-bench.py --plugin <libObfuscatorPass> [options] <kernel.c|.ll>...
+"""
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import time
+
+# Name, pipeline run before the -O<n> one, and its options
+VARIANTS = [
+    ("original", None, []),
+    ("mba-sub", "function(mba-sub)", []),
+    ("mba", "function(mba)", []),
+    ("cff", "function(cff)", []),
+    ("cff-indirect", "function(cff)", ["-cff-dispatch=indirect"]),
+    ("opaque", "function(opaque)", []),
+    ("opaque-all", "function(opaque)", ["-opaque-budget=0"]),
+    ("bcf", "function(bcf)", []),
+    ("bcf-all", "function(bcf)", ["-bcf-budget=0"]),
+    ("all", "function(mba,opaque,bcf,cff)", []),
+]
+
+
+def run(cmd, **kwargs):
+    return subprocess.run(cmd, check=True, **kwargs)
+
+
+def compile_kernel(args, source, work_dir):
+    name = os.path.splitext(os.path.basename(source))[0]
+    if source.endswith(".c"):
+        bitcode = os.path.join(work_dir, name + ".bc")
+        # Front-end output only, the passes see the IR before any optimization
+        run([args.clang, "-O2", "-Xclang", "-disable-llvm-passes",
+             "-emit-llvm", "-c", "-w", source, "-o", bitcode])
+        return name, bitcode
+    return name, source
+
+
+def build_variant(args, name, bitcode, variant, pipeline, options,
+                  work_dir):
+    stem = os.path.join(work_dir, "%s.%s" % (name, variant))
+    passes = "default<%s>" % args.opt_level
+    if pipeline is not None:
+        passes = pipeline + "," + passes
+
+    run([args.opt, "-load", args.plugin, "-load-pass-plugin", args.plugin,
+         "-passes=" + passes] + options + args.opt_arg +
+        [bitcode, "-o", stem + ".bc"])
+    run([args.llc, "-" + args.opt_level, "-filetype=obj",
+         "-relocation-model=pic", stem + ".bc", "-o", stem + ".o"])
+    run([args.cc, stem + ".o", "-o", stem])
+    return stem
+
+
+def text_size(args, obj):
+    # Berkeley format: text data bss dec hex filename
+    out = run([args.llvm_size, obj], stdout=subprocess.PIPE,
+              universal_newlines=True).stdout
+    return int(out.splitlines()[1].split()[0])
+
+
+def count_instructions(exe, perf_out):
+    perf = shutil.which("perf")
+    if perf is None:
+        return None
+    result = subprocess.run([perf, "stat", "-x,", "-e", "instructions:u",
+                             "-o", perf_out, "--", exe],
+                            stdout=subprocess.DEVNULL,
+                            stderr=subprocess.DEVNULL)
+    if result.returncode != 0:
+        return None
+    with open(perf_out) as f:
+        for line in f:
+            fields = line.split(",")
+            if len(fields) > 2 and fields[2].startswith("instructions"):
+                return int(fields[0]) if fields[0].isdigit() else None
+    return None
+
+
+def measure(args, exe):
+    best = None
+    output = None
+    for _ in range(args.repeat):
+        start = time.perf_counter()
+        result = subprocess.run([exe], stdout=subprocess.PIPE)
+        elapsed = time.perf_counter() - start
+        if result.returncode != 0:
+            return None, None, None
+        best = elapsed if best is None else min(best, elapsed)
+        output = result.stdout
+    return best, count_instructions(exe, exe + ".perf"), output
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Runtime overhead of the obfuscation passes")
+    parser.add_argument("kernels", nargs="+", help="C or LLVM IR kernels")
+    parser.add_argument("--plugin", required=True,
+                        help="path to libObfuscatorPass")
+    parser.add_argument("--clang", default="clang")
+    parser.add_argument("--opt", default="opt")
+    parser.add_argument("--llc", default="llc")
+    parser.add_argument("--llvm-size", default="llvm-size")
+    parser.add_argument("--cc", default="cc", help="used as the linker")
+    parser.add_argument("--opt-level", default="O2",
+                        choices=["O0", "O1", "O2", "O3"])
+    parser.add_argument("--opt-arg", action="append", default=[],
+                        help="extra opt option, e.g. -cff-max-cases=64")
+    parser.add_argument("--variant", action="append",
+                        choices=[v[0] for v in VARIANTS],
+                        help="only build these variants (default: all)")
+    parser.add_argument("--repeat", type=int, default=3)
+    parser.add_argument("--work-dir", default="bench-work")
+    parser.add_argument("--output", help="JSON report (default: stdout)")
+    parser.add_argument("--max-overhead", type=float, default=0.0,
+                        help="fail above this ratio to the original "
+                        "(0 = report only)")
+    args = parser.parse_args()
+
+    selected = set(args.variant or [v[0] for v in VARIANTS])
+    selected.add("original")
+    os.makedirs(args.work_dir, exist_ok=True)
+
+    results = []
+    failed = False
+    for source in args.kernels:
+        name, bitcode = compile_kernel(args, source, args.work_dir)
+        baseline = None
+        for variant, pipeline, options in VARIANTS:
+            if variant not in selected:
+                continue
+
+            exe = build_variant(args, name, bitcode, variant, pipeline,
+                                options, args.work_dir)
+            wall, insts, output = measure(args, exe)
+            if variant == "original":
+                baseline = (wall, insts, output)
+
+            overhead = None
+            if wall is not None and baseline[0] is not None:
+                if insts is not None and baseline[1]:
+                    overhead = insts / baseline[1]
+                else:
+                    overhead = wall / baseline[0]
+
+            matches = output is not None and output == baseline[2]
+            if not matches or (args.max_overhead > 0 and
+                               (overhead is None or
+                                overhead > args.max_overhead)):
+                failed = True
+
+            results.append({
+                "kernel": name,
+                "variant": variant,
+                "text_bytes": text_size(args, exe + ".o"),
+                "wall_seconds": round(wall, 4) if wall is not None else None,
+                "instructions": insts,
+                "overhead": round(overhead, 3) if overhead is not None
+                else None,
+                "output_matches": matches,
+            })
+            summary = "FAILED" if wall is None else "%.3fs" % wall
+            if overhead is not None:
+                summary += " x%.2f" % overhead
+            sys.stderr.write("%-10s %-12s %s\n" % (name, variant, summary))
+
+    report = {
+        "opt_level": args.opt_level,
+        "repeat": args.repeat,
+        "opt_args": args.opt_arg,
+        "results": results,
+    }
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(report, f, indent=2)
+            f.write("\n")
+    else:
+        json.dump(report, sys.stdout, indent=2)
+        sys.stdout.write("\n")
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
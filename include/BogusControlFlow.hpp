@@ -0,0 +1,38 @@
+#pragma once
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Support/RandomNumberGenerator.h"
+
+namespace llvm {
+
+/**
+ * @brief Bogus control flow: an opaque predicate in front of a block, whose
+ * never-taken edge computes junk from the live values and feeds it to the
+ * block in place of one of them
+ * @note The junk is a mutated clone of the integer arithmetic of the block,
+ * in a block of its own at the end of the function behind an unlikely edge.
+ * The hot path only gains the predicate and keeps its fall-through layout,
+ * and no function is created, so the pass stays a plain function pass.
+ * Blocks are picked coldest first, within -bcf-budget
+ */
+class BogusControlFlow : public PassInfoMixin<BogusControlFlow> {
+public:
+  PreservedAnalyses run(Function &Func, FunctionAnalysisManager &FAM);
+
+  static bool isRequired() { return true; }
+
+private:
+  Value *createJunk(BasicBlock &BB, Value *V, IRBuilder<> &Builder,
+                    RandomNumberGenerator &RNG) const;
+
+  BasicBlock *insertBogusFlow(BasicBlock &BB, Value *V, Value *Y,
+                              DominatorTree &DT,
+                              RandomNumberGenerator &RNG) const;
+};
+
+} // namespace llvm
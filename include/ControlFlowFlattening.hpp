@@ -1,15 +1,29 @@
 #pragma once
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Support/RandomNumberGenerator.h"
+#include <string>
 
 namespace llvm {
 
+/**
+ * @brief The text of the -cff-hot-list file, empty without one
+ * @note For drivers caching whole outputs, which depend on it
+ */
+StringRef getCFFHotListText();
+
 class ControlFlowFlattening : public PassInfoMixin<ControlFlowFlattening> {
 public:
   PreservedAnalyses run(Function &Func, FunctionAnalysisManager &FAM);
@@ -17,17 +31,110 @@ public:
   static bool isRequired() { return true; }
 
 private:
+  /**
+   * @brief One switch loop: EntryCase dispatches on the state, every case
+   * jumps back through EndCase (or straight to EntryCase with a PHI state)
+   * @note With -cff-dispatch=indirect there is no loop, only Table: every
+   * case jumps to the next one through an indirectbr on its encoded address
+   */
+  struct Dispatcher {
+    SmallVector<BasicBlock *, 16> CaseBB;
+
+    BasicBlock *LoopEntry = nullptr;
+    BasicBlock *LoopEnd = nullptr;
+    AllocaInst *SwitchState = nullptr;
+    PHINode *SwitchVar = nullptr;
+    SwitchInst *Switch = nullptr;
+
+    GlobalVariable *Table = nullptr;
+    SmallVector<BasicBlock *, 16> TableBB;
+  };
+
+  void nameBlocks(Function &Func);
+
+  void collectHotBlocks(Function &Func, FunctionAnalysisManager &FAM);
+
+  void collectEdgeFreqs(Function &Func, const BlockFrequencyInfo &BFI,
+                        const BranchProbabilityInfo &BPI);
+
   BasicBlock *splitEntryBlock(BasicBlock *EntryBlock);
 
+  void addLandingBlocks(Function &Func, LoopInfo &LI);
+
+  void partitionFlattenBB(const LoopInfo &LI);
+
+  void demotePHIs();
+
+  void demoteCrossingValues(Function &Func);
+
   SwitchInst *CreateSwitchLoop(Function &Func, BasicBlock *EntryBlock,
-                               RandomNumberGenerator &RNG);
+                               Dispatcher &Disp, RandomNumberGenerator &RNG);
+
+  void createDispatchTable(Function &Func, Dispatcher &Disp,
+                           RandomNumberGenerator &RNG);
+
+  void addDispatchedEdges(BasicBlock *BB, bool SkipDefault = false);
+
+  void setCaseWeights(Dispatcher &Disp) const;
+
+  void instrumentDispatchers(Function &Func);
+
+  ConstantInt *getCaseValue(BasicBlock *BB) const;
+
+  Dispatcher &getDispatcher(BasicBlock *BB);
+
+  void dispatchState(IRBuilder<> &Builder, Dispatcher &Disp, Value *NextState);
+
+  void dispatchTo(IRBuilder<> &Builder, BasicBlock *Successor);
+
+  Constant *getTableSlot(BasicBlock *BB);
+
+  void dispatchIndirect(IRBuilder<> &Builder, Value *Slot,
+                        ArrayRef<BasicBlock *> Successors);
+
+  BasicBlock *createTrampoline(Function &Func, BasicBlock *Successor);
+
+  bool fuseSwitch(Function &Func, SwitchInst *SwInst);
+
+  Value *createStateLookup(IRBuilder<> &Builder, Function &Func,
+                           SwitchInst *SwInst);
 
 private:
   SmallVector<BasicBlock *, 10> FlattenBB;
+  DenseMap<BasicBlock *, ConstantInt *> CaseValues;
+  DenseMap<BasicBlock *, BasicBlock *> Trampolines;
+  SmallPtrSet<BasicBlock *, 16> HotBB;
+  // Cases in front of the hot blocks reached through the dispatcher, see
+  // addLandingBlocks()
+  SmallPtrSet<BasicBlock *, 8> LandingBB;
+  // Names of the blocks in profiles and hot lists, see nameBlocks()
+  DenseMap<BasicBlock *, std::string> BlockKeys;
+  // Frequency of the edges out of each original block, by successor index,
+  // and of the entry, see collectEdgeFreqs()
+  DenseMap<BasicBlock *, SmallVector<uint64_t, 2>> EdgeFreqs;
+  uint64_t EntryFreq = 0;
+  // Frequency of the edges reaching each block through its dispatcher
+  DenseMap<BasicBlock *, uint64_t> DispatchedFreq;
+
+  SmallVector<Dispatcher, 1> Dispatchers;
+  DenseMap<BasicBlock *, unsigned> CaseDispatcher;
+
+  // Offset added to every block address in the dispatch tables
+  int64_t TableKey = 0;
+};
 
-  BasicBlock *LoopEntry = nullptr;
-  BasicBlock *LoopEnd = nullptr;
-  AllocaInst *SwitchState = nullptr;
+/**
+ * @brief Register the counters -cff-instrument added to the functions of a
+ * module with the runtime of runtime/CFFProfile.c, from one constructor
+ * @note A function pass must leave llvm.global_ctors alone, so this runs
+ * after it: "cff" at the module level runs both, a function pipeline is
+ * followed by "cff-profile"
+ */
+class CFFProfileRegistration : public PassInfoMixin<CFFProfileRegistration> {
+public:
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM);
+
+  static bool isRequired() { return true; }
 };
 
 } // namespace llvm
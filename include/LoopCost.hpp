@@ -0,0 +1,129 @@
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+
+namespace llvm {
+
+/**
+ * @brief Where a loop decides to leave
+ */
+enum class LoopShape {
+  // The header exits: the condition is tested before the body
+  ForWhile,
+  // Only the latch exits: the body runs at least once
+  DoWhile,
+  // Neither, e.g. a break in the middle of the body or several latches
+  Irregular,
+};
+
+StringRef getLoopShapeName(LoopShape Shape);
+
+/**
+ * @brief The structure and estimated cost of one loop
+ * @note Trip counts are 0 when unknown
+ */
+struct LoopCost {
+  const Loop *L = nullptr;
+  unsigned Depth = 0;
+  unsigned NumBlocks = 0;
+  // In its blocks, subloops included
+  unsigned NumInsts = 0;
+  LoopShape Shape = LoopShape::Irregular;
+  // The header or the latch, by Shape, nullptr for irregular loops
+  BasicBlock *ExitingBlock = nullptr;
+
+  // Exact and upper bound from SCEV
+  unsigned TripCount = 0;
+  unsigned MaxTripCount = 0;
+  // From the branch weights of the latch
+  unsigned EstimatedTripCount = 0;
+
+  // Instructions run per entry of the loop, subloops included, a loop with
+  // no trip count counting as a single iteration
+  uint64_t Cost = 0;
+
+  /**
+   * @brief The exact trip count, else the one of the branch weights, else
+   * the SCEV upper bound, 0 if none is known
+   */
+  unsigned getTripCountEstimate() const;
+};
+
+/**
+ * @brief LoopCost of every loop of a function, in preorder
+ */
+class LoopCostInfo {
+public:
+  ArrayRef<LoopCost> loops() const { return Loops; }
+
+  /**
+   * @return nullptr if L isn't a loop of the function
+   */
+  const LoopCost *getLoopCost(const Loop *L) const;
+
+  /**
+   * @brief One JSON object per function, on a single line
+   */
+  void printJSON(raw_ostream &OS, const Function &Func) const;
+
+  /**
+   * @brief The loop tree of the function as a DOT graph
+   */
+  void printDOT(raw_ostream &OS, const Function &Func) const;
+
+private:
+  friend class LoopCostAnalysis;
+
+  SmallVector<LoopCost, 8> Loops;
+  DenseMap<const Loop *, unsigned> Index;
+};
+
+/**
+ * @brief Depth, size, shape and trip counts of every loop, computed once
+ * per function for the printers and the passes keeping expensive loops as
+ * they are
+ * @note Holds Loop pointers, so it is invalidated with LoopAnalysis
+ */
+class LoopCostAnalysis : public AnalysisInfoMixin<LoopCostAnalysis> {
+public:
+  using Result = LoopCostInfo;
+
+  Result run(Function &Func, FunctionAnalysisManager &FAM) const;
+
+private:
+  static AnalysisKey Key;
+  friend struct AnalysisInfoMixin<LoopCostAnalysis>;
+};
+
+class LoopCostPrinter : public PassInfoMixin<LoopCostPrinter> {
+public:
+  enum class Format { JSON, DOT };
+
+  LoopCostPrinter(raw_ostream &OutS, Format Fmt) : OS(OutS), Fmt(Fmt) {}
+
+  PreservedAnalyses run(Function &Func, FunctionAnalysisManager &FAM) const;
+
+  static bool isRequired() { return true; }
+
+private:
+  raw_ostream &OS;
+  Format Fmt;
+};
+
+/**
+ * @brief Register LoopCostAnalysis, "print<loop-cost>" (JSON) and
+ * "dot-loop-cost" with PB
+ * @note Called by every plugin using the analysis, registering twice is
+ * harmless
+ */
+void registerLoopCost(PassBuilder &PB);
+
+} // namespace llvm
@@ -1,19 +1,68 @@
 #pragma once
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
+#include <array>
+#include <optional>
 
 namespace llvm {
 
+/**
+ * @brief Mixed Boolean-Arithmetic rewrite engine
+ * @note Every rule is a MBARule<Opcode> specialization, the engine dispatches
+ * on the opcode of each integer binary operator through a table built from
+ * the enabled rules, so any set of rules costs a single walk over the IR
+ */
 class MBASub : public PassInfoMixin<MBASub> {
 public:
-  PreservedAnalyses run(Function &Func, FunctionAnalysisManager &) const;
+  /**
+   * @brief Rewrites BinOp in front of it, returns nullptr to keep BinOp
+   */
+  using RewriteFn = Value *(*)(IRBuilder<> &, BinaryOperator &);
+
+  /**
+   * @brief Upper bound of the instructions a rewrite adds, charged to the
+   * -mba-budget/-mba-max-growth budget
+   */
+  using CostFn = unsigned (*)(const BinaryOperator &);
+
+  struct Rule {
+    RewriteFn Rewrite = nullptr;
+    CostFn Cost = nullptr;
+  };
+
+  static constexpr unsigned NumBinaryOps =
+      Instruction::BinaryOpsEnd - Instruction::BinaryOpsBegin;
+
+  /**
+   * @brief Enables the rules of Opcodes, every rule if empty
+   */
+  explicit MBASub(ArrayRef<unsigned> Opcodes = {});
+
+  /**
+   * @brief Parses the rule list of "mba<add;xor;...>"
+   * @return The opcodes, std::nullopt if a name has no rule
+   */
+  static std::optional<SmallVector<unsigned, 6>> parseRules(StringRef Params);
+
+  PreservedAnalyses run(Function &Func, FunctionAnalysisManager &FAM) const;
 
   static bool isRequired() { return true; }
 
 private:
-  bool runOnBasicBlock(BasicBlock &BB) const;
+  /**
+   * @return The number of instructions rewritten, OverBudget counts the
+   * ones left alone for lack of budget
+   */
+  unsigned runOnBasicBlock(BasicBlock &BB, std::optional<size_t> &Budget,
+                           unsigned &OverBudget) const;
+
+  std::array<Rule, NumBinaryOps> Rules{};
 };
 
 } // namespace llvm
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/raw_ostream.h"
+#include <optional>
+
+namespace llvm {
+
+/**
+ * @brief Obfuscations a function may go through, as a set of bits
+ */
+class ObfuscationPolicy {
+public:
+  enum Kind : unsigned {
+    None = 0,
+    CFF = 1 << 0,
+    MBA = 1 << 1,
+    Opaque = 1 << 2,
+    BCF = 1 << 3,
+    All = CFF | MBA | Opaque | BCF,
+  };
+
+  ObfuscationPolicy(unsigned Enabled = All) : Enabled(Enabled) {}
+
+  bool allows(Kind K) const { return (Enabled & K) == K; }
+
+  unsigned getEnabled() const { return Enabled; }
+
+  /**
+   * @brief Parses "cff,mba,opaque,bcf", "all" or "none"
+   * @return std::nullopt if a name is unknown
+   */
+  static std::optional<unsigned> parse(StringRef Names);
+
+  void print(raw_ostream &OS) const;
+
+  /**
+   * @brief Never stale: annotations and the policy file don't change with
+   * the function body
+   */
+  bool invalidate(Function &, const PreservedAnalyses &,
+                  FunctionAnalysisManager::Invalidator &) {
+    return false;
+  }
+
+private:
+  unsigned Enabled;
+};
+
+/**
+ * @brief The obfuscations allowed for a function
+ * @note An annotate("obf=...") attribute on the function wins, then the first
+ * rule of the -obf-policy file matching its name. Functions matched by
+ * neither allow everything
+ */
+class ObfuscationPolicyAnalysis
+    : public AnalysisInfoMixin<ObfuscationPolicyAnalysis> {
+public:
+  using Result = ObfuscationPolicy;
+
+  Result run(Function &Func, FunctionAnalysisManager &) const;
+
+private:
+  static AnalysisKey Key;
+  friend struct AnalysisInfoMixin<ObfuscationPolicyAnalysis>;
+};
+
+class ObfuscationPolicyPrinter
+    : public PassInfoMixin<ObfuscationPolicyPrinter> {
+public:
+  explicit ObfuscationPolicyPrinter(raw_ostream &OutS) : OS(OutS) {}
+
+  PreservedAnalyses run(Function &Func, FunctionAnalysisManager &FAM) const;
+
+  static bool isRequired() { return true; }
+
+private:
+  raw_ostream &OS;
+};
+
+/**
+ * @brief The text of the -obf-policy file, empty without one
+ * @note For drivers caching whole outputs, which depend on it
+ */
+StringRef getObfuscationPolicyText();
+
+/**
+ * @brief Register ObfuscationPolicyAnalysis and "print<obf-policy>" with PB
+ * @note Called by every plugin whose passes query the policy, registering
+ * twice is harmless
+ */
+void registerObfuscationPolicy(PassBuilder &PB);
+
+} // namespace llvm
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+
+namespace llvm {
+
+/**
+ * @brief Registration callbacks of every pass in this project, each one is
+ * also the entry point of its own plugin library
+ */
+PassPluginLibraryInfo getOpcodeCounterPluginInfo();
+PassPluginLibraryInfo getCFGPrinterPluginInfo();
+PassPluginLibraryInfo getMBASubPluginInfo();
+PassPluginLibraryInfo getControlFlowFlatteningPluginInfo();
+PassPluginLibraryInfo getOpaquePredicatePluginInfo();
+PassPluginLibraryInfo getBogusControlFlowPluginInfo();
+
+/**
+ * @brief Registration callback of every pass at once, see
+ * registerObfuscatorPasses()
+ */
+PassPluginLibraryInfo getObfuscatorPassPluginInfo();
+
+/**
+ * @brief Register every pipeline name of this project with PB
+ * @note For drivers linking the ObfuscatorPassStatic library instead of
+ * loading a plugin
+ */
+void registerObfuscatorPasses(PassBuilder &PB);
+
+} // namespace llvm
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Support/RandomNumberGenerator.h"
+
+namespace llvm {
+
+class LoopInfo;
+
+/**
+ * @brief Opaque predicates on unconditional branches
+ * @note A predicate (see PredicateBuilder.hpp) is a couple of multiplies and
+ * a compare on integers the block already computed, so it adds no load, call
+ * or memory traffic. Its never-taken edge goes to a later block of the
+ * function, or to a return. Insertion points are picked coldest first,
+ * within -opaque-budget
+ */
+class OpaquePredicate : public PassInfoMixin<OpaquePredicate> {
+public:
+  PreservedAnalyses run(Function &Func, FunctionAnalysisManager &FAM);
+
+  static bool isRequired() { return true; }
+
+private:
+  BasicBlock *getFalseTarget(BasicBlock &BB, BasicBlock *Succ,
+                             const DominatorTree &DT, const LoopInfo &LI,
+                             RandomNumberGenerator &RNG);
+
+  BasicBlock *getFakeExit(Function &Func);
+
+  void insertPredicate(BranchInst *Br, Value *X, Value *Y,
+                       const DominatorTree &DT, const LoopInfo &LI,
+                       RandomNumberGenerator &RNG);
+
+  SmallVector<BasicBlock *, 16> Blocks;
+  DenseMap<BasicBlock *, unsigned> RPOIndex;
+  BasicBlock *FakeExit = nullptr;
+};
+
+} // namespace llvm
@@ -1,14 +1,47 @@
 #pragma once
 
-#include "llvm/ADT/StringMap.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Module.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/raw_ostream.h"
+#include <array>
+#include <cstddef>
 
 namespace llvm {
 
-using ResultOpcodeCounter = StringMap<size_t>;
+/**
+ * @brief Number of instructions per opcode, indexed by
+ * Instruction::getOpcode()
+ * @note Opcode names are only looked up when printing
+ */
+class ResultOpcodeCounter {
+public:
+  static constexpr unsigned NumOpcodes = Instruction::OtherOpsEnd;
+
+  void count(unsigned Opcode) {
+    assert(Opcode < NumOpcodes && "Unknown opcode");
+    ++Counts[Opcode];
+  }
+
+  size_t operator[](unsigned Opcode) const {
+    assert(Opcode < NumOpcodes && "Unknown opcode");
+    return Counts[Opcode];
+  }
+
+  /**
+   * @brief Add the counts of Other, e.g. to sum per-function results
+   */
+  void merge(const ResultOpcodeCounter &Other) {
+    for (unsigned Opcode = 0; Opcode < NumOpcodes; ++Opcode) {
+      Counts[Opcode] += Other.Counts[Opcode];
+    }
+  }
+
+private:
+  std::array<size_t, NumOpcodes> Counts{};
+};
 
 class OpcodeCounter : public AnalysisInfoMixin<OpcodeCounter> {
 public:
@@ -16,6 +49,8 @@ public:
 
   Result run(const Function &Func, const FunctionAnalysisManager &) const;
 
+  static Result countOpcodes(const Function &Func);
+
   static bool isRequired() { return true; }
 
 private:
@@ -23,6 +58,32 @@ private:
   friend struct AnalysisInfoMixin<OpcodeCounter>;
 };
 
+/**
+ * @brief Opcode counts of a whole module
+ */
+struct ResultModuleOpcodeCounter {
+  ResultOpcodeCounter Total;
+  size_t NumFunctions = 0;
+};
+
+/**
+ * @brief Counts every function of a module in parallel and sums the results
+ * @note Only reads the IR, each function is counted on its own thread pool
+ * task without going through the FunctionAnalysisManager
+ */
+class ModuleOpcodeCounter : public AnalysisInfoMixin<ModuleOpcodeCounter> {
+public:
+  using Result = ResultModuleOpcodeCounter;
+
+  Result run(Module &M, ModuleAnalysisManager &) const;
+
+  static bool isRequired() { return true; }
+
+private:
+  static AnalysisKey Key;
+  friend struct AnalysisInfoMixin<ModuleOpcodeCounter>;
+};
+
 class OpcodeCounterPrinter : public PassInfoMixin<OpcodeCounterPrinter> {
 public:
   explicit OpcodeCounterPrinter(raw_ostream &OutS) : OS(OutS) {}
@@ -35,4 +96,17 @@ private:
   raw_ostream &OS;
 };
 
+class ModuleOpcodeCounterPrinter
+    : public PassInfoMixin<ModuleOpcodeCounterPrinter> {
+public:
+  explicit ModuleOpcodeCounterPrinter(raw_ostream &OutS) : OS(OutS) {}
+
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM) const;
+
+  static bool isRequired() { return true; }
+
+private:
+  raw_ostream &OS;
+};
+
 } // namespace llvm
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Value.h"
+#include "llvm/Support/RandomNumberGenerator.h"
+#include <utility>
+
+namespace llvm {
+
+/**
+ * @brief Narrowest integer an opaque predicate can be built on, they hold
+ * modulo 8
+ */
+constexpr unsigned MinPredicateBitWidth = 8;
+
+/**
+ * @brief Integers available at the end of BB to build a predicate on, the
+ * last computed first, then the arguments. The second may be nullptr
+ * @return {nullptr, nullptr} if there is none
+ */
+std::pair<Value *, Value *> getPredicateOperands(BasicBlock &BB);
+
+/**
+ * @brief Instructions createOpaquePredicate adds, with or without a Y
+ */
+inline unsigned getPredicateCost(bool HasY) { return HasY ? 5 : 2; }
+
+/**
+ * @brief Builds an i1 that is always Result, from X and, if not nullptr,
+ * Y of the same type
+ * @note A couple of multiplies and a compare, no load nor call
+ */
+Value *createOpaquePredicate(IRBuilder<> &Builder, Value *X, Value *Y,
+                             bool Result, RandomNumberGenerator &RNG);
+
+/**
+ * @brief Weights of the branch on a predicate that is always Result, the
+ * ones of __builtin_expect
+ */
+MDNode *createPredicateWeights(LLVMContext &Ctx, bool Result);
+
+/**
+ * @brief A block that may get a predicate on X and, if not nullptr, Y
+ */
+struct PredicateCandidate {
+  BasicBlock *BB;
+  Value *X;
+  Value *Y;
+  // Runs of the block per call of the function
+  double Freq;
+};
+
+/**
+ * @brief Keep the candidates whose predicates fit in Budget instructions per
+ * call of the function, coldest first, 0 keeping them all
+ * @note A predicate on X and Y that doesn't fit falls back to the cheaper
+ * one on X alone, Y is then set to nullptr
+ * @return The number of candidates dropped
+ */
+unsigned selectWithinBudget(SmallVectorImpl<PredicateCandidate> &Candidates,
+                            unsigned Budget);
+
+} // namespace llvm
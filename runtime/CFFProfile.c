@@ -0,0 +1,121 @@
+/**
+ * @file CFFProfile.c
+ * @brief Runtime of -cff-instrument: collects the dispatch counters of the
+ * flattened functions and writes them out at exit
+ *
+ * Every instrumented module registers the counters of its functions from a
+ * constructor, and calls __cff_profile_dump from a destructor. The profile is
+ * written once, by the last of those calls, when every module is done.
+ *
+ * The profile goes to $CFF_PROFILE_FILE, "%p" replaced by the process ID, or
+ * to cff-profile.json. Functions are named as in hot lists, a static one
+ * after its source file:
+ *
+ *   {"version":1,"functions":[{"name":"a.c:f","blocks":{"loop":8192,...}},...]}
+ *
+ * obfuscator-profdata turns it into a -cff-hot-list file.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* The record built by ControlFlowFlattening::instrumentDispatchers */
+struct CFFProfile {
+  struct CFFProfile *Next;
+  const char *Name;
+  const char *const *Blocks;
+  uint64_t *Counts;
+  uint32_t NumStates;
+};
+
+static struct CFFProfile *Profiles = NULL;
+
+/* Modules registered and not done yet */
+static uint32_t PendingModules = 0;
+
+/* Called from the constructor of each module, with the records of its
+ * functions, before any thread can be running */
+void __cff_profile_register(struct CFFProfile *const *Module,
+                            uint32_t NumProfiles) {
+  for (uint32_t Index = 0; Index < NumProfiles; ++Index) {
+    Module[Index]->Next = Profiles;
+    Profiles = Module[Index];
+  }
+  ++PendingModules;
+}
+
+static void writeString(FILE *Out, const char *Str) {
+  fputc('"', Out);
+  for (; *Str != '\0'; ++Str) {
+    unsigned char C = (unsigned char)*Str;
+    if (C == '"' || C == '\\') {
+      fprintf(Out, "\\%c", C);
+    } else if (C < 0x20) {
+      fprintf(Out, "\\u%04x", C);
+    } else {
+      fputc(C, Out);
+    }
+  }
+  fputc('"', Out);
+}
+
+/* $CFF_PROFILE_FILE with "%p" expanded, truncated to Size */
+static void getProfilePath(char *Path, size_t Size) {
+  const char *Pattern = getenv("CFF_PROFILE_FILE");
+  if (Pattern == NULL || *Pattern == '\0') {
+    Pattern = "cff-profile.json";
+  }
+
+  size_t Length = 0;
+  for (; *Pattern != '\0' && Length + 1 < Size; ++Pattern) {
+    if (Pattern[0] == '%' && Pattern[1] == 'p') {
+      int Written = snprintf(Path + Length, Size - Length, "%ld",
+                             (long)getpid());
+      if (Written > 0) {
+        Length += (size_t)Written;
+      }
+      ++Pattern;
+      continue;
+    }
+    Path[Length++] = *Pattern;
+  }
+  Path[Length < Size ? Length : Size - 1] = '\0';
+}
+
+/* Called from the destructor of each module, only the last call writes */
+void __cff_profile_dump(void) {
+  if (PendingModules == 0 || --PendingModules != 0) {
+    return;
+  }
+
+  char Path[4096];
+  getProfilePath(Path, sizeof(Path));
+  FILE *Out = fopen(Path, "w");
+  if (Out == NULL) {
+    fprintf(stderr, "cff-profile: can't write '%s'\n", Path);
+    return;
+  }
+
+  fputs("{\"version\":1,\"functions\":[", Out);
+  for (struct CFFProfile *Profile = Profiles; Profile != NULL;
+       Profile = Profile->Next) {
+    fputs("{\"name\":", Out);
+    writeString(Out, Profile->Name);
+    fputs(",\"blocks\":{", Out);
+    for (uint32_t Index = 0; Index < Profile->NumStates; ++Index) {
+      if (Index != 0) {
+        fputc(',', Out);
+      }
+      writeString(Out, Profile->Blocks[Index]);
+      fprintf(Out, ":%llu",
+              (unsigned long long)__atomic_load_n(&Profile->Counts[Index],
+                                                  __ATOMIC_RELAXED));
+    }
+    fputs(Profile->Next != NULL ? "}}," : "}}", Out);
+  }
+  fputs("]}\n", Out);
+  fclose(Out);
+}
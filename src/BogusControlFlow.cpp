@@ -0,0 +1,314 @@
+#include "BogusControlFlow.hpp"
+#include "ObfuscationPolicy.hpp"
+#include "ObfuscatorPass.hpp"
+#include "PredicateBuilder.hpp"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include <iterator>
+
+#define DEBUG_TYPE "bcf"
+
+namespace llvm {
+
+STATISTIC(NumBogusBlocks, "Number of blocks given bogus control flow");
+STATISTIC(NumOverBudget, "Number of blocks left alone by the budget");
+STATISTIC(NumJunkInsts, "Number of instructions in the junk blocks");
+
+static cl::opt<unsigned> BCFBudget(
+    "bcf-budget", cl::init(8),
+    cl::desc("Maximum number of instructions bogus control flow may add to "
+             "the hot path of a call of a function, estimated from block "
+             "frequencies (0 = no limit)"));
+
+// Opcodes of the junk, none of them divides or shifts so the junk can't be
+// poison and folded away along with the edge leading to it
+static constexpr Instruction::BinaryOps JunkOpcodes[] = {
+    Instruction::Add, Instruction::Sub, Instruction::Mul,
+    Instruction::And, Instruction::Or,  Instruction::Xor,
+};
+
+static bool isInBody(const Value *V, const BasicBlock &BB) {
+  const auto *Inst = dyn_cast<Instruction>(V);
+  return Inst != nullptr && Inst->getParent() == &BB && !isa<PHINode>(Inst);
+}
+
+/**
+ * @brief The first integer the non-PHI instructions of BB use but don't
+ * define, the one the junk stands in for
+ */
+static Value *getReplacedValue(BasicBlock &BB) {
+  for (Instruction &Inst :
+       make_range(BB.getFirstNonPHI()->getIterator(), BB.end())) {
+    for (Value *Op : Inst.operands()) {
+      auto *Ty = dyn_cast<IntegerType>(Op->getType());
+      if (Ty == nullptr || Ty->getBitWidth() < MinPredicateBitWidth) {
+        continue;
+      }
+      if ((isa<Instruction>(Op) || isa<Argument>(Op)) && !isInBody(Op, BB)) {
+        return Op;
+      }
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * @brief A second operand for the predicate in front of BB, among its PHIs
+ * and the arguments
+ */
+static Value *getSecondOperand(BasicBlock &BB, Value *V) {
+  for (PHINode &Phi : BB.phis()) {
+    if (&Phi != V && Phi.getType() == V->getType()) {
+      return &Phi;
+    }
+  }
+  for (Argument &Arg : BB.getParent()->args()) {
+    if (&Arg != V && Arg.getType() == V->getType()) {
+      return &Arg;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * @brief Clone the integer arithmetic of BB with random opcodes at the end of
+ * the block of Builder
+ * @return The junk, a value of the type of V
+ * @note The clone reads the live values of BB where BB reads them, so the
+ * junk block only has to be dominated by the PHIs of BB
+ */
+Value *BogusControlFlow::createJunk(BasicBlock &BB, Value *V,
+                                    IRBuilder<> &Builder,
+                                    RandomNumberGenerator &RNG) const {
+  TimeTraceScope TimeScope("BCFCreateJunk", BB.getName());
+
+  // The arithmetic that can be computed from constants, live values and
+  // itself
+  DenseMap<const Value *, Value *> Map;
+  Value *Last = nullptr;
+  for (Instruction &Inst : BB) {
+    auto *BinOp = dyn_cast<BinaryOperator>(&Inst);
+    if (BinOp == nullptr || !BinOp->getType()->isIntegerTy()) {
+      continue;
+    }
+
+    SmallVector<Value *, 2> Ops;
+    for (Value *Op : BinOp->operands()) {
+      if (isa<ConstantInt>(Op) ||
+          ((isa<Instruction>(Op) || isa<Argument>(Op)) && !isInBody(Op, BB))) {
+        Ops.push_back(Op);
+      } else if (Value *Cloned = Map.lookup(Op)) {
+        Ops.push_back(Cloned);
+      }
+    }
+    if (Ops.size() != 2) {
+      continue;
+    }
+
+    Value *NewValue = Builder.CreateBinOp(
+        JunkOpcodes[RNG() % std::size(JunkOpcodes)], Ops[0], Ops[1]);
+    Map[BinOp] = NewValue;
+    if (NewValue->getType() == V->getType()) {
+      Last = NewValue;
+    }
+  }
+
+  // Never V itself, or the edge to the junk would have nothing to change
+  Value *Result = V;
+  if (Last != nullptr) {
+    Result = Builder.CreateBinOp(JunkOpcodes[RNG() % std::size(JunkOpcodes)],
+                                 Last, Result);
+  }
+  return Builder.CreateXor(Result, ConstantInt::get(V->getType(), RNG() | 1));
+}
+
+/**
+ * @return The junk block the never-taken edge leads to
+ */
+BasicBlock *BogusControlFlow::insertBogusFlow(BasicBlock &BB, Value *V,
+                                              Value *Y, DominatorTree &DT,
+                                              RandomNumberGenerator &RNG) const {
+  // The uses of V in BB and below it see the junk, found before the split
+  SmallVector<Use *, 8> Uses;
+  for (Use &U : V->uses()) {
+    auto *User = dyn_cast<Instruction>(U.getUser());
+    if (User == nullptr) {
+      continue;
+    }
+    auto *Phi = dyn_cast<PHINode>(User);
+    BasicBlock *UseBB =
+        Phi != nullptr ? Phi->getIncomingBlock(U) : User->getParent();
+    if (DT.isReachableFromEntry(UseBB) && DT.dominates(&BB, UseBB)) {
+      Uses.push_back(&U);
+    }
+  }
+
+  // The junk is cloned from the body before it moves to its own block
+  Function &Func = *BB.getParent();
+  BasicBlock *JunkBB =
+      BasicBlock::Create(Func.getContext(), BB.getName() + ".bogus", &Func);
+  IRBuilder<> JunkBuilder(JunkBB);
+  Value *JunkValue = createJunk(BB, V, JunkBuilder, RNG);
+
+  BasicBlock *Head = &BB;
+  BasicBlock *Body =
+      SplitBlock(Head, BB.getFirstNonPHI(), &DT, nullptr, nullptr,
+                 BB.getName() + ".body");
+
+  // Laid out last, behind an unlikely edge
+  JunkBuilder.CreateBr(Body);
+  DT.addNewBlock(JunkBB, Head);
+
+  Instruction *Br = Head->getTerminator();
+  IRBuilder<> Builder(Br);
+  bool Result = RNG() & 1;
+  Value *Cond = createOpaquePredicate(Builder, V, Y, Result, RNG);
+  MDNode *Weights = createPredicateWeights(Func.getContext(), Result);
+  if (Result) {
+    Builder.CreateCondBr(Cond, Body, JunkBB, Weights);
+  } else {
+    Builder.CreateCondBr(Cond, JunkBB, Body, Weights);
+  }
+  Br->eraseFromParent();
+
+  PHINode *Merged = PHINode::Create(V->getType(), 2, "", &Body->front());
+  Merged->addIncoming(V, Head);
+  Merged->addIncoming(JunkValue, JunkBB);
+  for (Use *U : Uses) {
+    U->set(Merged);
+  }
+
+  LLVM_DEBUG(dbgs() << "Bogus flow in " << Head->getName() << ", junk in "
+                    << JunkBB->getName() << "\n");
+  return JunkBB;
+}
+
+PreservedAnalyses BogusControlFlow::run(Function &Func,
+                                        FunctionAnalysisManager &FAM) {
+  auto &ORE = FAM.getResult<OptimizationRemarkEmitterAnalysis>(Func);
+
+  if (!FAM.getResult<ObfuscationPolicyAnalysis>(Func).allows(
+          ObfuscationPolicy::BCF)) {
+    LLVM_DEBUG(dbgs() << "Policy excludes " << Func.getName() << "\n");
+    ORE.emit([&] {
+      return OptimizationRemarkMissed(DEBUG_TYPE, "PolicyExcluded", &Func)
+             << "no bogus control flow in " << Func.getName()
+             << ": excluded by the obfuscation policy";
+    });
+    return PreservedAnalyses::all();
+  }
+
+  std::unique_ptr<RandomNumberGenerator> RNG =
+      Func.getParent()->createRNG(("bcf." + Func.getName()).str());
+
+  auto &BFI = FAM.getResult<BlockFrequencyAnalysis>(Func);
+  auto &DT = FAM.getResult<DominatorTreeAnalysis>(Func);
+
+  SmallVector<PredicateCandidate, 16> Candidates;
+  auto EntryFreq = static_cast<double>(BFI.getEntryFreq());
+  for (BasicBlock &BB : Func) {
+    // Splitting the entry block would take the allocas out of it
+    if (&BB == &Func.getEntryBlock() || BB.isEHPad() ||
+        !DT.isReachableFromEntry(&BB)) {
+      continue;
+    }
+
+    Value *V = getReplacedValue(BB);
+    if (V == nullptr) {
+      continue;
+    }
+
+    Candidates.push_back({&BB, V, getSecondOperand(BB, V),
+                          BFI.getBlockFreq(&BB).getFrequency() / EntryFreq});
+  }
+
+  // Only the predicate is on the hot path, the junk is behind it
+  size_t NumCandidates = Candidates.size();
+  unsigned OverBudget = selectWithinBudget(Candidates, BCFBudget);
+  unsigned InstsBefore = Func.getInstructionCount();
+  unsigned JunkInsts = 0;
+  unsigned Inserted = 0;
+  for (const PredicateCandidate &C : Candidates) {
+    // Chosen again, an earlier block may have replaced the uses of the
+    // first pick
+    Value *V = getReplacedValue(*C.BB);
+    if (V == nullptr) {
+      continue;
+    }
+    BasicBlock *JunkBB = insertBogusFlow(
+        *C.BB, V, C.Y != nullptr ? getSecondOperand(*C.BB, V) : nullptr, DT,
+        *RNG);
+    // Without its branch
+    JunkInsts += JunkBB->size() - 1;
+    ++Inserted;
+  }
+
+  NumBogusBlocks += Inserted;
+  NumOverBudget += OverBudget;
+  NumJunkInsts += JunkInsts;
+
+  if (Inserted == 0) {
+    ORE.emit([&] {
+      return OptimizationRemarkMissed(DEBUG_TYPE, "NothingInserted", &Func)
+             << "no bogus control flow in " << Func.getName() << ": "
+             << ore::NV("Candidates", NumCandidates)
+             << " candidate blocks, " << ore::NV("OverBudget", OverBudget)
+             << " over budget";
+    });
+    return PreservedAnalyses::all();
+  }
+
+  ORE.emit([&] {
+    return OptimizationRemark(DEBUG_TYPE, "Inserted", &Func)
+           << "inserted bogus control flow in "
+           << ore::NV("Blocks", Inserted) << " blocks of " << Func.getName()
+           << ", " << ore::NV("OverBudget", OverBudget) << " over budget; "
+           << ore::NV("InstsBefore", InstsBefore) << " to "
+           << ore::NV("InstsAfter", Func.getInstructionCount())
+           << " instructions, " << ore::NV("JunkInsts", JunkInsts)
+           << " of them in junk blocks";
+  });
+
+  return PreservedAnalyses::none();
+}
+
+/**
+ * @brief BogusControlFlow pass registration callback
+ * @note Pass name: "bcf"
+ */
+PassPluginLibraryInfo getBogusControlFlowPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "BogusControlFlow", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            registerObfuscationPolicy(PB);
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, FunctionPassManager &FPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name != "bcf") {
+                    return false;
+                  }
+
+                  FPM.addPass(BogusControlFlow());
+                  return true;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getBogusControlFlowPluginInfo();
+}
+
+} // namespace llvm
@@ -1,4 +1,6 @@
 #include "CFGPrinter.hpp"
+#include "LoopCost.hpp"
+#include "ObfuscatorPass.hpp"
 
 #include "llvm/IR/InstIterator.h"
 #include "llvm/Passes/PassBuilder.h"
@@ -9,37 +11,29 @@ namespace llvm {
 
 /**
  * @brief CFGPrinter implementation
+ * @note Prints the instruction computing the exit condition of each loop,
+ * the shapes are the ones of LoopCostAnalysis
  */
 PreservedAnalyses CFGPrinter::run(Function &Func,
                                   FunctionAnalysisManager &FAM) const {
-  const auto &LI = FAM.getResult<LoopAnalysis>(Func);
+  const auto &Costs = FAM.getResult<LoopCostAnalysis>(Func);
 
   OS << "Printing analysis 'CFG' for function '"
      << Func.getName() << "':\n";
 
-  for (const auto &L : LI.getLoopsInPreorder()) {
-    const auto &HeaderBB = L->getHeader();
-    assert(HeaderBB != nullptr && "Empty loop header");
+  for (const LoopCost &Cost : Costs.loops()) {
+    OS << getLoopShapeName(Cost.Shape) << " loop: ";
 
-    if (L->isLoopExiting(HeaderBB)) {
-      assert(HeaderBB->size() > 2 && "Header Inst size less than 2");
-      OS << "for/while loop: ";
-      OS << *(----HeaderBB->end());
-      OS << "\n";
-    } else {
-      const auto &LatchBB = L->getLoopLatch();
-      assert(LatchBB != nullptr && "Empty latch");
-
-      if (L->isLoopExiting(LatchBB)) {
-        assert(LatchBB->size() > 2 && "Latch Inst size less than 2");
-        OS << "do-while loop: ";
-        OS << *(----LatchBB->end());
-        OS << "\n";
-      } else {
-        OS << "wtf is this loop\n";
-        L->print(OS);
-      }
+    if (Cost.ExitingBlock == nullptr) {
+      Cost.L->print(OS);
+      continue;
     }
+
+    // The compare right before the exiting branch, or the branch itself
+    const Instruction *Term = Cost.ExitingBlock->getTerminator();
+    const Instruction *Prev = Term->getPrevNode();
+    OS << *(Prev != nullptr ? Prev : Term);
+    OS << "\n";
   }
 
   return PreservedAnalyses::all();
@@ -47,11 +41,12 @@ PreservedAnalyses CFGPrinter::run(Function &Func,
 
 /**
  * @brief CFGPrinter pass registration callback
- * @note Pass name: "print<cfg>"
+ * @note Pass names: "print<cfg>", "print<loop-cost>", "dot-loop-cost"
  */
 PassPluginLibraryInfo getCFGPrinterPluginInfo() {
   return {LLVM_PLUGIN_API_VERSION, "CFGPrinter", LLVM_VERSION_STRING,
           [](PassBuilder &PB) {
+            registerLoopCost(PB);
             PB.registerPipelineParsingCallback(
                 [](StringRef Name, FunctionPassManager &FPM,
                    ArrayRef<PassBuilder::PipelineElement>) {
@@ -1,26 +1,283 @@
 #include "ControlFlowFlattening.hpp"
+#include "LoopCost.hpp"
+#include "ObfuscationPolicy.hpp"
+#include "ObfuscatorPass.hpp"
 
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
 #include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/ModuleSlotTracker.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
 #include "llvm/Support/Casting.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include <algorithm>
 #include <cstdint>
+#include <functional>
 #include <memory>
-#include <random>
+#include <numeric>
 
 #define DEBUG_TYPE "cff"
 
 namespace llvm {
 
+STATISTIC(NumFlattened, "Number of functions flattened");
+STATISTIC(NumSkipped, "Number of functions left alone by the policy or "
+                      "because of their shape");
+STATISTIC(NumFlattenedBlocks, "Number of blocks behind a dispatcher");
+STATISTIC(NumHotBlocks, "Number of hot blocks keeping their own branches");
+STATISTIC(NumDispatchers, "Number of dispatchers created");
+STATISTIC(NumDemoted, "Number of PHIs and values demoted to the stack");
+STATISTIC(NumInstrumented, "Number of functions counting their dispatches");
+
+enum class DispatchKind { Switch, Indirect };
+
+static cl::opt<DispatchKind> CFFDispatch(
+    "cff-dispatch", cl::init(DispatchKind::Switch),
+    cl::desc("How flattened blocks reach their successor"),
+    cl::values(clEnumValN(DispatchKind::Switch, "switch",
+                          "Through a central switch loop"),
+               clEnumValN(DispatchKind::Indirect, "indirect",
+                          "Through an indirectbr at the end of every block, "
+                          "on an address loaded from an encoded table")));
+
+static cl::opt<bool> CFFPhiState(
+    "cff-phi-state", cl::init(false),
+    cl::desc("Keep the CFF dispatcher state in an SSA PHI instead of a stack "
+             "slot (avoids a store/load per dispatch without mem2reg)"));
+
+enum class CaseNumbering { Sequential, Dense };
+
+static cl::opt<CaseNumbering> CFFCaseNumbering(
+    "cff-case-numbering", cl::init(CaseNumbering::Dense),
+    cl::desc("How CFF numbers the dispatcher cases"),
+    cl::values(clEnumValN(CaseNumbering::Sequential, "sequential",
+                          "1, 2, ... in block order"),
+               clEnumValN(CaseNumbering::Dense, "dense",
+                          "A random permutation of a contiguous range at a "
+                          "random base, still lowered to a jump table")));
+
+static cl::opt<bool> CFFSkipHot(
+    "cff-skip-hot", cl::init(false),
+    cl::desc("Leave hot blocks, and the innermost loops containing them, "
+             "out of the CFF dispatcher"));
+
+static cl::opt<unsigned> CFFHotFreqRatio(
+    "cff-hot-freq-ratio", cl::init(32),
+    cl::desc("Without a profile summary, a block is hot for -cff-skip-hot "
+             "when it runs at least this many times per function entry"));
+
+static cl::opt<int> CFFHotCutoff(
+    "cff-hot-cutoff", cl::init(990000),
+    cl::desc("With a profile summary (require<profile-summary>), a block is "
+             "hot for -cff-skip-hot when its count is within this percentile "
+             "(in parts per million) of the profile"));
+
+static cl::opt<unsigned> CFFMaxLoopTrips(
+    "cff-max-loop-trips", cl::init(0),
+    cl::desc("Leave innermost loops estimated to run more than this many "
+             "iterations per entry out of the CFF dispatcher, like hot ones "
+             "(0 = no limit)"));
+
+static cl::opt<std::string> CFFHotList(
+    "cff-hot-list", cl::init(""), cl::value_desc("filename"),
+    cl::desc("Blocks to leave out of the CFF dispatcher like hot ones, one "
+             "'<function> <block>' per line, as written by "
+             "obfuscator-profdata"));
+
+static cl::opt<bool> CFFInstrument(
+    "cff-instrument", cl::init(false),
+    cl::desc("Count the runs of every flattened or hot block, written out at "
+             "exit by the ObfuscatorProfile runtime"));
+
+static cl::opt<unsigned> CFFMaxCases(
+    "cff-max-cases", cl::init(0),
+    cl::desc("Split the CFF dispatcher so no switch has more than this many "
+             "cases, giving each loop nest its own dispatcher when it fits "
+             "(0 = a single dispatcher)"));
+
+// Entry points of runtime/CFFProfile.c
+static constexpr const char *ProfileRegisterName = "__cff_profile_register";
+static constexpr const char *ProfileDumpName = "__cff_profile_dump";
+
+// Marks the records CFFProfileRegistration has yet to register
+static constexpr const char *ProfileMDName = "cff.profile";
+
+/**
+ * @brief Name as a key of a profile or hot list, with "\\XX" in hex for
+ * whitespace, unprintable characters, '#', '%' and '\\'
+ * @note A key is then a single token, never cut by a '#' comment and never
+ * mistaken for the "%<slot>" of an unnamed block
+ */
+static std::string escapeKey(StringRef Name) {
+  std::string Key;
+  Key.reserve(Name.size());
+  for (char C : Name) {
+    if (isPrint(C) && !isSpace(C) && C != '#' && C != '%' && C != '\\') {
+      Key += C;
+      continue;
+    }
+    Key += '\\';
+    Key += hexdigit(static_cast<unsigned char>(C) >> 4);
+    Key += hexdigit(static_cast<unsigned char>(C) & 0xF);
+  }
+  return Key;
+}
+
+/**
+ * @brief Key of Func in profiles and hot lists: its global identifier, which
+ * is "<source file>:<name>" for a local function like the PGO names, so the
+ * static functions of different files are told apart
+ */
+static std::string getFunctionKey(const Function &Func) {
+  return escapeKey(Func.getGlobalIdentifier());
+}
+
+namespace {
+
+/**
+ * @brief The blocks of the -cff-hot-list file, loaded once per process
+ */
+class HotList {
+public:
+  static const HotList &get() {
+    static const HotList List(CFFHotList);
+    return List;
+  }
+
+  bool contains(StringRef Func, StringRef Block) const {
+    auto It = Blocks.find(Func);
+    return It != Blocks.end() && It->second.count(Block) != 0;
+  }
+
+  /**
+   * @brief Why the file couldn't be loaded, empty if it was
+   */
+  StringRef getError() const { return Error; }
+
+  StringRef getText() const { return Text ? Text->getBuffer() : StringRef(); }
+
+private:
+  explicit HotList(StringRef Filename) {
+    if (Filename.empty()) {
+      return;
+    }
+
+    auto Buffer = MemoryBuffer::getFile(Filename, /*IsText=*/true);
+    if (!Buffer) {
+      Error = ("can't read CFF hot list '" + Filename +
+               "': " + Buffer.getError().message())
+                  .str();
+      return;
+    }
+
+    Text = std::move(*Buffer);
+    SmallVector<StringRef, 64> Lines;
+    Text->getBuffer().split(Lines, '\n');
+    for (size_t LineNo = 0; LineNo < Lines.size(); ++LineNo) {
+      StringRef Line = Lines[LineNo].split('#').first.trim();
+      if (Line.empty()) {
+        continue;
+      }
+
+      auto [Func, Block] = getToken(Line);
+      Block = Block.trim();
+      if (Block.empty()) {
+        Error = (Filename + ":" + Twine(LineNo + 1) +
+                 ": expected '<function> <block>'")
+                    .str();
+        return;
+      }
+      Blocks[Func].insert(Block);
+    }
+
+    LLVM_DEBUG(dbgs() << "Loaded hot blocks of " << Blocks.size()
+                      << " functions from " << Filename << "\n");
+  }
+
+  std::string Error;
+  std::unique_ptr<MemoryBuffer> Text;
+  StringMap<StringSet<>> Blocks;
+};
+
+} // namespace
+
+StringRef getCFFHotListText() { return HotList::get().getText(); }
+
+/**
+ * @brief Case IDs for NumCases blocks, contiguous from BaseID, in a random
+ * order with -cff-case-numbering=dense
+ */
+static SmallVector<uint32_t, 16> makeCaseIDs(size_t NumCases, uint32_t BaseID,
+                                             RandomNumberGenerator &RNG) {
+  SmallVector<uint32_t, 16> CaseIDs(NumCases);
+  std::iota(CaseIDs.begin(), CaseIDs.end(), BaseID);
+  if (CFFCaseNumbering == CaseNumbering::Dense) {
+    // llvm::shuffle rather than std::shuffle to get the same IDs with every
+    // standard library
+    llvm::shuffle(CaseIDs.begin(), CaseIDs.end(), RNG);
+  }
+  return CaseIDs;
+}
+
 PreservedAnalyses ControlFlowFlattening::run(Function &Func,
-                                             FunctionAnalysisManager &) {
+                                             FunctionAnalysisManager &FAM) {
   std::unique_ptr<RandomNumberGenerator> RNG =
       Func.getParent()->createRNG(Func.getName());
   LLVM_DEBUG(dbgs() << "Running CFF on " << Func.getName() << "\n");
 
+  auto &ORE = FAM.getResult<OptimizationRemarkEmitterAnalysis>(Func);
+  auto Skip = [&](StringRef RemarkName, StringRef Reason) {
+    LLVM_DEBUG(dbgs() << Func.getName() << " not flattened: " << Reason
+                      << "\n");
+    ++NumSkipped;
+    ORE.emit([&] {
+      return OptimizationRemarkMissed(DEBUG_TYPE, RemarkName, &Func)
+             << Func.getName() << " not flattened: " << Reason;
+    });
+    return PreservedAnalyses::all();
+  };
+
+  if (!FAM.getResult<ObfuscationPolicyAnalysis>(Func).allows(
+          ObfuscationPolicy::CFF)) {
+    return Skip("PolicyExcluded", "excluded by the obfuscation policy");
+  }
+
+  FlattenBB.clear();
+  CaseValues.clear();
+  Trampolines.clear();
+  HotBB.clear();
+  LandingBB.clear();
+  BlockKeys.clear();
+  EdgeFreqs.clear();
+  DispatchedFreq.clear();
+
+  if (CFFInstrument || !CFFHotList.empty()) {
+    nameBlocks(Func);
+  }
+  if (CFFSkipHot || !CFFHotList.empty() || CFFMaxLoopTrips != 0) {
+    collectHotBlocks(Func, FAM);
+  }
+
   BasicBlock *EntryBlock = &Func.getEntryBlock();
 
   for (BasicBlock &BB : Func) {
@@ -30,29 +287,77 @@ PreservedAnalyses ControlFlowFlattening::run(Function &Func,
 
     // TODO: not handling function with exception and invoke for now
     if (BB.isLandingPad() || isa<InvokeInst>(BB.getTerminator())) {
-      return PreservedAnalyses::all();
+      return Skip("ExceptionHandling", "has invokes or landing pads");
     }
 
     FlattenBB.push_back(&BB);
   }
 
   if (FlattenBB.size() <= 1) {
-    LLVM_DEBUG(dbgs() << Func.getName() << " is too small to be flattened\n");
-    return PreservedAnalyses::all();
+    return Skip("TooSmall", "too small, at most one block past the entry");
   }
 
+  if (HotBB.size() == FlattenBB.size()) {
+    return Skip("TooHot", "every block is hot");
+  }
+
+  unsigned InstsBefore = Func.getInstructionCount();
+
+  // The analyses are read before the CFG changes: the frequencies of the
+  // original edges become the weights of the dispatcher cases, and the splits
+  // below keep LI up to date
+  auto &LI = FAM.getResult<LoopAnalysis>(Func);
+  collectEdgeFreqs(Func, FAM.getResult<BlockFrequencyAnalysis>(Func),
+                   FAM.getResult<BranchProbabilityAnalysis>(Func));
+
   EntryBlock = splitEntryBlock(EntryBlock);
 
-  LoopEntry =
-      BasicBlock::Create(Func.getContext(), "EntryCase", &Func, EntryBlock);
-  LoopEnd = BasicBlock::Create(Func.getContext(), "EndCase", &Func, EntryBlock);
+  BranchInst *EntryBr = dyn_cast<BranchInst>(EntryBlock->getTerminator());
+  if (EntryBr == nullptr || EntryBr->isConditional()) {
+    // TODO: not handling entry block terminated by invoke for now
+    return Skip("EntryNotSplit", "the entry block can't be split");
+  }
+
+  addLandingBlocks(Func, LI);
+  partitionFlattenBB(LI);
+  demotePHIs();
+
+  // Delete BR terminator to add switch alloca, the dispatcher starts at the
+  // block it used to jump to
+  BasicBlock *FirstBB = EntryBr->getSuccessor(0);
+  EntryBr->eraseFromParent();
 
-  SwitchInst *SwLoopInst = CreateSwitchLoop(Func, EntryBlock, *RNG);
+  if (CFFDispatch == DispatchKind::Indirect) {
+    TableKey = static_cast<int64_t>((*RNG)() % 0xFFFF) + 1;
+  }
+  for (Dispatcher &Disp : Dispatchers) {
+    TimeTraceScope TimeScope("CFFCreateDispatcher");
+    if (CFFDispatch == DispatchKind::Indirect) {
+      createDispatchTable(Func, Disp, *RNG);
+    } else {
+      CreateSwitchLoop(Func, EntryBlock, Disp, *RNG);
+    }
+  }
+
+  // Set the initial state for switch var
+  IRBuilder<> EntryBuilder(EntryBlock);
+  DispatchedFreq[FirstBB] += EntryFreq;
+  dispatchTo(EntryBuilder, FirstBB);
+  if (Dispatchers.front().LoopEntry != nullptr) {
+    // Move it back to top
+    EntryBlock->moveBefore(Dispatchers.front().LoopEntry);
+  }
 
   // Update switch state in every BB/case
   for (BasicBlock *BB : FlattenBB) {
     Instruction *TermInst = BB->getTerminator();
 
+    if (LandingBB.contains(BB)) {
+      // Only the edges into a hot block go through the dispatcher, the
+      // landing block falls through to it
+      continue;
+    }
+
     if (isa<ReturnInst>(TermInst) || isa<UnreachableInst>(TermInst)) {
       // Skip ret inst
       continue;
@@ -64,60 +369,76 @@ PreservedAnalyses ControlFlowFlattening::run(Function &Func,
     }
 
     if (SwitchInst *SwInst = dyn_cast<SwitchInst>(TermInst)) {
-      for (const auto &SwCase : SwInst->cases()) {
-        BasicBlock *Successor = SwCase.getCaseSuccessor();
-
-        ConstantInt *CaseValue = SwLoopInst->findCaseDest(Successor);
-        assert(CaseValue != nullptr &&
-               "This BB should be added to switch case already");
-
-        BasicBlock *DispatchBB =
-            BasicBlock::Create(Func.getContext(), "", &Func, LoopEnd);
-
-        IRBuilder<> SwCaseBuilder(DispatchBB);
-
-        SwCaseBuilder.CreateStore(CaseValue, SwitchState);
-        SwCaseBuilder.CreateBr(LoopEnd);
+      // Only a fused switch sends its default edge through the dispatcher,
+      // otherwise only the cases are trampolined. The edges are read before
+      // fuseSwitch replaces the switch
+      BasicBlock *DefaultBB = SwInst->getDefaultDest();
+      uint64_t DefaultFreq = EdgeFreqs[BB][0];
+      addDispatchedEdges(BB, /*SkipDefault=*/true);
+      if (fuseSwitch(Func, SwInst)) {
+        DispatchedFreq[DefaultBB] += DefaultFreq;
+        continue;
+      }
 
-        SwCase.setSuccessor(DispatchBB);
+      for (const auto &SwCase : SwInst->cases()) {
+        SwCase.setSuccessor(createTrampoline(Func, SwCase.getCaseSuccessor()));
       }
       continue;
     }
 
     if (BranchInst *BrInst = dyn_cast<BranchInst>(TermInst)) {
+      addDispatchedEdges(BB);
+
       if (BrInst->isConditional()) {
         BasicBlock *TrueBB = BrInst->getSuccessor(0);
         BasicBlock *FalseBB = BrInst->getSuccessor(1);
 
-        auto *TrueCaseValue = SwLoopInst->findCaseDest(TrueBB);
-        assert(TrueCaseValue != nullptr &&
-               "This BB should be added to switch case already");
-        auto *FalseCaseValue = SwLoopInst->findCaseDest(FalseBB);
-        assert(FalseCaseValue != nullptr &&
-               "This BB should be added to switch case already");
+        if (CFFDispatch == DispatchKind::Indirect) {
+          // Select the table slot, tables of different dispatchers included
+          IRBuilder<> CondBrBuilder(BB);
+          Value *Slot = CondBrBuilder.CreateSelect(
+              BrInst->getCondition(), getTableSlot(TrueBB),
+              getTableSlot(FalseBB), "", BrInst);
+
+          // The indirectbr lists the successors in the order of the branch,
+          // so it can take its weights
+          MDNode *Weights = BrInst->getMetadata(LLVMContext::MD_prof);
+          TermInst->eraseFromParent();
+          dispatchIndirect(CondBrBuilder, Slot, {TrueBB, FalseBB});
+          if (TrueBB != FalseBB) {
+            BB->getTerminator()->setMetadata(LLVMContext::MD_prof, Weights);
+          }
+          continue;
+        }
+
+        if (&getDispatcher(TrueBB) != &getDispatcher(FalseBB)) {
+          // A select can't pick between two dispatchers, so each edge goes
+          // through its own trampoline instead
+          BrInst->setSuccessor(0, createTrampoline(Func, TrueBB));
+          BrInst->setSuccessor(1, createTrampoline(Func, FalseBB));
+          continue;
+        }
+
+        auto *TrueCaseValue = getCaseValue(TrueBB);
+        auto *FalseCaseValue = getCaseValue(FalseBB);
 
         IRBuilder<> CondBrBuilder(BB);
 
-        auto *SelectInst = CondBrBuilder.CreateSelect(
-            BrInst->getCondition(), TrueCaseValue, FalseCaseValue);
+        auto *SelectInst =
+            CondBrBuilder.CreateSelect(BrInst->getCondition(), TrueCaseValue,
+                                       FalseCaseValue, "", BrInst);
 
         TermInst->eraseFromParent();
-        CondBrBuilder.CreateStore(SelectInst, SwitchState);
-        CondBrBuilder.CreateBr(LoopEnd);
+        dispatchState(CondBrBuilder, getDispatcher(TrueBB), SelectInst);
       }
 
       else {
         BasicBlock *Successor = BrInst->getSuccessor(0);
 
-        auto *CaseValue = SwLoopInst->findCaseDest(Successor);
-        assert(CaseValue != nullptr &&
-               "This BB should be added to switch case already");
-
         IRBuilder<> UncondBrBuilder(BB);
 
         TermInst->eraseFromParent();
-        UncondBrBuilder.CreateStore(CaseValue, SwitchState);
-        UncondBrBuilder.CreateBr(LoopEnd);
+        dispatchTo(UncondBrBuilder, Successor);
       }
       continue;
     }
@@ -126,12 +447,141 @@ PreservedAnalyses ControlFlowFlattening::run(Function &Func,
                       << TermInst << "\n");
   }
 
+  for (Dispatcher &Disp : Dispatchers) {
+    if (Disp.Switch != nullptr) {
+      setCaseWeights(Disp);
+    }
+  }
+
+  if (CFFInstrument) {
+    instrumentDispatchers(Func);
+  }
+
+  demoteCrossingValues(Func);
+
+  size_t NumBlocks = FlattenBB.size() - LandingBB.size();
+  ++NumFlattened;
+  NumFlattenedBlocks += NumBlocks;
+  NumHotBlocks += HotBB.size();
+  NumDispatchers += Dispatchers.size();
+
+  ORE.emit([&] {
+    return OptimizationRemark(DEBUG_TYPE, "Flattened", &Func)
+           << "flattened " << ore::NV("Blocks", NumBlocks) << " blocks of "
+           << Func.getName() << " into "
+           << ore::NV("Dispatchers", Dispatchers.size())
+           << " dispatchers, keeping " << ore::NV("HotBlocks", HotBB.size())
+           << " hot blocks; " << ore::NV("InstsBefore", InstsBefore) << " to "
+           << ore::NV("InstsAfter", Func.getInstructionCount())
+           << " instructions";
+  });
+
   return PreservedAnalyses::none();
 }
 
+/**
+ * @brief Key every block of Func by its escaped name, or by "%<slot>" as
+ * printed in the IR when it has none
+ * @note Called before the pass adds any block, so the keys of a profile
+ * written by -cff-instrument match the blocks -cff-hot-list sees in the next
+ * build of the same IR
+ */
+void ControlFlowFlattening::nameBlocks(Function &Func) {
+  ModuleSlotTracker MST(Func.getParent(),
+                        /*ShouldInitializeAllMetadata=*/false);
+  MST.incorporateFunction(Func);
+  for (BasicBlock &BB : Func) {
+    BlockKeys[&BB] = BB.hasName()
+                         ? escapeKey(BB.getName())
+                         : ("%" + Twine(MST.getLocalSlot(&BB))).str();
+  }
+}
+
+/**
+ * @brief Collect the blocks -cff-skip-hot, -cff-hot-list or
+ * -cff-max-loop-trips must leave out of the dispatcher
+ * @note Uses the profile summary when it is cached (real PGO data), otherwise
+ * the block frequency relative to the function entry. A hot block taints its
+ * whole innermost loop so the loop keeps running at native speed
+ */
+void ControlFlowFlattening::collectHotBlocks(Function &Func,
+                                             FunctionAnalysisManager &FAM) {
+  const HotList &Listed = HotList::get();
+  if (!Listed.getError().empty()) {
+    // Fatal with the default diagnostic handler, like any error of opt
+    Func.getContext().emitError(Listed.getError());
+  }
+
+  auto &BFI = FAM.getResult<BlockFrequencyAnalysis>(Func);
+  const auto &LI = FAM.getResult<LoopAnalysis>(Func);
+  auto &MAMProxy = FAM.getResult<ModuleAnalysisManagerFunctionProxy>(Func);
+  auto *PSI =
+      MAMProxy.getCachedResult<ProfileSummaryAnalysis>(*Func.getParent());
+  bool HasProfile = PSI != nullptr && PSI->hasProfileSummary();
+
+  uint64_t EntryFreq = BFI.getEntryFreq();
+  std::string FuncKey = getFunctionKey(Func);
+
+  for (BasicBlock &BB : Func) {
+    bool IsHot = false;
+
+    if (!BlockKeys.empty() && Listed.contains(FuncKey, BlockKeys[&BB])) {
+      IsHot = true;
+    } else if (CFFSkipHot && HasProfile) {
+      IsHot = PSI->isHotBlockNthPercentile(CFFHotCutoff, &BB, &BFI);
+    } else if (CFFSkipHot) {
+      IsHot = BFI.getBlockFreq(&BB).getFrequency() >=
+              EntryFreq * CFFHotFreqRatio;
+    }
+
+    if (!IsHot || &BB == &Func.getEntryBlock()) {
+      continue;
+    }
+
+    if (const Loop *L = LI.getLoopFor(&BB)) {
+      HotBB.insert(L->block_begin(), L->block_end());
+    } else {
+      HotBB.insert(&BB);
+    }
+  }
+
+  if (CFFMaxLoopTrips != 0) {
+    for (const LoopCost &Cost : FAM.getResult<LoopCostAnalysis>(Func).loops()) {
+      if (Cost.L->isInnermost() &&
+          Cost.getTripCountEstimate() > CFFMaxLoopTrips) {
+        HotBB.insert(Cost.L->block_begin(), Cost.L->block_end());
+      }
+    }
+  }
+
+  LLVM_DEBUG(dbgs() << "Skipping " << HotBB.size() << " hot blocks in "
+                    << Func.getName() << "\n");
+}
+
+/**
+ * @brief Record the frequency of every edge of Func by the successor index of
+ * its source, and the entry frequency
+ * @note The CFG edits keep the successor indices of the original blocks, the
+ * landing blocks only take the place of a successor
+ */
+void ControlFlowFlattening::collectEdgeFreqs(Function &Func,
+                                             const BlockFrequencyInfo &BFI,
+                                             const BranchProbabilityInfo &BPI) {
+  EntryFreq = BFI.getEntryFreq();
+  for (BasicBlock &BB : Func) {
+    uint64_t Freq = BFI.getBlockFreq(&BB).getFrequency();
+    SmallVector<uint64_t, 2> &Freqs = EdgeFreqs[&BB];
+    for (unsigned I = 0, E = BB.getTerminator()->getNumSuccessors(); I < E;
+         ++I) {
+      Freqs.push_back(BPI.getEdgeProbability(&BB, I).scale(Freq));
+    }
+  }
+}
+
 /**
  * @brief Split entry basic block if it is terminated by a conditional control
  flow instruction and add the new splited to FlattenBB otherwise don't
+ * @note The entry is in no loop, so LoopInfo needs no update
  * @return BasicBlock* New entry basic block after splited otherwise same
  * EntryBlock
  */
@@ -153,6 +603,12 @@ BasicBlock *ControlFlowFlattening::splitEntryBlock(BasicBlock *EntryBlock) {
         LLVM_DEBUG(
             dbgs()
             << "Condition of branch inst in entry block is not a condition\n");
+
+        BasicBlock *SplitedEntry =
+            EntryBlock->splitBasicBlockBefore(BrInst, "SplitedEntry");
+
+        FlattenBB.insert(FlattenBB.begin(), EntryBlock);
+        EntryBlock = SplitedEntry;
       }
     }
   }
@@ -172,57 +628,744 @@ BasicBlock *ControlFlowFlattening::splitEntryBlock(BasicBlock *EntryBlock) {
 }
 
 /**
- * @brief Create a switch loop with random state and add cases to all the BB
+ * @brief Replace every hot block of FlattenBB reached through the dispatcher
+ * by a landing block taking the dispatched edges, and drop the other hot
+ * blocks
+ * @note The dispatcher then enters a hot loop only through the landing block
+ * of its header, so the header still dominates the loop: its PHIs keep the
+ * latch edge and only the values coming from the dispatcher are demoted.
+ * LI gets the landing blocks, in the loop enclosing the dispatched edges,
+ * which takes a dominator tree of the split entry
+ */
+void ControlFlowFlattening::addLandingBlocks(Function &Func, LoopInfo &LI) {
+  if (HotBB.empty()) {
+    return;
+  }
+
+  DominatorTree DT(Func);
+  SmallVector<BasicBlock *, 10> Cases;
+  for (BasicBlock *BB : FlattenBB) {
+    if (!HotBB.contains(BB)) {
+      Cases.push_back(BB);
+      continue;
+    }
+
+    // The entry block and the flattened blocks jump through the dispatcher
+    SmallVector<BasicBlock *, 4> Dispatched;
+    for (BasicBlock *Pred : predecessors(BB)) {
+      if (!HotBB.contains(Pred) && !is_contained(Dispatched, Pred)) {
+        Dispatched.push_back(Pred);
+      }
+    }
+    if (Dispatched.empty()) {
+      continue;
+    }
+
+    BasicBlock *Landing =
+        SplitBlockPredecessors(BB, Dispatched, ".landing", &DT, &LI);
+    if (Landing == nullptr) {
+      // Flattened like any other block instead
+      Cases.push_back(BB);
+      continue;
+    }
+    LandingBB.insert(Landing);
+    Cases.push_back(Landing);
+  }
+
+  FlattenBB = std::move(Cases);
+  LLVM_DEBUG(dbgs() << "Added " << LandingBB.size() << " landing blocks\n");
+}
+
+/**
+ * @brief Split FlattenBB into the dispatchers to build, one per loop nest
+ * with at most -cff-max-cases blocks
+ * @note Loops that are too big are split along their subloops, the remaining
+ * blocks are chunked in function order. The dispatchers are siblings: an edge
+ * into another dispatcher jumps straight to its switch instead of going
+ * through the switches enclosing it, so it costs a single dispatch
+ */
+void ControlFlowFlattening::partitionFlattenBB(const LoopInfo &LI) {
+  Dispatchers.clear();
+  CaseDispatcher.clear();
+
+  auto AddDispatchers = [&](ArrayRef<BasicBlock *> Blocks) {
+    for (size_t I = 0, E = Blocks.size(); I < E; I += CFFMaxCases) {
+      Dispatcher &Disp = Dispatchers.emplace_back();
+      for (BasicBlock *BB : Blocks.slice(I, std::min<size_t>(CFFMaxCases,
+                                                             E - I))) {
+        Disp.CaseBB.push_back(BB);
+        CaseDispatcher[BB] = Dispatchers.size() - 1;
+      }
+    }
+  };
+
+  // Hot blocks of a loop are no cases, their landing blocks are
+  SmallPtrSet<BasicBlock *, 16> Cases(FlattenBB.begin(), FlattenBB.end());
+  auto Unassigned = [&](ArrayRef<BasicBlock *> Blocks) {
+    SmallVector<BasicBlock *, 16> Result;
+    for (BasicBlock *BB : Blocks) {
+      if (Cases.contains(BB) && !CaseDispatcher.count(BB)) {
+        Result.push_back(BB);
+      }
+    }
+    return Result;
+  };
+
+  if (CFFMaxCases == 0 || FlattenBB.size() <= CFFMaxCases) {
+    Dispatchers.emplace_back().CaseBB.assign(FlattenBB.begin(),
+                                             FlattenBB.end());
+    for (BasicBlock *BB : FlattenBB) {
+      CaseDispatcher[BB] = 0;
+    }
+    return;
+  }
+
+  std::function<void(const Loop *)> AddLoop = [&](const Loop *L) {
+    if (L->getNumBlocks() > CFFMaxCases) {
+      for (const Loop *SubLoop : *L) {
+        AddLoop(SubLoop);
+      }
+    }
+    AddDispatchers(Unassigned(L->getBlocks()));
+  };
+
+  for (const Loop *L : LI) {
+    AddLoop(L);
+  }
+  AddDispatchers(Unassigned(FlattenBB));
+
+  LLVM_DEBUG(dbgs() << "Split " << FlattenBB.size() << " blocks into "
+                    << Dispatchers.size() << " dispatchers\n");
+}
+
+/**
+ * @brief Demote the PHIs of the flattened blocks to stack slots
+ * @note Every flattened block becomes a join of its dispatcher, whose edges
+ * these PHIs can't name. The stores land before the terminators of the
+ * predecessors, so they survive the rewrite of those terminators
+ */
+void ControlFlowFlattening::demotePHIs() {
+  TimeTraceScope TimeScope("CFFDemotePHIs");
+  SmallVector<PHINode *, 16> PHIs;
+  for (BasicBlock *BB : FlattenBB) {
+    for (PHINode &PHI : BB->phis()) {
+      PHIs.push_back(&PHI);
+    }
+  }
+
+  for (PHINode *PHI : PHIs) {
+    DemotePHIToStack(PHI);
+  }
+  NumDemoted += PHIs.size();
+
+  LLVM_DEBUG(dbgs() << "Demoted " << PHIs.size() << " PHIs\n");
+}
+
+/**
+ * @brief Demote the values that are live across a dispatcher to stack slots
+ * @note Once flattened, a block only dominates the blocks it still branches
+ * to directly, so a value is live across a dispatcher exactly when one of its
+ * uses is no longer dominated by its definition. Only those uses reload the
+ * value, the others and the values used next to their definition stay in
+ * registers. The uses in a hot loop share a reload in its landing block
+ */
+void ControlFlowFlattening::demoteCrossingValues(Function &Func) {
+  TimeTraceScope TimeScope("CFFDemoteCrossingValues");
+  DominatorTree DT(Func);
+
+  // Hot blocks left out of FlattenBB define crossing values too
+  SmallVector<Instruction *, 16> Crossing;
+  for (BasicBlock &BB : Func) {
+    for (Instruction &Inst : BB) {
+      if (any_of(Inst.uses(),
+                 [&](const Use &U) { return !DT.dominates(&Inst, U); })) {
+        Crossing.push_back(&Inst);
+      }
+    }
+  }
+
+  IRBuilder<> Builder(Func.getContext());
+  for (Instruction *Inst : Crossing) {
+    BasicBlock *DefBB = Inst->getParent();
+    Builder.SetInsertPoint(&*Func.getEntryBlock().getFirstInsertionPt());
+    AllocaInst *Slot = Builder.CreateAlloca(Inst->getType(), nullptr,
+                                            Inst->getName() + ".reg2mem");
+    Builder.SetInsertPoint(isa<PHINode>(Inst) ? &*DefBB->getFirstInsertionPt()
+                                              : Inst->getNextNode());
+    Builder.CreateStore(Inst, Slot);
+
+    // The reloads at the end of the incoming blocks of PHIs and in landing
+    // blocks, shared by every use there
+    DenseMap<BasicBlock *, Value *> Reloads;
+    for (Use &U : make_early_inc_range(Inst->uses())) {
+      if (DT.dominates(Inst, U)) {
+        continue;
+      }
+
+      auto *User = cast<Instruction>(U.getUser());
+      auto *Phi = dyn_cast<PHINode>(User);
+      BasicBlock *UseBB = Phi != nullptr ? Phi->getIncomingBlock(U)
+                                         : User->getParent();
+
+      // The outermost landing block between the definition and the use, the
+      // slot can't change past it
+      BasicBlock *Landing = nullptr;
+      for (DomTreeNode *Node = DT.getNode(UseBB);
+           Node != nullptr && !DT.dominates(Node->getBlock(), DefBB);
+           Node = Node->getIDom()) {
+        if (LandingBB.contains(Node->getBlock())) {
+          Landing = Node->getBlock();
+        }
+      }
+
+      if (Landing == nullptr && Phi == nullptr) {
+        Builder.SetInsertPoint(User);
+        U.set(Builder.CreateLoad(Inst->getType(), Slot,
+                                 Inst->getName() + ".reload"));
+        continue;
+      }
+
+      Value *&Reload = Reloads[Landing != nullptr ? Landing : UseBB];
+      if (Reload == nullptr) {
+        Builder.SetInsertPoint(Landing != nullptr
+                                   ? &*Landing->getFirstInsertionPt()
+                                   : UseBB->getTerminator());
+        Reload = Builder.CreateLoad(Inst->getType(), Slot,
+                                    Inst->getName() + ".reload");
+      }
+      U.set(Reload);
+    }
+  }
+  NumDemoted += Crossing.size();
+
+  LLVM_DEBUG(dbgs() << "Demoted " << Crossing.size() << " values live across "
+                    << "the dispatcher\n");
+}
+
+/**
+ * @brief Create a switch loop for Disp and add cases to all its BB
  * @note This switch should never reach default case
  */
 SwitchInst *
 ControlFlowFlattening::CreateSwitchLoop(Function &Func, BasicBlock *EntryBlock,
+                                        Dispatcher &Disp,
                                         RandomNumberGenerator &RNG) {
-  std::uniform_int_distribution<uint32_t> Dist(10);
+  Disp.LoopEntry =
+      BasicBlock::Create(Func.getContext(), "EntryCase", &Func, EntryBlock);
+  Disp.LoopEnd =
+      BasicBlock::Create(Func.getContext(), "EndCase", &Func, EntryBlock);
+
   IRBuilder<> EntryBuilder(EntryBlock);
-  IRBuilder<> LoopEntryBuilder(LoopEntry);
-  IRBuilder<> LoopEndBuilder(LoopEnd);
+  IRBuilder<> LoopEntryBuilder(Disp.LoopEntry);
+  IRBuilder<> LoopEndBuilder(Disp.LoopEnd);
 
   BasicBlock *SwDefaultBB =
       BasicBlock::Create(Func.getContext(), "DefaultCase", &Func, EntryBlock);
   IRBuilder<> SwDefaultBuilder(SwDefaultBB);
-  SwDefaultBuilder.CreateBr(LoopEnd); // Should never reach default case
-
-  // Delete BR terminator to add switch alloca
-  EntryBlock->getTerminator()->eraseFromParent();
-
-  // Create and store a random state for switch var
-  SwitchState = EntryBuilder.CreateAlloca(EntryBuilder.getInt32Ty(), nullptr,
-                                          "SwitchState");
-  EntryBuilder.CreateStore(EntryBuilder.getInt32(Dist(RNG)), SwitchState);
+  SwDefaultBuilder.CreateBr(Disp.LoopEnd); // Should never reach default case
 
-  EntryBlock->moveBefore(LoopEntry); // Move it back to the top
-  EntryBuilder.CreateBr(LoopEntry);
+  Value *SwVar = nullptr;
 
-  LoadInst *SwVar = LoopEntryBuilder.CreateLoad(LoopEntryBuilder.getInt32Ty(),
-                                                SwitchState, "SwitchVar");
-  LoopEndBuilder.CreateBr(LoopEntry);
+  if (CFFPhiState) {
+    // Every flattened block jumps straight back to the dispatcher and feeds
+    // its next state into this PHI, see dispatchState()
+    Disp.SwitchVar = LoopEntryBuilder.CreatePHI(
+        LoopEntryBuilder.getInt32Ty(), Disp.CaseBB.size() + 2, "SwitchVar");
+    Disp.SwitchVar->addIncoming(Disp.SwitchVar, Disp.LoopEnd);
+    SwVar = Disp.SwitchVar;
+  } else {
+    Disp.SwitchState = EntryBuilder.CreateAlloca(EntryBuilder.getInt32Ty(),
+                                                 nullptr, "SwitchState");
+    SwVar = LoopEntryBuilder.CreateLoad(LoopEntryBuilder.getInt32Ty(),
+                                        Disp.SwitchState, "SwitchVar");
+  }
 
   SwitchInst *SwInst = LoopEntryBuilder.CreateSwitch(SwVar, SwDefaultBB);
+  Disp.Switch = SwInst;
+
+  // Keep the case IDs contiguous: fully random 32-bit IDs would make the
+  // backend lower the dispatcher to a binary search instead of a jump table
+  uint32_t BaseID = 1;
+  if (CFFCaseNumbering == CaseNumbering::Dense) {
+    BaseID = RNG() % (INT32_MAX - Disp.CaseBB.size());
+  }
+  SmallVector<uint32_t, 16> CaseIDs =
+      makeCaseIDs(Disp.CaseBB.size(), BaseID, RNG);
 
   // Add switch case to all BB
-  for (BasicBlock *BB : FlattenBB) {
-    BB->moveBefore(LoopEnd);
+  for (auto [BB, CaseID] : zip(Disp.CaseBB, CaseIDs)) {
+    BB->moveBefore(Disp.LoopEnd);
 
-    // FIXME: generate and replace unique id for each BB
-    auto *CaseValue = dyn_cast<ConstantInt>(ConstantInt::get(
-        SwInst->getCondition()->getType(), SwInst->getNumCases() + 1));
-    assert(CaseValue != nullptr && "CaseValue can't never be nullptr here");
+    auto *CaseValue = ConstantInt::get(LoopEntryBuilder.getInt32Ty(), CaseID);
 
     SwInst->addCase(CaseValue, BB);
+    CaseValues[BB] = CaseValue;
   }
 
+  LoopEndBuilder.CreateBr(Disp.LoopEntry);
+
   return SwInst;
 }
 
+/**
+ * @brief Lay out the cases of Disp in a table of encoded block addresses,
+ * in the order of their case IDs
+ * @note Each entry is the address of its block plus TableKey, so neither the
+ * table nor a memory dump of it points at the flattened blocks
+ */
+void ControlFlowFlattening::createDispatchTable(Function &Func,
+                                                Dispatcher &Disp,
+                                                RandomNumberGenerator &RNG) {
+  SmallVector<uint32_t, 16> CaseIDs = makeCaseIDs(Disp.CaseBB.size(), 0, RNG);
+
+  Disp.TableBB.resize(Disp.CaseBB.size());
+  for (auto [BB, CaseID] : zip(Disp.CaseBB, CaseIDs)) {
+    Disp.TableBB[CaseID] = BB;
+    CaseValues[BB] =
+        ConstantInt::get(Type::getInt32Ty(Func.getContext()), CaseID);
+  }
+
+  Type *Int8Ty = Type::getInt8Ty(Func.getContext());
+  Constant *Key =
+      ConstantInt::get(Type::getInt64Ty(Func.getContext()), TableKey);
+  SmallVector<Constant *, 16> Entries;
+  for (BasicBlock *BB : Disp.TableBB) {
+    Entries.push_back(
+        ConstantExpr::getGetElementPtr(Int8Ty, BlockAddress::get(BB), Key));
+  }
+
+  auto *TableTy = ArrayType::get(Entries.front()->getType(), Entries.size());
+  Disp.Table = new GlobalVariable(
+      *Func.getParent(), TableTy, /*isConstant=*/true,
+      GlobalValue::PrivateLinkage, ConstantArray::get(TableTy, Entries),
+      Func.getName() + ".cff.table");
+}
+
+/**
+ * @brief Add the frequency of every edge out of BB to the successor it
+ * reaches through its dispatcher
+ * @param SkipDefault Leave out the default edge of a switch, successor 0
+ * @note Called before the terminator of BB is rewritten, the frequencies are
+ * the ones of its original edges, see collectEdgeFreqs()
+ */
+void ControlFlowFlattening::addDispatchedEdges(BasicBlock *BB,
+                                               bool SkipDefault) {
+  ArrayRef<uint64_t> Freqs = EdgeFreqs[BB];
+  Instruction *TermInst = BB->getTerminator();
+  for (unsigned I = SkipDefault ? 1 : 0, E = Freqs.size(); I < E; ++I) {
+    DispatchedFreq[TermInst->getSuccessor(I)] += Freqs[I];
+  }
+}
+
+/**
+ * @brief Weigh the cases of the switch of Disp by the frequency of the edges
+ * dispatched to them, so codegen lays out and tests the hot states first
+ * @note The default case is never taken. Frequencies are scaled down to fit
+ * the 32-bit weights
+ */
+void ControlFlowFlattening::setCaseWeights(Dispatcher &Disp) const {
+  SwitchInst *SwInst = Disp.Switch;
+  SmallVector<uint64_t, 16> Freqs = {0};
+  for (const auto &SwCase : SwInst->cases()) {
+    Freqs.push_back(DispatchedFreq.lookup(SwCase.getCaseSuccessor()));
+  }
+
+  uint64_t Max = *std::max_element(Freqs.begin(), Freqs.end());
+  if (Max == 0) {
+    return;
+  }
+  uint64_t Scale = Max / UINT32_MAX + 1;
+
+  SmallVector<uint32_t, 16> Weights;
+  for (uint64_t Freq : Freqs) {
+    Weights.push_back(static_cast<uint32_t>(Freq / Scale));
+  }
+
+  SwInst->setMetadata(LLVMContext::MD_prof,
+                      MDBuilder(SwInst->getContext()).createBranchWeights(
+                          Weights));
+}
+
+/**
+ * @brief Count the runs of every flattened or hot block of Func, for
+ * -cff-instrument, in counters CFFProfileRegistration then registers with the
+ * runtime of runtime/CFFProfile.c
+ * @note Every block counts on entry with either dispatch kind, the hot ones
+ * too: a loop kept out of the dispatcher by a hot list stays hot in the next
+ * profile. Landing blocks have no key and don't count. The increments are
+ * relaxed atomics: only the totals matter, not their order between threads
+ */
+void ControlFlowFlattening::instrumentDispatchers(Function &Func) {
+  Module &M = *Func.getParent();
+  LLVMContext &Ctx = Func.getContext();
+  IRBuilder<> Builder(Ctx);
+  Type *PtrTy = Builder.getInt8PtrTy();
+
+  SmallVector<BasicBlock *, 16> Counted;
+  for (BasicBlock &BB : Func) {
+    if (BlockKeys.count(&BB) &&
+        (CaseDispatcher.count(&BB) || HotBB.contains(&BB))) {
+      Counted.push_back(&BB);
+    }
+  }
+  size_t NumStates = Counted.size();
+
+  auto *CountsTy = ArrayType::get(Builder.getInt64Ty(), NumStates);
+  auto *Counts = new GlobalVariable(
+      M, CountsTy, /*isConstant=*/false, GlobalValue::InternalLinkage,
+      ConstantAggregateZero::get(CountsTy), Func.getName() + ".cff.counts");
+
+  SmallVector<Constant *, 16> Names;
+  for (BasicBlock *BB : Counted) {
+    Builder.SetInsertPoint(&*BB->getFirstInsertionPt());
+    Value *Counter =
+        Builder.CreateConstInBoundsGEP2_64(CountsTy, Counts, 0, Names.size());
+    Builder.CreateAtomicRMW(AtomicRMWInst::Add, Counter, Builder.getInt64(1),
+                            MaybeAlign(8), AtomicOrdering::Monotonic);
+
+    Names.push_back(ConstantExpr::getPointerCast(
+        Builder.CreateGlobalString(BlockKeys[BB], "", 0, &M), PtrTy));
+  }
+
+  auto *NamesTy = ArrayType::get(PtrTy, NumStates);
+  auto *Blocks = new GlobalVariable(
+      M, NamesTy, /*isConstant=*/true, GlobalValue::PrivateLinkage,
+      ConstantArray::get(NamesTy, Names), Func.getName() + ".cff.blocks");
+
+  // struct CFFProfile of the runtime, its first field links the registered
+  // profiles
+  Constant *Fields[] = {
+      Constant::getNullValue(PtrTy),
+      ConstantExpr::getPointerCast(
+          Builder.CreateGlobalString(getFunctionKey(Func), "", 0, &M), PtrTy),
+      ConstantExpr::getPointerCast(Blocks, PtrTy),
+      ConstantExpr::getPointerCast(Counts, PtrTy),
+      Builder.getInt32(NumStates)};
+  Constant *Record = ConstantStruct::getAnon(Fields);
+  auto *Profile = new GlobalVariable(
+      M, Record->getType(), /*isConstant=*/false, GlobalValue::InternalLinkage,
+      Record, Func.getName() + ".cff.profile");
+  Profile->setMetadata(ProfileMDName, MDNode::get(Ctx, {}));
+
+  ++NumInstrumented;
+  LLVM_DEBUG(dbgs() << "Counting " << NumStates << " states of "
+                    << Func.getName() << "\n");
+}
+
+/**
+ * @note The records are found by their metadata, dropped once they are
+ * registered so running the pass again registers nothing twice. Blocks count
+ * before their record is registered, so the constructor runs at the default
+ * priority. The destructor runs at the lowest one, after those that may
+ * still dispatch: the runtime writes the profile when the last module is done
+ */
+PreservedAnalyses CFFProfileRegistration::run(Module &M,
+                                              ModuleAnalysisManager &) {
+  LLVMContext &Ctx = M.getContext();
+  unsigned ProfileMD = Ctx.getMDKindID(ProfileMDName);
+  IRBuilder<> Builder(Ctx);
+  Type *PtrTy = Builder.getInt8PtrTy();
+
+  SmallVector<Constant *, 16> Profiles;
+  for (GlobalVariable &GV : M.globals()) {
+    if (GV.hasMetadata(ProfileMD)) {
+      GV.setMetadata(ProfileMD, nullptr);
+      Profiles.push_back(ConstantExpr::getPointerCast(&GV, PtrTy));
+    }
+  }
+
+  if (Profiles.empty()) {
+    return PreservedAnalyses::all();
+  }
+
+  auto *ProfilesTy = ArrayType::get(PtrTy, Profiles.size());
+  auto *Table = new GlobalVariable(
+      M, ProfilesTy, /*isConstant=*/true, GlobalValue::PrivateLinkage,
+      ConstantArray::get(ProfilesTy, Profiles), "cff.profiles");
+
+  Function *Init = Function::Create(
+      FunctionType::get(Builder.getVoidTy(), /*isVarArg=*/false),
+      GlobalValue::InternalLinkage, "cff.profile.init", M);
+  Builder.SetInsertPoint(BasicBlock::Create(Ctx, "", Init));
+  Builder.CreateCall(M.getOrInsertFunction(ProfileRegisterName,
+                                           Builder.getVoidTy(), PtrTy,
+                                           Builder.getInt32Ty()),
+                     {ConstantExpr::getPointerCast(Table, PtrTy),
+                      Builder.getInt32(Profiles.size())});
+  Builder.CreateRetVoid();
+  appendToGlobalCtors(M, Init, /*Priority=*/65535);
+
+  // A destructor rather than atexit(), so a JIT runs it too
+  FunctionCallee Dump =
+      M.getOrInsertFunction(ProfileDumpName, Builder.getVoidTy());
+  appendToGlobalDtors(M, cast<Function>(Dump.getCallee()), /*Priority=*/101);
+
+  LLVM_DEBUG(dbgs() << "Registering " << Profiles.size()
+                    << " profiles from one constructor\n");
+  return PreservedAnalyses::none();
+}
+
+/**
+ * @brief Look up the switch case value assigned to BB by CreateSwitchLoop
+ * @note SwitchInst::findCaseDest is a linear scan over all cases, which makes
+ * the pass quadratic in the number of flattened blocks
+ */
+ConstantInt *ControlFlowFlattening::getCaseValue(BasicBlock *BB) const {
+  auto It = CaseValues.find(BB);
+  assert(It != CaseValues.end() &&
+         "This BB should be added to switch case already");
+  return It->second;
+}
+
+/**
+ * @brief Look up the dispatcher BB is a case of
+ */
+ControlFlowFlattening::Dispatcher &
+ControlFlowFlattening::getDispatcher(BasicBlock *BB) {
+  auto It = CaseDispatcher.find(BB);
+  assert(It != CaseDispatcher.end() &&
+         "This BB should be added to a dispatcher already");
+  return Dispatchers[It->second];
+}
+
+/**
+ * @brief Set the state of Disp to NextState and jump back to it from the block
+ * Builder is inserting into
+ * @note With -cff-phi-state the state never touches memory: the block becomes
+ * an incoming edge of the SwitchVar PHI in EntryCase
+ */
+void ControlFlowFlattening::dispatchState(IRBuilder<> &Builder,
+                                          Dispatcher &Disp, Value *NextState) {
+  if (Disp.SwitchVar != nullptr) {
+    Disp.SwitchVar->addIncoming(NextState, Builder.GetInsertBlock());
+    Builder.CreateBr(Disp.LoopEntry);
+    return;
+  }
+
+  Builder.CreateStore(NextState, Disp.SwitchState);
+  Builder.CreateBr(Disp.LoopEnd);
+}
+
+/**
+ * @brief Jump to Successor through its dispatcher
+ */
+void ControlFlowFlattening::dispatchTo(IRBuilder<> &Builder,
+                                       BasicBlock *Successor) {
+  if (getDispatcher(Successor).Table != nullptr) {
+    dispatchIndirect(Builder, getTableSlot(Successor), Successor);
+    return;
+  }
+
+  dispatchState(Builder, getDispatcher(Successor), getCaseValue(Successor));
+}
+
+/**
+ * @brief Address of the dispatch table entry of BB
+ */
+Constant *ControlFlowFlattening::getTableSlot(BasicBlock *BB) {
+  GlobalVariable *Table = getDispatcher(BB).Table;
+  Type *Int32Ty = Type::getInt32Ty(BB->getContext());
+  Constant *Indices[] = {ConstantInt::get(Int32Ty, 0), getCaseValue(BB)};
+  return ConstantExpr::getInBoundsGetElementPtr(Table->getValueType(), Table,
+                                                Indices);
+}
+
+/**
+ * @brief Jump to the block whose encoded address is stored at Slot, which
+ * must be one of Successors
+ * @note The load is volatile: the tables are constant, and folding the load
+ * would turn the indirectbr back into the original branch. An indirectbr
+ * with a single destination is folded all the same, so the table neighbour
+ * of the successor, or a block of another table, is listed as a decoy
+ * destination. A function with a single flattened block gets no decoy
+ */
+void ControlFlowFlattening::dispatchIndirect(
+    IRBuilder<> &Builder, Value *Slot, ArrayRef<BasicBlock *> Successors) {
+  Type *PtrTy = getDispatcher(Successors.front()).Table->getValueType()
+                    ->getArrayElementType();
+  Value *Encoded =
+      Builder.CreateLoad(PtrTy, Slot, /*isVolatile=*/true, "EncodedTarget");
+  Value *Target = Builder.CreateGEP(Builder.getInt8Ty(), Encoded,
+                                    Builder.getInt64(-TableKey), "Target");
+
+  SmallVector<BasicBlock *, 2> Destinations;
+  for (BasicBlock *BB : Successors) {
+    if (!is_contained(Destinations, BB)) {
+      Destinations.push_back(BB);
+    }
+  }
+  if (Destinations.size() == 1) {
+    BasicBlock *Real = Destinations.front();
+    Dispatcher &Disp = getDispatcher(Real);
+    uint64_t CaseID = getCaseValue(Real)->getZExtValue();
+    BasicBlock *Decoy = Disp.TableBB[(CaseID + 1) % Disp.TableBB.size()];
+    // A one-entry table is its own neighbour, borrow from another table
+    for (const Dispatcher &Other : Dispatchers) {
+      if (Decoy == Real && !Other.TableBB.empty()) {
+        Decoy = Other.TableBB.front();
+      }
+    }
+    if (Decoy != Real) {
+      Destinations.push_back(Decoy);
+    }
+  }
+
+  IndirectBrInst *IndBr =
+      Builder.CreateIndirectBr(Target, Destinations.size());
+  for (BasicBlock *BB : Destinations) {
+    IndBr->addDestination(BB);
+  }
+}
+
+/**
+ * @brief Create a block that only jumps to Successor through its dispatcher,
+ * for edges that can't be rewritten in place
+ * @note Every edge to the same Successor shares one trampoline
+ */
+BasicBlock *ControlFlowFlattening::createTrampoline(Function &Func,
+                                                    BasicBlock *Successor) {
+  BasicBlock *&DispatchBB = Trampolines[Successor];
+  if (DispatchBB != nullptr) {
+    return DispatchBB;
+  }
+
+  DispatchBB = BasicBlock::Create(Func.getContext(), "", &Func,
+                                  getDispatcher(Successor).LoopEnd);
+
+  IRBuilder<> Builder(DispatchBB);
+  dispatchTo(Builder, Successor);
+
+  return DispatchBB;
+}
+
+/**
+ * @brief Replace SwInst by a single dispatch on the state of its successor,
+ * computed from the switch condition
+ * @return false if SwInst is left alone: its successors belong to different
+ * dispatchers or no cheap lookup fits its case values
+ */
+bool ControlFlowFlattening::fuseSwitch(Function &Func, SwitchInst *SwInst) {
+  Dispatcher &Disp = getDispatcher(SwInst->getDefaultDest());
+  SmallVector<BasicBlock *, 8> Successors;
+  for (BasicBlock *Succ : successors(SwInst)) {
+    if (&getDispatcher(Succ) != &Disp) {
+      return false;
+    }
+    if (!is_contained(Successors, Succ)) {
+      Successors.push_back(Succ);
+    }
+  }
+
+  IRBuilder<> Builder(SwInst);
+  Value *NextState = createStateLookup(Builder, Func, SwInst);
+  if (NextState == nullptr) {
+    return false;
+  }
+
+  BasicBlock *BB = SwInst->getParent();
+  SwInst->eraseFromParent();
+  Builder.SetInsertPoint(BB);
+
+  if (Disp.Table != nullptr) {
+    Value *Slot = Builder.CreateInBoundsGEP(
+        Disp.Table->getValueType(), Disp.Table,
+        {Builder.getInt32(0), NextState});
+    dispatchIndirect(Builder, Slot, Successors);
+  } else {
+    dispatchState(Builder, Disp, NextState);
+  }
+
+  return true;
+}
+
+/**
+ * @brief Build the case value of the successor SwInst would jump to
+ * @note Case values spanning a small enough range are looked up in a constant
+ * table indexed by the condition minus the smallest case, a handful of sparse
+ * cases become a chain of selects
+ * @return nullptr if neither fits
+ */
+Value *ControlFlowFlattening::createStateLookup(IRBuilder<> &Builder,
+                                                Function &Func,
+                                                SwitchInst *SwInst) {
+  // Lookup tables larger than that, or emptier than 1/4, are not worth it
+  static constexpr uint64_t MaxLookupTableSize = 4096;
+  static constexpr uint64_t MinLookupTableCases = 4;
+  // Beyond that many cases a chain of selects costs more than a dispatch
+  static constexpr unsigned MaxSelectCases = 4;
+
+  ConstantInt *DefaultState = getCaseValue(SwInst->getDefaultDest());
+  if (SwInst->getNumCases() == 0) {
+    return DefaultState;
+  }
+
+  Value *Condition = SwInst->getCondition();
+  if (Condition->getType()->getIntegerBitWidth() > 64) {
+    return nullptr;
+  }
+
+  APInt Min = SwInst->case_begin()->getCaseValue()->getValue();
+  APInt Max = Min;
+  for (const auto &SwCase : SwInst->cases()) {
+    const APInt &Value = SwCase.getCaseValue()->getValue();
+    if (Value.slt(Min)) {
+      Min = Value;
+    }
+    if (Value.sgt(Max)) {
+      Max = Value;
+    }
+  }
+
+  uint64_t NumCases = SwInst->getNumCases();
+  uint64_t Size = (Max - Min).getZExtValue() + 1;
+  if (Size != 0 && Size <= MaxLookupTableSize &&
+      Size <= std::max(NumCases, MinLookupTableCases) * 4) {
+    SmallVector<Constant *, 16> Entries(Size, DefaultState);
+    for (const auto &SwCase : SwInst->cases()) {
+      uint64_t Index = (SwCase.getCaseValue()->getValue() - Min).getZExtValue();
+      Entries[Index] = getCaseValue(SwCase.getCaseSuccessor());
+    }
+
+    auto *TableTy = ArrayType::get(Builder.getInt32Ty(), Size);
+    auto *Table = new GlobalVariable(
+        *Func.getParent(), TableTy, /*isConstant=*/true,
+        GlobalValue::PrivateLinkage, ConstantArray::get(TableTy, Entries),
+        Func.getName() + ".cff.lookup");
+
+    // The subtraction wraps in the condition type, so everything out of
+    // [Min, Max] lands past the end of the table
+    Value *Index = Builder.CreateZExt(
+        Builder.CreateSub(Condition,
+                          ConstantInt::get(Condition->getType(), Min)),
+        Builder.getInt64Ty());
+    Value *InRange = Builder.CreateICmpULT(Index, Builder.getInt64(Size));
+    Value *SafeIndex = Builder.CreateSelect(InRange, Index,
+                                            Builder.getInt64(0));
+    Value *Entry = Builder.CreateLoad(
+        Builder.getInt32Ty(),
+        Builder.CreateInBoundsGEP(TableTy, Table,
+                                  {Builder.getInt64(0), SafeIndex}));
+    return Builder.CreateSelect(InRange, Entry, DefaultState);
+  }
+
+  if (NumCases <= MaxSelectCases) {
+    Value *State = DefaultState;
+    for (const auto &SwCase : SwInst->cases()) {
+      Value *IsCase = Builder.CreateICmpEQ(Condition, SwCase.getCaseValue());
+      State = Builder.CreateSelect(
+          IsCase, getCaseValue(SwCase.getCaseSuccessor()), State);
+    }
+    return State;
+  }
+
+  return nullptr;
+}
+
 PassPluginLibraryInfo getControlFlowFlatteningPluginInfo() {
   return {LLVM_PLUGIN_API_VERSION, "ControlFlowFlattening", LLVM_VERSION_STRING,
           [](PassBuilder &PB) {
+            registerObfuscationPolicy(PB);
+            registerLoopCost(PB);
             PB.registerPipelineParsingCallback(
                 [](StringRef Name, FunctionPassManager &FPM,
                    ArrayRef<PassBuilder::PipelineElement>) {
@@ -233,6 +1376,19 @@ PassPluginLibraryInfo getControlFlowFlatteningPluginInfo() {
                   FPM.addPass(ControlFlowFlattening());
                   return true;
                 });
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name == "cff") {
+                    MPM.addPass(createModuleToFunctionPassAdaptor(
+                        ControlFlowFlattening()));
+                  } else if (Name != "cff-profile") {
+                    return false;
+                  }
+
+                  MPM.addPass(CFFProfileRegistration());
+                  return true;
+                });
           }};
 }
 
@@ -0,0 +1,202 @@
+#include "LoopCost.hpp"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Support/GraphWriter.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
+#include <algorithm>
+#include <string>
+
+namespace llvm {
+
+AnalysisKey LoopCostAnalysis::Key;
+
+StringRef getLoopShapeName(LoopShape Shape) {
+  switch (Shape) {
+  case LoopShape::ForWhile:
+    return "for/while";
+  case LoopShape::DoWhile:
+    return "do-while";
+  case LoopShape::Irregular:
+    return "irregular";
+  }
+  llvm_unreachable("Unknown loop shape");
+}
+
+unsigned LoopCost::getTripCountEstimate() const {
+  if (TripCount != 0) {
+    return TripCount;
+  }
+  if (EstimatedTripCount != 0) {
+    return EstimatedTripCount;
+  }
+  return MaxTripCount;
+}
+
+const LoopCost *LoopCostInfo::getLoopCost(const Loop *L) const {
+  auto It = Index.find(L);
+  return It != Index.end() ? &Loops[It->second] : nullptr;
+}
+
+/**
+ * @brief The name of BB as an operand, e.g. "%loop" or "%3"
+ */
+static std::string getBlockLabel(const BasicBlock *BB) {
+  std::string Label;
+  raw_string_ostream OS(Label);
+  BB->printAsOperand(OS, /*PrintType=*/false);
+  return OS.str();
+}
+
+void LoopCostInfo::printJSON(raw_ostream &OS, const Function &Func) const {
+  json::OStream J(OS);
+  J.object([&] {
+    J.attribute("function", Func.getName());
+    J.attributeArray("loops", [&] {
+      for (const LoopCost &Cost : Loops) {
+        J.object([&] {
+          J.attribute("header", getBlockLabel(Cost.L->getHeader()));
+          const Loop *Parent = Cost.L->getParentLoop();
+          J.attribute("parent", Parent != nullptr
+                                    ? json::Value(getBlockLabel(
+                                          Parent->getHeader()))
+                                    : json::Value(nullptr));
+          J.attribute("depth", Cost.Depth);
+          J.attribute("blocks", Cost.NumBlocks);
+          J.attribute("instructions", Cost.NumInsts);
+          J.attribute("shape", getLoopShapeName(Cost.Shape));
+          J.attribute("tripCount", Cost.TripCount);
+          J.attribute("maxTripCount", Cost.MaxTripCount);
+          J.attribute("estimatedTripCount", Cost.EstimatedTripCount);
+          J.attribute("cost", Cost.Cost);
+        });
+      }
+    });
+  });
+}
+
+void LoopCostInfo::printDOT(raw_ostream &OS, const Function &Func) const {
+  std::string Title = DOT::EscapeString(("Loops of " + Func.getName()).str());
+  OS << "digraph \"" << Title << "\" {\n"
+     << "  label=\"" << Title << "\";\n"
+     << "  node [shape=record];\n"
+     << "  Func [shape=box, label=\"" << DOT::EscapeString(Func.getName().str())
+     << "\"];\n";
+
+  for (const auto &Entry : enumerate(Loops)) {
+    const LoopCost &Cost = Entry.value();
+    // One record field per line, only the header name needs escaping
+    OS << "  Loop" << Entry.index() << " [label=\"{"
+       << DOT::EscapeString(getBlockLabel(Cost.L->getHeader())) << "|depth "
+       << Cost.Depth << ", " << Cost.NumBlocks << " blocks, " << Cost.NumInsts
+       << " instructions|" << getLoopShapeName(Cost.Shape) << "|trips "
+       << Cost.getTripCountEstimate() << "|cost " << Cost.Cost << "}\"];\n";
+
+    const Loop *Parent = Cost.L->getParentLoop();
+    if (Parent != nullptr) {
+      OS << "  Loop" << Index.lookup(Parent);
+    } else {
+      OS << "  Func";
+    }
+    OS << " -> Loop" << Entry.index() << ";\n";
+  }
+
+  OS << "}\n";
+}
+
+/**
+ * @brief Where L tests its exit, as told apart by print<cfg>
+ */
+static LoopShape getLoopShape(const Loop &L, BasicBlock *&ExitingBlock) {
+  BasicBlock *Header = L.getHeader();
+  if (L.isLoopExiting(Header)) {
+    ExitingBlock = Header;
+    return LoopShape::ForWhile;
+  }
+
+  BasicBlock *Latch = L.getLoopLatch();
+  if (Latch != nullptr && L.isLoopExiting(Latch)) {
+    ExitingBlock = Latch;
+    return LoopShape::DoWhile;
+  }
+
+  ExitingBlock = nullptr;
+  return LoopShape::Irregular;
+}
+
+LoopCostInfo LoopCostAnalysis::run(Function &Func,
+                                   FunctionAnalysisManager &FAM) const {
+  auto &LI = FAM.getResult<LoopAnalysis>(Func);
+  auto &SE = FAM.getResult<ScalarEvolutionAnalysis>(Func);
+
+  LoopCostInfo Info;
+  for (Loop *L : LI.getLoopsInPreorder()) {
+    Info.Index[L] = Info.Loops.size();
+    LoopCost &Cost = Info.Loops.emplace_back();
+    Cost.L = L;
+    Cost.Depth = L->getLoopDepth();
+    Cost.NumBlocks = L->getNumBlocks();
+    for (const BasicBlock *BB : L->blocks()) {
+      Cost.NumInsts += BB->size();
+    }
+    Cost.Shape = getLoopShape(*L, Cost.ExitingBlock);
+
+    Cost.TripCount = SE.getSmallConstantTripCount(L);
+    Cost.MaxTripCount = SE.getSmallConstantMaxTripCount(L);
+    if (auto Estimated = getLoopEstimatedTripCount(L)) {
+      Cost.EstimatedTripCount = *Estimated;
+    }
+  }
+
+  // Subloops come after their parent in preorder, so backwards every
+  // subloop has its cost before its parent needs it
+  for (LoopCost &Cost : reverse(Info.Loops)) {
+    uint64_t OwnInsts = Cost.NumInsts;
+    uint64_t SubLoopCost = 0;
+    for (const Loop *SubLoop : *Cost.L) {
+      const LoopCost &Sub = Info.Loops[Info.Index.lookup(SubLoop)];
+      OwnInsts -= Sub.NumInsts;
+      SubLoopCost = SaturatingAdd(SubLoopCost, Sub.Cost);
+    }
+    uint64_t Body = SaturatingAdd(OwnInsts, SubLoopCost);
+    Cost.Cost = SaturatingMultiply(
+        Body, uint64_t(std::max(1u, Cost.getTripCountEstimate())));
+  }
+
+  return Info;
+}
+
+PreservedAnalyses LoopCostPrinter::run(Function &Func,
+                                       FunctionAnalysisManager &FAM) const {
+  const auto &Info = FAM.getResult<LoopCostAnalysis>(Func);
+  if (Fmt == Format::JSON) {
+    Info.printJSON(OS, Func);
+    OS << "\n";
+  } else {
+    Info.printDOT(OS, Func);
+  }
+  return PreservedAnalyses::all();
+}
+
+void registerLoopCost(PassBuilder &PB) {
+  PB.registerPipelineParsingCallback(
+      [](StringRef Name, FunctionPassManager &FPM,
+         ArrayRef<PassBuilder::PipelineElement>) {
+        if (Name == "print<loop-cost>") {
+          FPM.addPass(LoopCostPrinter(errs(), LoopCostPrinter::Format::JSON));
+          return true;
+        }
+        if (Name == "dot-loop-cost") {
+          FPM.addPass(LoopCostPrinter(errs(), LoopCostPrinter::Format::DOT));
+          return true;
+        }
+        return false;
+      });
+  PB.registerAnalysisRegistrationCallback([](FunctionAnalysisManager &FAM) {
+    FAM.registerPass([] { return LoopCostAnalysis(); });
+  });
+}
+
+} // namespace llvm
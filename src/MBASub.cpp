@@ -1,29 +1,278 @@
 #include "MBASub.hpp"
+#include "ObfuscationPolicy.hpp"
+#include "ObfuscatorPass.hpp"
 
-#include "llvm/IR/IRBuilder.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/PatternMatch.h"
 #include "llvm/IR/Value.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
-#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include <algorithm>
 
 #define DEBUG_TYPE "mba-sub"
 
 namespace llvm {
 
+STATISTIC(NumRewritten, "Number of instructions rewritten into MBA");
+STATISTIC(NumOverBudget, "Number of instructions left alone by the budget");
+STATISTIC(NumAddedInsts, "Number of instructions added by MBA");
+
+static cl::opt<unsigned> MBABudget(
+    "mba-budget", cl::init(0),
+    cl::desc("Maximum number of instructions MBA may add to a function "
+             "(0 = no limit)"));
+
+static cl::opt<unsigned> MBAMaxGrowth(
+    "mba-max-growth", cl::init(0),
+    cl::desc("Maximum growth of a function's instruction count through MBA, "
+             "in percent (0 = no limit)"));
+
 /**
- * @brief MBA Sub Implementation
+ * @brief Rewrite rule of one opcode, specialized below
+ * @note Each specialization provides the Name used in "mba<...>", a
+ * rewrite() matching MBASub::RewriteFn and a cost() matching MBASub::CostFn
  */
-bool MBASub::runOnBasicBlock(BasicBlock &BB) const {
-  bool Changed = false;
+template <unsigned Opcode> struct MBARule;
 
-  for (auto Inst = BB.begin(), IE = BB.end(); Inst != IE; ++Inst) {
-    auto *BinOp = dyn_cast<BinaryOperator>(Inst);
-    if (BinOp == nullptr) {
-      continue;
+// The rules below create one instruction per statement, so that the output
+// does not depend on the evaluation order of function arguments
+
+/**
+ * @brief a + b == (a ^ b) + ((a & b) << 1)
+ */
+template <> struct MBARule<Instruction::Add> {
+  static constexpr const char *Name = "add";
+
+  static unsigned cost(const BinaryOperator &) { return 3; }
+
+  static Value *rewrite(IRBuilder<> &Builder, BinaryOperator &BinOp) {
+    // Shifting an i1 by one is poison
+    if (BinOp.getType()->getIntegerBitWidth() < 2) {
+      return nullptr;
+    }
+
+    Value *A = BinOp.getOperand(0);
+    Value *B = BinOp.getOperand(1);
+    Value *Xor = Builder.CreateXor(A, B);
+    Value *Carry = Builder.CreateShl(Builder.CreateAnd(A, B), 1);
+    return Builder.CreateAdd(Xor, Carry);
+  }
+};
+
+/**
+ * @brief a - b == (a + ~b) + 1
+ */
+template <> struct MBARule<Instruction::Sub> {
+  static constexpr const char *Name = "sub";
+
+  static unsigned cost(const BinaryOperator &) { return 2; }
+
+  static Value *rewrite(IRBuilder<> &Builder, BinaryOperator &BinOp) {
+    Value *A = BinOp.getOperand(0);
+    Value *B = BinOp.getOperand(1);
+    return Builder.CreateAdd(Builder.CreateAdd(A, Builder.CreateNot(B)),
+                             ConstantInt::get(BinOp.getType(), 1));
+  }
+};
+
+/**
+ * @brief a ^ b == (a | b) - (a & b)
+ */
+template <> struct MBARule<Instruction::Xor> {
+  static constexpr const char *Name = "xor";
+
+  static unsigned cost(const BinaryOperator &) { return 2; }
+
+  static Value *rewrite(IRBuilder<> &Builder, BinaryOperator &BinOp) {
+    Value *A = BinOp.getOperand(0);
+    Value *B = BinOp.getOperand(1);
+
+    // Leave ~a alone, it would only turn into (a | -1) - a
+    if (PatternMatch::match(B, PatternMatch::m_AllOnes())) {
+      return nullptr;
+    }
+
+    Value *Or = Builder.CreateOr(A, B);
+    Value *And = Builder.CreateAnd(A, B);
+    return Builder.CreateSub(Or, And);
+  }
+};
+
+/**
+ * @brief a & b == (a + b) - (a | b)
+ */
+template <> struct MBARule<Instruction::And> {
+  static constexpr const char *Name = "and";
+
+  static unsigned cost(const BinaryOperator &) { return 2; }
+
+  static Value *rewrite(IRBuilder<> &Builder, BinaryOperator &BinOp) {
+    Value *A = BinOp.getOperand(0);
+    Value *B = BinOp.getOperand(1);
+    Value *Add = Builder.CreateAdd(A, B);
+    Value *Or = Builder.CreateOr(A, B);
+    return Builder.CreateSub(Add, Or);
+  }
+};
+
+/**
+ * @brief a | b == (a ^ b) + (a & b)
+ */
+template <> struct MBARule<Instruction::Or> {
+  static constexpr const char *Name = "or";
+
+  static unsigned cost(const BinaryOperator &) { return 2; }
+
+  static Value *rewrite(IRBuilder<> &Builder, BinaryOperator &BinOp) {
+    Value *A = BinOp.getOperand(0);
+    Value *B = BinOp.getOperand(1);
+    Value *Xor = Builder.CreateXor(A, B);
+    Value *And = Builder.CreateAnd(A, B);
+    return Builder.CreateAdd(Xor, And);
+  }
+};
+
+/**
+ * @brief a * C == sum of (a << i) over the set bits i of C, or 0 minus that
+ * sum over the set bits of -C when -C has fewer of them
+ */
+template <> struct MBARule<Instruction::Mul> {
+  static constexpr const char *Name = "mul";
+
+  // Past that many terms the rewrite is mostly code growth
+  static constexpr unsigned MaxTerms = 4;
+
+  /**
+   * @brief Splits BinOp into A * Factor, negated if Negate
+   * @return false if the rule does not apply
+   */
+  static bool decompose(const BinaryOperator &BinOp, Value *&A, APInt &Factor,
+                        bool &Negate) {
+    // Constants are canonicalized to the right, but opt may not have run
+    A = BinOp.getOperand(0);
+    auto *C = dyn_cast<ConstantInt>(BinOp.getOperand(1));
+    if (C == nullptr) {
+      A = BinOp.getOperand(1);
+      C = dyn_cast<ConstantInt>(BinOp.getOperand(0));
+    }
+    if (C == nullptr || C->isZero()) {
+      return false;
+    }
+
+    Factor = C->getValue();
+    Negate = (-Factor).countPopulation() < Factor.countPopulation();
+    if (Negate) {
+      Factor.negate();
+    }
+
+    // A factor of 1 or -1 would only simplify the multiply to A or -A
+    return !Factor.isOne() && Factor.countPopulation() <= MaxTerms;
+  }
+
+  static unsigned cost(const BinaryOperator &BinOp) {
+    Value *A;
+    APInt Factor;
+    bool Negate;
+    if (!decompose(BinOp, A, Factor, Negate)) {
+      return 0;
+    }
+
+    // A shift per term but the one of bit 0, the adds, the negation, and
+    // the mul goes away
+    unsigned Terms = Factor.countPopulation();
+    unsigned Insts = (Terms - Factor[0]) + (Terms - 1) + Negate;
+    return Insts > 0 ? Insts - 1 : 0;
+  }
+
+  static Value *rewrite(IRBuilder<> &Builder, BinaryOperator &BinOp) {
+    Value *A;
+    APInt Factor;
+    bool Negate;
+    if (!decompose(BinOp, A, Factor, Negate)) {
+      return nullptr;
+    }
+
+    Value *Sum = nullptr;
+    for (unsigned Bit = 0, Width = Factor.getBitWidth(); Bit < Width; ++Bit) {
+      if (!Factor[Bit]) {
+        continue;
+      }
+
+      Value *Term = Bit == 0 ? A : Builder.CreateShl(A, Bit);
+      Sum = Sum == nullptr ? Term : Builder.CreateAdd(Sum, Term);
     }
 
-    // Only handle sub instruction
-    if (BinOp->getOpcode() != Instruction::Sub) {
+    return Negate ? Builder.CreateNeg(Sum) : Sum;
+  }
+};
+
+namespace {
+
+struct MBARuleInfo {
+  const char *Name;
+  unsigned Opcode;
+  MBASub::RewriteFn Rewrite;
+  MBASub::CostFn Cost;
+};
+
+template <unsigned Opcode> constexpr MBARuleInfo makeRule() {
+  return {MBARule<Opcode>::Name, Opcode, &MBARule<Opcode>::rewrite,
+          &MBARule<Opcode>::cost};
+}
+
+constexpr MBARuleInfo AllRules[] = {
+    makeRule<Instruction::Add>(), makeRule<Instruction::Sub>(),
+    makeRule<Instruction::Mul>(), makeRule<Instruction::And>(),
+    makeRule<Instruction::Or>(),  makeRule<Instruction::Xor>(),
+};
+
+} // namespace
+
+MBASub::MBASub(ArrayRef<unsigned> Opcodes) {
+  for (const MBARuleInfo &Rule : AllRules) {
+    if (Opcodes.empty() || is_contained(Opcodes, Rule.Opcode)) {
+      Rules[Rule.Opcode - Instruction::BinaryOpsBegin] = {Rule.Rewrite,
+                                                          Rule.Cost};
+    }
+  }
+}
+
+std::optional<SmallVector<unsigned, 6>>
+MBASub::parseRules(StringRef Params) {
+  SmallVector<unsigned, 6> Opcodes;
+  SmallVector<StringRef, 6> Names;
+  Params.split(Names, ';', -1, false);
+
+  for (StringRef Name : Names) {
+    const auto *Rule = find_if(
+        AllRules, [Name](const MBARuleInfo &R) { return Name == R.Name; });
+    if (Rule == std::end(AllRules)) {
+      return std::nullopt;
+    }
+
+    Opcodes.push_back(Rule->Opcode);
+  }
+
+  return Opcodes;
+}
+
+/**
+ * @brief MBA Implementation
+ */
+unsigned MBASub::runOnBasicBlock(BasicBlock &BB, std::optional<size_t> &Budget,
+                                 unsigned &OverBudget) const {
+  unsigned NumRewrites = 0;
+
+  // The rewrites are inserted before Inst, so they are never rewritten again
+  for (Instruction &Inst : make_early_inc_range(BB)) {
+    auto *BinOp = dyn_cast<BinaryOperator>(&Inst);
+    if (BinOp == nullptr) {
       continue;
     }
 
@@ -32,45 +281,172 @@ bool MBASub::runOnBasicBlock(BasicBlock &BB) const {
       continue;
     }
 
+    const Rule &R = Rules[BinOp->getOpcode() - Instruction::BinaryOpsBegin];
+    if (R.Rewrite == nullptr) {
+      continue;
+    }
+
+    // A rewrite that does not fit may be followed by a cheaper one that does
+    unsigned Cost = Budget ? R.Cost(*BinOp) : 0;
+    if (Budget && Cost > *Budget) {
+      ++OverBudget;
+      continue;
+    }
+
+    // The rewrite inserts its instructions between Prev and BinOp
+    Instruction *Prev = BinOp->getPrevNode();
     IRBuilder<> Builder(BinOp);
+    Value *NewValue = R.Rewrite(Builder, *BinOp);
+    if (NewValue == nullptr) {
+      continue;
+    }
 
-    // (a + ~b)
-    Value *FirstHalf = Builder.CreateAdd(
-        BinOp->getOperand(0), Builder.CreateNot(BinOp->getOperand(1)));
-    // (a + ~b) + 1
-    Instruction *NewInst = BinaryOperator::CreateAdd(
-        FirstHalf, ConstantInt::get(BinOp->getType(), 1));
+    if (Budget) {
+      *Budget -= Cost;
+    }
 
-    LLVM_DEBUG(dbgs() << *BinOp << " -> " << *NewInst << "\n");
+    LLVM_DEBUG(dbgs() << *BinOp << " -> " << *NewValue << "\n");
 
-    ReplaceInstWithInst(BB.getInstList(), Inst, NewInst);
-    Changed = true;
+    // Only an instruction of the rewrite takes the name, never a value that
+    // was already there
+    auto Inserted = make_range(Prev != nullptr ? std::next(Prev->getIterator())
+                                               : BB.begin(),
+                               BinOp->getIterator());
+    if (any_of(Inserted,
+               [NewValue](Instruction &I) { return &I == NewValue; })) {
+      NewValue->takeName(BinOp);
+    }
+    BinOp->replaceAllUsesWith(NewValue);
+    BinOp->eraseFromParent();
+    ++NumRewrites;
   }
 
-  return Changed;
+  return NumRewrites;
 }
 
-PreservedAnalyses MBASub::run(Function &Func, FunctionAnalysisManager &) const {
-  bool Changed = false;
+PreservedAnalyses MBASub::run(Function &Func,
+                              FunctionAnalysisManager &FAM) const {
+  auto &ORE = FAM.getResult<OptimizationRemarkEmitterAnalysis>(Func);
+
+  if (!FAM.getResult<ObfuscationPolicyAnalysis>(Func).allows(
+          ObfuscationPolicy::MBA)) {
+    LLVM_DEBUG(dbgs() << "Policy excludes " << Func.getName() << "\n");
+    ORE.emit([&] {
+      return OptimizationRemarkMissed(DEBUG_TYPE, "PolicyExcluded", &Func)
+             << "no MBA in " << Func.getName()
+             << ": excluded by the obfuscation policy";
+    });
+    return PreservedAnalyses::all();
+  }
+
+  unsigned InstsBefore = Func.getInstructionCount();
+  unsigned Rewrites = 0;
+  unsigned OverBudget = 0;
+
+  std::optional<size_t> Budget;
+  if (MBABudget != 0) {
+    Budget = MBABudget;
+  }
+  if (MBAMaxGrowth != 0) {
+    size_t GrowthBudget = Func.getInstructionCount() * MBAMaxGrowth / 100;
+    Budget = Budget ? std::min(*Budget, GrowthBudget) : GrowthBudget;
+  }
+
+  if (!Budget) {
+    for (auto &BB : Func) {
+      Rewrites += runOnBasicBlock(BB, Budget, OverBudget);
+    }
+  } else {
+    // Spend the budget on the coldest blocks first, so hot paths are the
+    // last to pay for the extra instructions
+    auto &BFI = FAM.getResult<BlockFrequencyAnalysis>(Func);
+    SmallVector<BasicBlock *, 16> Blocks;
+    for (auto &BB : Func) {
+      Blocks.push_back(&BB);
+    }
+    std::stable_sort(Blocks.begin(), Blocks.end(),
+                     [&BFI](BasicBlock *LHS, BasicBlock *RHS) {
+                       return BFI.getBlockFreq(LHS) < BFI.getBlockFreq(RHS);
+                     });
+
+    for (BasicBlock *BB : Blocks) {
+      Rewrites += runOnBasicBlock(*BB, Budget, OverBudget);
+    }
+  }
 
-  for (auto &BB : Func) {
-    Changed |= runOnBasicBlock(BB);
+  unsigned InstsAfter = Func.getInstructionCount();
+  NumRewritten += Rewrites;
+  NumOverBudget += OverBudget;
+  // No rule shrinks the code, the test only keeps the counter from wrapping
+  if (InstsAfter > InstsBefore) {
+    NumAddedInsts += InstsAfter - InstsBefore;
   }
 
-  return Changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+  if (Rewrites == 0 && OverBudget == 0) {
+    ORE.emit([&] {
+      return OptimizationRemarkMissed(DEBUG_TYPE, "NoCandidates", &Func)
+             << "no MBA in " << Func.getName()
+             << ": no candidate instructions";
+    });
+    return PreservedAnalyses::all();
+  }
+
+  if (Rewrites == 0) {
+    ORE.emit([&] {
+      return OptimizationRemarkMissed(DEBUG_TYPE, "NothingRewritten", &Func)
+             << "no MBA in " << Func.getName() << ": "
+             << ore::NV("OverBudget", OverBudget)
+             << " instructions over budget";
+    });
+    return PreservedAnalyses::all();
+  }
+
+  ORE.emit([&] {
+    return OptimizationRemark(DEBUG_TYPE, "Rewritten", &Func)
+           << "rewrote " << ore::NV("Rewritten", Rewrites)
+           << " instructions of " << Func.getName() << ", "
+           << ore::NV("OverBudget", OverBudget) << " over budget; "
+           << ore::NV("InstsBefore", InstsBefore) << " to "
+           << ore::NV("InstsAfter", InstsAfter) << " instructions";
+  });
+
+  return PreservedAnalyses::none();
 }
 
+/**
+ * @brief MBASub pass registration callback
+ * @note Pass names: "mba-sub" (the sub rule only), "mba" (every rule),
+ * "mba<add;sub;mul;and;or;xor>" (the listed rules)
+ */
 PassPluginLibraryInfo getMBASubPluginInfo() {
   return {LLVM_PLUGIN_API_VERSION, "MBASub", LLVM_VERSION_STRING,
           [](PassBuilder &PB) {
+            registerObfuscationPolicy(PB);
             PB.registerPipelineParsingCallback(
                 [](StringRef Name, FunctionPassManager &FPM,
                    ArrayRef<PassBuilder::PipelineElement>) {
-                  if (Name != "mba-sub") {
+                  if (Name == "mba-sub") {
+                    static constexpr unsigned SubOnly[] = {Instruction::Sub};
+                    FPM.addPass(MBASub(SubOnly));
+                    return true;
+                  }
+
+                  if (Name == "mba") {
+                    FPM.addPass(MBASub());
+                    return true;
+                  }
+
+                  if (!Name.consume_front("mba<") ||
+                      !Name.consume_back(">")) {
+                    return false;
+                  }
+
+                  auto Opcodes = MBASub::parseRules(Name);
+                  if (!Opcodes || Opcodes->empty()) {
                     return false;
                   }
 
-                  FPM.addPass(MBASub());
+                  FPM.addPass(MBASub(*Opcodes));
                   return true;
                 });
           }};
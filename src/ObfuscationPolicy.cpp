@@ -0,0 +1,324 @@
+#include "ObfuscationPolicy.hpp"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/DiagnosticPrinter.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/GlobPattern.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define DEBUG_TYPE "obf-policy"
+
+namespace llvm {
+
+static cl::opt<std::string> ObfPolicyFile(
+    "obf-policy", cl::init(""), cl::value_desc("filename"),
+    cl::desc("Per-function obfuscation rules, one '<name or glob> <cff,mba|"
+             "all|none>' per line, the first matching rule wins"));
+
+AnalysisKey ObfuscationPolicyAnalysis::Key;
+
+static constexpr const char *AnnotationPrefix = "obf=";
+
+static const struct {
+  StringRef Name;
+  unsigned Kinds;
+} PolicyNames[] = {
+    {"cff", ObfuscationPolicy::CFF},
+    {"mba", ObfuscationPolicy::MBA},
+    {"opaque", ObfuscationPolicy::Opaque},
+    {"bcf", ObfuscationPolicy::BCF},
+    {"all", ObfuscationPolicy::All},
+    {"none", ObfuscationPolicy::None},
+};
+
+std::optional<unsigned> ObfuscationPolicy::parse(StringRef Names) {
+  unsigned Enabled = None;
+
+  SmallVector<StringRef, 4> Items;
+  Names.split(Items, ',', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+  for (StringRef Item : Items) {
+    Item = Item.trim();
+    const auto *It = find_if(PolicyNames, [&](const auto &Entry) {
+      return Entry.Name == Item;
+    });
+    if (It == std::end(PolicyNames)) {
+      return std::nullopt;
+    }
+    Enabled |= It->Kinds;
+  }
+
+  return Enabled;
+}
+
+void ObfuscationPolicy::print(raw_ostream &OS) const {
+  if (Enabled == None) {
+    OS << "none";
+    return;
+  }
+
+  ListSeparator LS(",");
+  for (const auto &Entry : PolicyNames) {
+    if (Entry.Kinds != All && Entry.Kinds != None &&
+        allows(Kind(Entry.Kinds))) {
+      OS << LS << Entry.Name;
+    }
+  }
+}
+
+namespace {
+
+/**
+ * @brief The rules of the -obf-policy file, compiled once per process
+ * @note Plain names go to a hash map, only globs are matched in turn, and
+ * only the ones written before the plain name that matched
+ */
+class PolicyRules {
+public:
+  static const PolicyRules &get() {
+    static const PolicyRules Rules(ObfPolicyFile);
+    return Rules;
+  }
+
+  std::optional<unsigned> lookup(StringRef Name) const {
+    unsigned Index = std::numeric_limits<unsigned>::max();
+    auto It = Exact.find(Name);
+    if (It != Exact.end()) {
+      Index = It->second;
+    }
+
+    for (const GlobRule &Rule : Globs) {
+      if (Rule.Index > Index) {
+        break;
+      }
+      if (Rule.Pattern.match(Name)) {
+        return Enabled[Rule.Index];
+      }
+    }
+
+    if (It != Exact.end()) {
+      return Enabled[Index];
+    }
+    return std::nullopt;
+  }
+
+  /**
+   * @brief Why the file couldn't be loaded, empty if it was
+   */
+  StringRef getError() const { return Error; }
+
+  StringRef getText() const { return Text ? Text->getBuffer() : StringRef(); }
+
+private:
+  struct GlobRule {
+    GlobPattern Pattern;
+    unsigned Index;
+  };
+
+  explicit PolicyRules(StringRef Filename) {
+    if (Filename.empty()) {
+      return;
+    }
+
+    auto Buffer = MemoryBuffer::getFile(Filename, /*IsText=*/true);
+    if (!Buffer) {
+      Error = ("can't read obfuscation policy '" + Filename +
+               "': " + Buffer.getError().message())
+                  .str();
+      return;
+    }
+
+    // GlobPattern keeps references to its pattern, so the text has to
+    // outlive the rules
+    Text = std::move(*Buffer);
+    SmallVector<StringRef, 64> Lines;
+    Text->getBuffer().split(Lines, '\n');
+    for (size_t LineNo = 0; LineNo < Lines.size(); ++LineNo) {
+      StringRef Line = Lines[LineNo].split('#').first.trim();
+      if (Line.empty()) {
+        continue;
+      }
+
+      auto [Pattern, Names] = getToken(Line);
+      std::optional<unsigned> Kinds = ObfuscationPolicy::parse(Names);
+      if (Names.trim().empty() || !Kinds) {
+        Error = (Filename + ":" + Twine(LineNo + 1) +
+                 ": expected '<name or glob> <cff,mba|all|none>'")
+                    .str();
+        return;
+      }
+
+      unsigned Index = Enabled.size();
+      Enabled.push_back(*Kinds);
+      if (Pattern.find_first_of("*?[\\") == StringRef::npos) {
+        // The first rule for a name wins
+        Exact.try_emplace(Pattern, Index);
+        continue;
+      }
+
+      Expected<GlobPattern> Glob = GlobPattern::create(Pattern);
+      if (!Glob) {
+        Error = (Filename + ":" + Twine(LineNo + 1) + ": " +
+                 toString(Glob.takeError()))
+                    .str();
+        return;
+      }
+      Globs.push_back({std::move(*Glob), Index});
+    }
+
+    LLVM_DEBUG(dbgs() << "Loaded " << Enabled.size() << " obfuscation rules "
+                      << "from " << Filename << "\n");
+  }
+
+  std::string Error;
+  std::unique_ptr<MemoryBuffer> Text;
+  std::vector<unsigned> Enabled;
+  StringMap<unsigned> Exact;
+  std::vector<GlobRule> Globs;
+};
+
+} // namespace
+
+namespace {
+
+/**
+ * @brief Warning for an obf=... annotation that doesn't parse, which would
+ * otherwise leave the function with the policy it was meant to change
+ */
+class DiagnosticInfoPolicyAnnotation : public DiagnosticInfo {
+public:
+  DiagnosticInfoPolicyAnnotation(const Function &Func, StringRef Annotation)
+      : DiagnosticInfo(getKindID(), DS_Warning), Func(Func),
+        Annotation(Annotation) {}
+
+  void print(DiagnosticPrinter &DP) const override {
+    DP << "ignoring annotation '" << Annotation << "' of " << Func.getName()
+       << ": expected '" << AnnotationPrefix << "<cff,mba|all|none>'";
+  }
+
+private:
+  static int getKindID() {
+    static const int KindID = getNextAvailablePluginDiagnosticKind();
+    return KindID;
+  }
+
+  const Function &Func;
+  StringRef Annotation;
+};
+
+} // namespace
+
+/**
+ * @brief Union of the obf=... annotations of Func, found through its uses
+ * in llvm.global.annotations rather than by scanning every annotation
+ */
+static std::optional<unsigned> getAnnotatedPolicy(Function &Func) {
+  std::optional<unsigned> Result;
+
+  SmallVector<const User *, 4> Users(Func.users());
+  while (!Users.empty()) {
+    const User *U = Users.pop_back_val();
+    if (isa<ConstantExpr>(U)) {
+      // A bitcast to i8* with typed pointers
+      Users.append(U->user_begin(), U->user_end());
+      continue;
+    }
+
+    const auto *Entry = dyn_cast<ConstantStruct>(U);
+    if (Entry == nullptr || Entry->getNumOperands() < 2 ||
+        none_of(Entry->users(), [](const User *Array) {
+          return any_of(Array->users(), [](const User *GV) {
+            return isa<GlobalVariable>(GV) &&
+                   GV->getName() == "llvm.global.annotations";
+          });
+        })) {
+      continue;
+    }
+
+    const auto *Str = dyn_cast<GlobalVariable>(
+        Entry->getOperand(1)->stripPointerCasts());
+    if (Str == nullptr || !Str->hasInitializer()) {
+      continue;
+    }
+    const auto *Data = dyn_cast<ConstantDataArray>(Str->getInitializer());
+    if (Data == nullptr || !Data->isCString()) {
+      continue;
+    }
+
+    StringRef Annotation = Data->getAsCString();
+    if (!Annotation.consume_front(AnnotationPrefix)) {
+      continue;
+    }
+
+    std::optional<unsigned> Kinds = ObfuscationPolicy::parse(Annotation);
+    if (!Kinds) {
+      Func.getContext().diagnose(
+          DiagnosticInfoPolicyAnnotation(Func, Data->getAsCString()));
+      continue;
+    }
+    Result = Result.value_or(ObfuscationPolicy::None) | *Kinds;
+  }
+
+  return Result;
+}
+
+StringRef getObfuscationPolicyText() { return PolicyRules::get().getText(); }
+
+ObfuscationPolicy
+ObfuscationPolicyAnalysis::run(Function &Func,
+                               FunctionAnalysisManager &) const {
+  if (std::optional<unsigned> Kinds = getAnnotatedPolicy(Func)) {
+    return ObfuscationPolicy(*Kinds);
+  }
+
+  const PolicyRules &Rules = PolicyRules::get();
+  if (!Rules.getError().empty()) {
+    // Fatal with the default diagnostic handler, like any error of opt
+    Func.getContext().emitError(Rules.getError());
+  }
+
+  if (std::optional<unsigned> Kinds = Rules.lookup(Func.getName())) {
+    return ObfuscationPolicy(*Kinds);
+  }
+
+  return ObfuscationPolicy();
+}
+
+PreservedAnalyses
+ObfuscationPolicyPrinter::run(Function &Func,
+                              FunctionAnalysisManager &FAM) const {
+  // Diagnostics about the policy come before the line, not within it
+  const auto &Policy = FAM.getResult<ObfuscationPolicyAnalysis>(Func);
+  OS << Func.getName() << ": ";
+  Policy.print(OS);
+  OS << "\n";
+  return PreservedAnalyses::all();
+}
+
+void registerObfuscationPolicy(PassBuilder &PB) {
+  PB.registerPipelineParsingCallback(
+      [](StringRef Name, FunctionPassManager &FPM,
+         ArrayRef<PassBuilder::PipelineElement>) {
+        if (Name != "print<obf-policy>") {
+          return false;
+        }
+
+        FPM.addPass(ObfuscationPolicyPrinter(errs()));
+        return true;
+      });
+  PB.registerAnalysisRegistrationCallback([](FunctionAnalysisManager &FAM) {
+    FAM.registerPass([] { return ObfuscationPolicyAnalysis(); });
+  });
+}
+
+} // namespace llvm
@@ -0,0 +1,25 @@
+#include "ObfuscatorPass.hpp"
+
+namespace llvm {
+
+void registerObfuscatorPasses(PassBuilder &PB) {
+  getOpcodeCounterPluginInfo().RegisterPassBuilderCallbacks(PB);
+  getCFGPrinterPluginInfo().RegisterPassBuilderCallbacks(PB);
+  getMBASubPluginInfo().RegisterPassBuilderCallbacks(PB);
+  getControlFlowFlatteningPluginInfo().RegisterPassBuilderCallbacks(PB);
+  getOpaquePredicatePluginInfo().RegisterPassBuilderCallbacks(PB);
+  getBogusControlFlowPluginInfo().RegisterPassBuilderCallbacks(PB);
+}
+
+/**
+ * @brief All the passes pass registration callback
+ * @note Pass names: "print<opcode-counter>", "print<opcode-counter-module>",
+ * "print<cfg>", "print<loop-cost>", "dot-loop-cost", "print<obf-policy>",
+ * "mba-sub", "mba", "mba<...>", "cff", "cff-profile", "opaque", "bcf"
+ */
+PassPluginLibraryInfo getObfuscatorPassPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "ObfuscatorPass", LLVM_VERSION_STRING,
+          registerObfuscatorPasses};
+}
+
+} // namespace llvm
@@ -0,0 +1,16 @@
+#include "ObfuscatorPass.hpp"
+
+namespace llvm {
+
+/**
+ * @brief Public entry point for dynamically loaded pass plugin
+ * @note Not weak, so it wins over the weak entry points of the single pass
+ * plugins linked into the same library. Only the ObfuscatorPass plugin links
+ * it, ObfuscatorPassStatic leaves it out so the drivers linking the passes
+ * define no entry point of their own
+ */
+extern "C" ::llvm::PassPluginLibraryInfo llvmGetPassPluginInfo() {
+  return getObfuscatorPassPluginInfo();
+}
+
+} // namespace llvm
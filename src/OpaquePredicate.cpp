@@ -0,0 +1,247 @@
+#include "OpaquePredicate.hpp"
+#include "ObfuscationPolicy.hpp"
+#include "ObfuscatorPass.hpp"
+#include "PredicateBuilder.hpp"
+
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "opaque"
+
+namespace llvm {
+
+STATISTIC(NumPredicates, "Number of opaque predicates inserted");
+STATISTIC(NumOverBudget, "Number of branches left alone by the budget");
+STATISTIC(NumFakeExits, "Number of fake returns created");
+
+static cl::opt<unsigned> OpaqueBudget(
+    "opaque-budget", cl::init(8),
+    cl::desc("Maximum number of instructions opaque predicates may add to a "
+             "call of a function, estimated from block frequencies (0 = no "
+             "limit)"));
+
+// Blocks tried as the target of the never-taken edge before settling for a
+// return
+static constexpr unsigned MaxTargetTries = 8;
+
+/**
+ * @brief A later block in reverse post-order, so the new edge makes no loop,
+ * whose immediate dominator dominates BB, so the values it uses still
+ * dominate it, and entered from inside its loop
+ * @return nullptr if the tries found none
+ */
+BasicBlock *OpaquePredicate::getFalseTarget(BasicBlock &BB, BasicBlock *Succ,
+                                            const DominatorTree &DT,
+                                            const LoopInfo &LI,
+                                            RandomNumberGenerator &RNG) {
+  unsigned First = RPOIndex.lookup(&BB) + 1;
+  if (First >= Blocks.size()) {
+    return nullptr;
+  }
+
+  for (unsigned Try = 0; Try < MaxTargetTries; ++Try) {
+    BasicBlock *Target = Blocks[First + RNG() % (Blocks.size() - First)];
+    if (Target == Succ || Target->isEHPad()) {
+      continue;
+    }
+
+    const DomTreeNode *IDom = DT.getNode(Target)->getIDom();
+    if (IDom == nullptr || !DT.dominates(IDom->getBlock(), &BB)) {
+      continue;
+    }
+
+    const Loop *L = LI.getLoopFor(Target);
+    if (L != nullptr && !L->contains(&BB)) {
+      continue;
+    }
+
+    return Target;
+  }
+
+  return nullptr;
+}
+
+/**
+ * @brief A block returning a null value, shared by the predicates finding no
+ * other target
+ */
+BasicBlock *OpaquePredicate::getFakeExit(Function &Func) {
+  if (FakeExit == nullptr) {
+    FakeExit = BasicBlock::Create(Func.getContext(), "OpaqueExit", &Func);
+    ++NumFakeExits;
+    Type *RetTy = Func.getReturnType();
+    ReturnInst::Create(Func.getContext(),
+                       RetTy->isVoidTy() ? nullptr
+                                         : Constant::getNullValue(RetTy),
+                       FakeExit);
+  }
+  return FakeExit;
+}
+
+void OpaquePredicate::insertPredicate(BranchInst *Br, Value *X, Value *Y,
+                                      const DominatorTree &DT,
+                                      const LoopInfo &LI,
+                                      RandomNumberGenerator &RNG) {
+  BasicBlock *BB = Br->getParent();
+  BasicBlock *Succ = Br->getSuccessor(0);
+
+  BasicBlock *Target = getFalseTarget(*BB, Succ, DT, LI, RNG);
+  if (Target == nullptr) {
+    Target = getFakeExit(*BB->getParent());
+  }
+
+  // Any value of the right type does for an edge never taken, one that is
+  // already flowing in looks the part
+  for (PHINode &Phi : Target->phis()) {
+    Value *Incoming = Constant::getNullValue(Phi.getType());
+    for (Value *V : Phi.incoming_values()) {
+      auto *Inst = dyn_cast<Instruction>(V);
+      if (Inst == nullptr || DT.dominates(Inst, Br)) {
+        Incoming = V;
+        break;
+      }
+    }
+    Phi.addIncoming(Incoming, BB);
+  }
+
+  bool Result = RNG() & 1;
+  IRBuilder<> Builder(Br);
+  Value *Cond = createOpaquePredicate(Builder, X, Y, Result, RNG);
+
+  MDNode *Weights = createPredicateWeights(Br->getContext(), Result);
+  BranchInst *NewBr = Result
+                          ? Builder.CreateCondBr(Cond, Succ, Target, Weights)
+                          : Builder.CreateCondBr(Cond, Target, Succ, Weights);
+  NewBr->copyMetadata(*Br, {LLVMContext::MD_loop});
+  Br->eraseFromParent();
+
+  LLVM_DEBUG(dbgs() << "Opaque predicate in " << BB->getName() << " to "
+                    << Target->getName() << "\n");
+}
+
+PreservedAnalyses OpaquePredicate::run(Function &Func,
+                                       FunctionAnalysisManager &FAM) {
+  auto &ORE = FAM.getResult<OptimizationRemarkEmitterAnalysis>(Func);
+
+  if (!FAM.getResult<ObfuscationPolicyAnalysis>(Func).allows(
+          ObfuscationPolicy::Opaque)) {
+    LLVM_DEBUG(dbgs() << "Policy excludes " << Func.getName() << "\n");
+    ORE.emit([&] {
+      return OptimizationRemarkMissed(DEBUG_TYPE, "PolicyExcluded", &Func)
+             << "no opaque predicates in " << Func.getName()
+             << ": excluded by the obfuscation policy";
+    });
+    return PreservedAnalyses::all();
+  }
+
+  // Not the stream of CFF, which would pick its case numbers from the same
+  // values
+  std::unique_ptr<RandomNumberGenerator> RNG =
+      Func.getParent()->createRNG(("opaque." + Func.getName()).str());
+
+  Blocks.clear();
+  RPOIndex.clear();
+  FakeExit = nullptr;
+
+  ReversePostOrderTraversal<Function *> RPOT(&Func);
+  for (BasicBlock *BB : RPOT) {
+    RPOIndex[BB] = Blocks.size();
+    Blocks.push_back(BB);
+  }
+
+  auto &BFI = FAM.getResult<BlockFrequencyAnalysis>(Func);
+  auto &DT = FAM.getResult<DominatorTreeAnalysis>(Func);
+  auto &LI = FAM.getResult<LoopAnalysis>(Func);
+
+  SmallVector<PredicateCandidate, 16> Candidates;
+  auto EntryFreq = static_cast<double>(BFI.getEntryFreq());
+  for (BasicBlock *BB : Blocks) {
+    auto *Br = dyn_cast<BranchInst>(BB->getTerminator());
+    if (Br == nullptr || Br->isConditional()) {
+      continue;
+    }
+
+    auto [X, Y] = getPredicateOperands(*BB);
+    if (X == nullptr) {
+      continue;
+    }
+
+    Candidates.push_back(
+        {BB, X, Y, BFI.getBlockFreq(BB).getFrequency() / EntryFreq});
+  }
+
+  // The new edges don't change the dominator tree nor the loops, so both
+  // stay valid throughout
+  size_t NumCandidates = Candidates.size();
+  unsigned OverBudget = selectWithinBudget(Candidates, OpaqueBudget);
+  unsigned InstsBefore = Func.getInstructionCount();
+  unsigned Inserted = 0;
+  for (const PredicateCandidate &C : Candidates) {
+    insertPredicate(cast<BranchInst>(C.BB->getTerminator()), C.X, C.Y, DT, LI,
+                    *RNG);
+    ++Inserted;
+  }
+
+  NumPredicates += Inserted;
+  NumOverBudget += OverBudget;
+
+  if (Inserted == 0) {
+    ORE.emit([&] {
+      return OptimizationRemarkMissed(DEBUG_TYPE, "NothingInserted", &Func)
+             << "no opaque predicates in " << Func.getName() << ": "
+             << ore::NV("Candidates", NumCandidates)
+             << " candidate branches, "
+             << ore::NV("OverBudget", OverBudget) << " over budget";
+    });
+    return PreservedAnalyses::all();
+  }
+
+  ORE.emit([&] {
+    return OptimizationRemark(DEBUG_TYPE, "Inserted", &Func)
+           << "inserted " << ore::NV("Predicates", Inserted)
+           << " opaque predicates in " << Func.getName() << ", "
+           << ore::NV("OverBudget", OverBudget)
+           << " over budget; " << ore::NV("InstsBefore", InstsBefore)
+           << " to " << ore::NV("InstsAfter", Func.getInstructionCount())
+           << " instructions";
+  });
+
+  return PreservedAnalyses::none();
+}
+
+/**
+ * @brief OpaquePredicate pass registration callback
+ * @note Pass name: "opaque"
+ */
+PassPluginLibraryInfo getOpaquePredicatePluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "OpaquePredicate", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            registerObfuscationPolicy(PB);
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, FunctionPassManager &FPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name != "opaque") {
+                    return false;
+                  }
+
+                  FPM.addPass(OpaquePredicate());
+                  return true;
+                });
+          }};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getOpaquePredicatePluginInfo();
+}
+
+} // namespace llvm
@@ -1,16 +1,31 @@
 #include "OpcodeCounter.hpp"
+#include "ObfuscatorPass.hpp"
 
 #include "llvm/IR/InstIterator.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include <algorithm>
+#include <vector>
 
 namespace llvm {
 
+static cl::opt<unsigned> OpcodeCounterThreads(
+    "opcode-counter-threads", cl::init(0),
+    cl::desc("Threads used by print<opcode-counter-module> "
+             "(0 = all hardware threads)"));
+
 static void printOpcodeCounterResult(raw_ostream &,
                                      const ResultOpcodeCounter &);
 
+static void printModuleOpcodeCounterJSON(raw_ostream &, const Module &,
+                                         const ResultModuleOpcodeCounter &);
+
 AnalysisKey OpcodeCounter::Key;
+AnalysisKey ModuleOpcodeCounter::Key;
 
 /**
  * @brief OpcodeCounter implementation
@@ -18,20 +33,57 @@ AnalysisKey OpcodeCounter::Key;
 OpcodeCounter::Result
 OpcodeCounter::run(const Function &Func,
                    const FunctionAnalysisManager &) const {
+  return countOpcodes(Func);
+}
+
+OpcodeCounter::Result OpcodeCounter::countOpcodes(const Function &Func) {
   OpcodeCounter::Result OpcodeMap;
 
   for (const_inst_iterator I = inst_begin(Func), E = inst_end(Func); I != E;
        ++I) {
-    StringRef Name = I->getOpcodeName();
+    OpcodeMap.count(I->getOpcode());
+  }
 
-    if (OpcodeMap.find(Name) == OpcodeMap.end()) {
-      OpcodeMap[Name] = 1;
-    } else {
-      OpcodeMap[Name]++;
+  return OpcodeMap;
+}
+
+/**
+ * @brief ModuleOpcodeCounter implementation
+ */
+ModuleOpcodeCounter::Result
+ModuleOpcodeCounter::run(Module &M, ModuleAnalysisManager &) const {
+  std::vector<const Function *> Funcs;
+  for (const Function &Func : M) {
+    if (!Func.isDeclaration()) {
+      Funcs.push_back(&Func);
     }
   }
 
-  return OpcodeMap;
+  ModuleOpcodeCounter::Result ModuleMap;
+  ModuleMap.NumFunctions = Funcs.size();
+
+  // One partial result per task, so tasks never write to shared state.
+  // A few tasks per thread keep them balanced without paying a task per
+  // (usually tiny) function
+  ThreadPool Pool(hardware_concurrency(OpcodeCounterThreads));
+  size_t NumTasks = std::min<size_t>(Funcs.size(),
+                                     Pool.getThreadCount() * 4);
+  std::vector<ResultOpcodeCounter> Partials(NumTasks);
+
+  for (size_t Task = 0; Task < NumTasks; ++Task) {
+    Pool.async([&Funcs, &Partials, Task, NumTasks] {
+      for (size_t I = Task; I < Funcs.size(); I += NumTasks) {
+        Partials[Task].merge(OpcodeCounter::countOpcodes(*Funcs[I]));
+      }
+    });
+  }
+  Pool.wait();
+
+  for (const ResultOpcodeCounter &Partial : Partials) {
+    ModuleMap.Total.merge(Partial);
+  }
+
+  return ModuleMap;
 }
 
 /**
@@ -46,9 +98,19 @@ OpcodeCounterPrinter::run(Function &Func, FunctionAnalysisManager &FAM) const {
   return PreservedAnalyses::all();
 }
 
+/**
+ * @brief ModuleOpcodeCounterPrinter implementation
+ */
+PreservedAnalyses
+ModuleOpcodeCounterPrinter::run(Module &M, ModuleAnalysisManager &MAM) const {
+  const auto &ModuleMap = MAM.getResult<ModuleOpcodeCounter>(M);
+  printModuleOpcodeCounterJSON(OS, M, ModuleMap);
+  return PreservedAnalyses::all();
+}
+
 /**
  * @brief OpcodeCounter and OpcodeCounterPrinter pass registration callback
- * @note Pass name: "print<opcode-counter>"
+ * @note Pass names: "print<opcode-counter>", "print<opcode-counter-module>"
  */
 PassPluginLibraryInfo getOpcodeCounterPluginInfo() {
   return {LLVM_PLUGIN_API_VERSION, "OpcodeCounter", LLVM_VERSION_STRING,
@@ -63,10 +125,24 @@ PassPluginLibraryInfo getOpcodeCounterPluginInfo() {
                   FPM.addPass(OpcodeCounterPrinter(errs()));
                   return true;
                 });
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name != "print<opcode-counter-module>") {
+                    return false;
+                  }
+
+                  MPM.addPass(ModuleOpcodeCounterPrinter(outs()));
+                  return true;
+                });
             PB.registerAnalysisRegistrationCallback(
                 [](FunctionAnalysisManager &FAM) {
                   FAM.registerPass([] { return OpcodeCounter(); });
                 });
+            PB.registerAnalysisRegistrationCallback(
+                [](ModuleAnalysisManager &MAM) {
+                  MAM.registerPass([] { return ModuleOpcodeCounter(); });
+                });
           }};
 }
 
@@ -87,10 +163,46 @@ static void printOpcodeCounterResult(raw_ostream &OutS,
   OutS << "=================================================\n";
   OutS << formatv(format, "OPCODE", "#TIMES USED");
   OutS << "-------------------------------------------------\n";
-  for (const auto &Inst : OpcodeMap) {
-    OutS << formatv(format, Inst.getKey(), Inst.getValue());
+  for (unsigned Opcode = 0; Opcode < ResultOpcodeCounter::NumOpcodes;
+       ++Opcode) {
+    if (OpcodeMap[Opcode] == 0) {
+      continue;
+    }
+    OutS << formatv(format, Instruction::getOpcodeName(Opcode),
+                    OpcodeMap[Opcode]);
   }
   OutS << "-------------------------------------------------\n\n";
 }
 
+/**
+ * @brief Helper function to print the module totals as a single line of JSON,
+ * e.g. {"module":"m.ll","functions":2,"instructions":9,"opcodes":{"ret":2,...}}
+ */
+static void
+printModuleOpcodeCounterJSON(raw_ostream &OutS, const Module &M,
+                             const ResultModuleOpcodeCounter &ModuleMap) {
+  size_t NumInsts = 0;
+  for (unsigned Opcode = 0; Opcode < ResultOpcodeCounter::NumOpcodes;
+       ++Opcode) {
+    NumInsts += ModuleMap.Total[Opcode];
+  }
+
+  json::OStream JOS(OutS);
+  JOS.object([&] {
+    JOS.attribute("module", M.getModuleIdentifier());
+    JOS.attribute("functions", static_cast<int64_t>(ModuleMap.NumFunctions));
+    JOS.attribute("instructions", static_cast<int64_t>(NumInsts));
+    JOS.attributeObject("opcodes", [&] {
+      for (unsigned Opcode = 0; Opcode < ResultOpcodeCounter::NumOpcodes;
+           ++Opcode) {
+        if (ModuleMap.Total[Opcode] != 0) {
+          JOS.attribute(Instruction::getOpcodeName(Opcode),
+                        static_cast<int64_t>(ModuleMap.Total[Opcode]));
+        }
+      }
+    });
+  });
+  OutS << "\n";
+}
+
 } // namespace llvm
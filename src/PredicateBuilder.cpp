@@ -0,0 +1,111 @@
+#include "PredicateBuilder.hpp"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/MDBuilder.h"
+#include <algorithm>
+
+namespace llvm {
+
+std::pair<Value *, Value *> getPredicateOperands(BasicBlock &BB) {
+  Value *X = nullptr;
+  Value *Y = nullptr;
+  auto Add = [&](Value *V) {
+    auto *Ty = dyn_cast<IntegerType>(V->getType());
+    if (Ty == nullptr || Ty->getBitWidth() < MinPredicateBitWidth) {
+      return;
+    }
+    if (X == nullptr) {
+      X = V;
+    } else if (Y == nullptr && V->getType() == X->getType()) {
+      Y = V;
+    }
+  };
+
+  // What the block computed last is the likeliest to still be in a register
+  for (Instruction &Inst : reverse(BB)) {
+    if (Y != nullptr) {
+      break;
+    }
+    Add(&Inst);
+  }
+  for (Argument &Arg : BB.getParent()->args()) {
+    if (Y != nullptr) {
+      break;
+    }
+    Add(&Arg);
+  }
+
+  return {X, Y};
+}
+
+Value *createOpaquePredicate(IRBuilder<> &Builder, Value *X, Value *Y,
+                             bool Result, RandomNumberGenerator &RNG) {
+  auto *Ty = cast<IntegerType>(X->getType());
+
+  // Without the freeze, an undef operand could be a different value at each
+  // use and the predicate anything. It is free in the generated code
+  X = Builder.CreateFreeze(X);
+  Value *Square = Builder.CreateMul(X, X);
+
+  // Squares are 0, 1 or 4 modulo 8
+  Value *Other;
+  if (Y == nullptr) {
+    // x * x != 8k + 5
+    Other = ConstantInt::get(Ty, (RNG() << 3) | 5);
+  } else {
+    // x * x != (8k + 7) * y * y - (8l + 1), which is 7, 6 or 3 modulo 8
+    Y = Builder.CreateFreeze(Y);
+    Value *YSquare = Builder.CreateMul(Y, Y);
+    Value *Scaled =
+        Builder.CreateMul(YSquare, ConstantInt::get(Ty, (RNG() << 3) | 7));
+    Other = Builder.CreateSub(Scaled, ConstantInt::get(Ty, (RNG() << 3) | 1));
+  }
+
+  return Result ? Builder.CreateICmpNE(Square, Other)
+                : Builder.CreateICmpEQ(Square, Other);
+}
+
+MDNode *createPredicateWeights(LLVMContext &Ctx, bool Result) {
+  static constexpr uint32_t TakenWeight = 2000;
+  static constexpr uint32_t NotTakenWeight = 1;
+
+  MDBuilder MDB(Ctx);
+  return Result ? MDB.createBranchWeights(TakenWeight, NotTakenWeight)
+                : MDB.createBranchWeights(NotTakenWeight, TakenWeight);
+}
+
+unsigned selectWithinBudget(SmallVectorImpl<PredicateCandidate> &Candidates,
+                            unsigned Budget) {
+  if (Budget == 0) {
+    return 0;
+  }
+
+  // Hot paths are the last to pay for the predicates
+  std::stable_sort(Candidates.begin(), Candidates.end(),
+                   [](const PredicateCandidate &LHS,
+                      const PredicateCandidate &RHS) {
+                     return LHS.Freq < RHS.Freq;
+                   });
+
+  double Left = Budget;
+  SmallVector<PredicateCandidate, 16> Selected;
+  for (PredicateCandidate &C : Candidates) {
+    if (getPredicateCost(C.Y != nullptr) * C.Freq > Left) {
+      C.Y = nullptr;
+    }
+    double Cost = getPredicateCost(C.Y != nullptr) * C.Freq;
+    if (Cost > Left) {
+      continue;
+    }
+    Left -= Cost;
+    Selected.push_back(C);
+  }
+
+  unsigned Dropped = Candidates.size() - Selected.size();
+  Candidates.assign(Selected.begin(), Selected.end());
+  return Dropped;
+}
+
+} // namespace llvm
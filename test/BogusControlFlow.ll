@@ -0,0 +1,133 @@
+; RUN: opt -load %shlibdir/libBogusControlFlow%shlibext -load-pass-plugin %shlibdir/libBogusControlFlow%shlibext -passes="bcf" -S %s | FileCheck %s
+; RUN: opt -load %shlibdir/libBogusControlFlow%shlibext -load-pass-plugin %shlibdir/libBogusControlFlow%shlibext -passes="bcf" -bcf-budget=0 -S %s | FileCheck %s --check-prefix=ALL
+; RUN: opt -load %shlibdir/libBogusControlFlow%shlibext -load-pass-plugin %shlibdir/libBogusControlFlow%shlibext -passes="bcf" -bcf-budget=0 %s | lli
+; RUN: opt -load %shlibdir/libBogusControlFlow%shlibext -load-pass-plugin %shlibdir/libBogusControlFlow%shlibext -passes="function(bcf),default<O2>" -bcf-budget=0 %s | llc -O2 -stop-after=block-placement -o - | FileCheck %s --check-prefix=LAYOUT
+
+; The blocks get an opaque predicate, whose never-taken edge goes to a block
+; at the end of the function computing the junk, with no call and no new
+; function. The junk replaces one of the values of the block through a phi,
+; so no optimization can drop the edge. The default budget of 8 per call
+; leaves out the blocks of the loop.
+; After block placement the original blocks keep their order, the hot loop
+; stays in one piece and the junk blocks are laid out after the code falling
+; through to them.
+
+; CHECK-LABEL: @clamp_sum(
+; CHECK:       negative:
+; CHECK-NEXT:    [[X:%.*]] = freeze i32 %n
+; CHECK-NEXT:    [[SQ:%.*]] = mul i32 [[X]], [[X]]
+; CHECK:         [[P:%.*]] = icmp {{eq|ne}} i32 [[SQ]], {{.*}}
+; CHECK-NEXT:    br i1 [[P]], label %{{negative.body|negative.bogus}}, label %{{negative.body|negative.bogus}}, !prof
+; CHECK:       negative.body:
+; CHECK-NEXT:    [[N:%.*]] = phi i32 [ %n, %negative ], [ [[JUNK:%.*]], %negative.bogus ]
+; CHECK-NEXT:    %abs = sub i32 0, [[N]]
+; CHECK:       loop:
+; CHECK-NOT:     freeze
+; CHECK:       latch:
+; CHECK-NOT:     freeze
+; CHECK:       exit:
+; CHECK:         br i1 %{{.*}}, label %{{exit.body|exit.bogus}}, label %{{exit.body|exit.bogus}}, !prof
+; CHECK:       negative.bogus:
+; CHECK-NOT:     call
+; CHECK:         [[JUNK]] = xor i32 {{.*}}, {{-?[0-9]+}}
+; CHECK-NEXT:    br label %negative.body
+; CHECK:       exit.bogus:
+; CHECK-NOT:     call
+; CHECK:         xor i32 {{.*}}, {{-?[0-9]+}}
+; CHECK-NEXT:    br label %exit.body
+; CHECK-NEXT:  }
+; CHECK-NOT:   bcf
+
+; ALL-LABEL: @clamp_sum(
+; ALL:       even:
+; ALL:         br i1 %{{.*}}, label %{{even.body|even.bogus}}, label %{{even.body|even.bogus}}, !prof
+; ALL:       even.body:
+; ALL:         %acc.even = add i32
+
+; LAYOUT-LABEL: name: clamp_sum
+; LAYOUT-NOT:     .bogus:
+; LAYOUT:         .negative.body:
+; LAYOUT-NOT:     .bogus:
+; LAYOUT:         .loop.preheader:
+; LAYOUT-NOT:     .bogus:
+; LAYOUT:         .loop{{( \(align [0-9]+\))?}}:
+; LAYOUT-NOT:     .bogus:
+; LAYOUT:         .even:
+; LAYOUT-NOT:     .bogus:
+; LAYOUT:         .latch.body:
+; LAYOUT:         .bogus:
+; LAYOUT-LABEL: name: pick
+; LAYOUT-NOT:     .bogus:
+; LAYOUT:         .less.body:
+; LAYOUT-NOT:     .bogus:
+; LAYOUT:         .more.body:
+; LAYOUT-NOT:     .bogus:
+; LAYOUT:         .join.body:
+; LAYOUT-NOT:     .body:
+; LAYOUT:         .join.bogus:
+; LAYOUT-LABEL: name: main
+
+define i32 @clamp_sum(i32 %n, i32 %lo) {
+entry:
+  %neg = icmp slt i32 %n, 0
+  br i1 %neg, label %negative, label %loop.preheader
+
+negative:
+  %abs = sub i32 0, %n
+  br label %loop.preheader
+
+loop.preheader:
+  %m = phi i32 [ %abs, %negative ], [ %n, %entry ]
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %loop.preheader ], [ %i.next, %latch ]
+  %acc = phi i32 [ 0, %loop.preheader ], [ %acc.next, %latch ]
+  %odd = and i32 %i, 1
+  %even.i = icmp eq i32 %odd, 0
+  br i1 %even.i, label %even, label %latch
+
+even:
+  %acc.even = add i32 %acc, %i
+  br label %latch
+
+latch:
+  %acc.next = phi i32 [ %acc, %loop ], [ %acc.even, %even ]
+  %i.next = add i32 %i, 1
+  %done = icmp sge i32 %i.next, %m
+  br i1 %done, label %exit, label %loop
+
+exit:
+  %r = add i32 %acc.next, %lo
+  ret i32 %r
+}
+
+define i32 @pick(i32 %a, i32 %b) {
+entry:
+  %lt = icmp slt i32 %a, %b
+  br i1 %lt, label %less, label %more
+
+less:
+  %d1 = sub i32 %b, %a
+  br label %join
+
+more:
+  %d2 = sub i32 %a, %b
+  br label %join
+
+join:
+  %d = phi i32 [ %d1, %less ], [ %d2, %more ]
+  ret i32 %d
+}
+
+define i32 @main() {
+  %s = call i32 @clamp_sum(i32 -10, i32 1)
+  %p = call i32 @pick(i32 3, i32 10)
+  %q = call i32 @pick(i32 10, i32 3)
+  %t = add i32 %p, %q
+  %ok1 = icmp eq i32 %s, 21
+  %ok2 = icmp eq i32 %t, 14
+  %ok = and i1 %ok1, %ok2
+  %ret = select i1 %ok, i32 0, i32 1
+  ret i32 %ret
+}
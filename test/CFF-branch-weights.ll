@@ -0,0 +1,121 @@
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -S %s | FileCheck %s
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" %s | lli
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-dispatch=indirect -S %s | FileCheck %s --check-prefix=INDIRECT
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-dispatch=indirect %s | lli
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -S %s | FileCheck %s --check-prefix=SPARSE
+
+; The branch weights survive flattening. Each case of the dispatcher is
+; weighted by the frequency of the edges dispatched to it: %loop is entered
+; once per call and then 127 times out of 128 from %latch, %slow once in 1024
+; iterations. The selects of the next state, and with -cff-dispatch=indirect
+; the indirectbr, keep the weights of the branches they replace.
+
+; CHECK-LABEL: @count(
+; CHECK:         switch i32 %SwitchVar, label %DefaultCase [
+; CHECK-NEXT:      i32 [[LOOP:[0-9]+]], label %loop
+; CHECK-NEXT:      i32 [[SLOW:[0-9]+]], label %slow
+; CHECK-NEXT:      i32 [[LATCH:[0-9]+]], label %latch
+; CHECK-NEXT:      i32 [[EXIT:[0-9]+]], label %exit
+; CHECK-NEXT:    ], !prof [[CASES:![0-9]+]]
+; CHECK:       loop:
+; CHECK:         select i1 %rare, i32 [[SLOW]], i32 [[LATCH]], !prof [[RARE:![0-9]+]]
+; CHECK:       latch:
+; CHECK:         select i1 %done, i32 [[EXIT]], i32 [[LOOP]], !prof [[DONE:![0-9]+]]
+; CHECK-DAG:   [[CASES]] = !{!"branch_weights", i32 0, i32 8192, i32 8, i32 8192, i32 64}
+; CHECK-DAG:   [[RARE]] = !{!"branch_weights", i32 1, i32 1023}
+; CHECK-DAG:   [[DONE]] = !{!"branch_weights", i32 1, i32 127}
+
+; INDIRECT-LABEL: @count(
+; INDIRECT:       loop:
+; INDIRECT:         select i1 %rare, {{.*}}, !prof [[RARE:![0-9]+]]
+; INDIRECT:         indirectbr ptr %{{.*}}, [label %slow, label %latch], !prof [[RARE]]
+; INDIRECT:       latch:
+; INDIRECT:         select i1 %done, {{.*}}, !prof [[DONE:![0-9]+]]
+; INDIRECT:         indirectbr ptr %{{.*}}, [label %exit, label %loop], !prof [[DONE]]
+; INDIRECT-DAG:   [[RARE]] = !{!"branch_weights", i32 1, i32 1023}
+; INDIRECT-DAG:   [[DONE]] = !{!"branch_weights", i32 1, i32 127}
+
+define i32 @count(i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %acc = phi i32 [ 1, %entry ], [ %acc.next, %latch ]
+  %low = and i32 %i, 1023
+  %rare = icmp eq i32 %low, 0
+  br i1 %rare, label %slow, label %latch, !prof !0
+
+slow:
+  %acc.slow = mul i32 %acc, 3
+  br label %latch
+
+latch:
+  %acc.next = phi i32 [ %acc, %loop ], [ %acc.slow, %slow ]
+  %i.next = add i32 %i, 1
+  %done = icmp sge i32 %i.next, %n
+  br i1 %done, label %exit, label %loop, !prof !1
+
+exit:
+  ret i32 %acc.next
+}
+
+define i32 @main() {
+  %r = call i32 @count(i32 2048)
+  %ok = icmp eq i32 %r, 9
+  %ret = select i1 %ok, i32 0, i32 1
+  ret i32 %ret
+}
+
+; The switch of @sparse is too sparse for a lookup and has too many cases for
+; selects, so it isn't fused: only its cases go through the dispatcher and
+; its default edge to %other stays direct, leaving %other a weight of 0.
+
+; SPARSE-LABEL: @sparse(
+; SPARSE:         switch i32 %SwitchVar, label %DefaultCase [
+; SPARSE:         ], !prof [[CASES:![0-9]+]]
+; SPARSE:       entry:
+; SPARSE-NEXT:    switch i32 %x, label %other [
+; SPARSE-DAG:   [[CASES]] = !{!"branch_weights", i32 0, i32 8039, i32 7, i32 7, i32 7, i32 7, i32 7, i32 0, i32 8039}
+
+define i32 @sparse(i32 %x) {
+entry:
+  switch i32 %x, label %other [
+    i32 0, label %a
+    i32 1000, label %b
+    i32 2000, label %c
+    i32 3000, label %d
+    i32 4000, label %e
+  ], !prof !2
+
+a:
+  br label %exit
+
+b:
+  br label %exit
+
+c:
+  br label %exit
+
+d:
+  br label %exit
+
+e:
+  br label %exit
+
+other:
+  br label %exit
+
+exit:
+  %r = phi i32 [ 1, %a ], [ 2, %b ], [ 3, %c ], [ 4, %d ], [ 5, %e ], [ 0, %other ]
+  ret i32 %r
+}
+
+!0 = !{!"branch_weights", i32 1, i32 1023}
+!1 = !{!"branch_weights", i32 1, i32 127}
+!2 = !{!"branch_weights", i32 1000, i32 1, i32 1, i32 1, i32 1, i32 1}
@@ -0,0 +1,68 @@
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-dispatch=indirect -S %s | FileCheck %s
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-dispatch=indirect %s | lli
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-dispatch=indirect -cff-max-cases=2 %s | lli
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-dispatch=indirect -cff-max-cases=1 -S %s > %t.one.ll
+; RUN: FileCheck %s --check-prefix=ONE < %t.one.ll
+; RUN: grep indirectbr %t.one.ll | not grep -E 'label (%[0-9]+), label \1\]'
+; RUN: lli %t.one.ll
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="function(cff),default<O2>" -cff-dispatch=indirect %s \
+; RUN:   | llc -O2 -relocation-model=pic | FileCheck %s --check-prefix=ASM
+
+; test/input/while.c with threaded dispatch: no switch loop, every flattened
+; block loads its successor's address from an encoded table and jumps there
+; with an indirectbr. The table survives -O2 and is lowered to block
+; addresses plus the key.
+
+; CHECK:       @main.cff.table = private constant [3 x ptr] [ptr getelementptr (i8, ptr blockaddress(@main, %{{[0-9]+}}), i64 [[KEY:[0-9]+]]), ptr getelementptr (i8, ptr blockaddress(@main, %{{[0-9]+}}), i64 [[KEY]]), ptr getelementptr (i8, ptr blockaddress(@main, %{{[0-9]+}}), i64 [[KEY]])]
+; CHECK-LABEL: @main(
+; CHECK-NOT:     switch
+; CHECK:         [[ENC:%.*]] = load volatile ptr, ptr getelementptr inbounds ([3 x ptr], ptr @main.cff.table, i32 0, i32 {{[0-2]}})
+; CHECK-NEXT:    [[TARGET:%.*]] = getelementptr i8, ptr [[ENC]], i64 -[[KEY]]
+; CHECK-NEXT:    indirectbr ptr [[TARGET]], [label %[[HEADER:[0-9]+]], label %{{[0-9]+}}]
+; CHECK:       [[HEADER]]:
+; CHECK:         [[SLOT:%.*]] = select i1 {{%.*}}, ptr getelementptr inbounds ([3 x ptr], ptr @main.cff.table, i32 0, i32 {{[0-2]}}), ptr getelementptr inbounds ([3 x ptr], ptr @main.cff.table, i32 0, i32 {{[0-2]}})
+; CHECK-NEXT:    [[ENC2:%.*]] = load volatile ptr, ptr [[SLOT]]
+; CHECK-NEXT:    [[TARGET2:%.*]] = getelementptr i8, ptr [[ENC2]], i64 -[[KEY]]
+; CHECK-NEXT:    indirectbr ptr [[TARGET2]], [label %{{[0-9]+}}, label %{{[0-9]+}}]
+; CHECK-NOT:     switch
+
+; With one block per table, the decoy comes from another table rather than
+; being the target again.
+
+; ONE-COUNT-3: @main.cff.table{{.*}} = private constant [1 x ptr]
+; ONE-LABEL:   @main(
+; ONE:           indirectbr ptr %{{.*}}, [label %{{[0-9]+}}, label %{{[0-9]+}}]
+
+; ASM-LABEL: main:
+; ASM:         jmpq *
+; ASM:       .quad .Ltmp{{[0-9]+}}+{{[0-9]+}}
+
+define dso_local i32 @main() #0 {
+  %1 = alloca i32, align 4
+  %2 = alloca i32, align 4
+  store i32 0, ptr %1, align 4
+  store i32 0, ptr %2, align 4
+  br label %3
+
+3:
+  %4 = load i32, ptr %2, align 4
+  %5 = icmp slt i32 %4, 69
+  br i1 %5, label %6, label %9
+
+6:
+  %7 = load i32, ptr %2, align 4
+  %8 = add nsw i32 %7, 1
+  store i32 %8, ptr %2, align 4
+  br label %3
+
+9:
+  %10 = load i32, ptr %2, align 4
+  %11 = icmp ne i32 %10, 69
+  %12 = zext i1 %11 to i32
+  ret i32 %12
+}
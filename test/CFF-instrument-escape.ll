@@ -0,0 +1,66 @@
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-instrument %s -o %t.bc
+; RUN: env CFF_PROFILE_FILE=%t.json \
+; RUN:   lli --dlopen=%shlibdir/libObfuscatorProfile%shlibext %t.bc
+; RUN: FileCheck %s --check-prefix=PROFILE < %t.json
+; RUN: obfuscator-profdata %t.json -o %t.hot
+; RUN: FileCheck %s --check-prefix=HOT < %t.hot
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-hot-list=%t.hot -S %s | FileCheck %s --check-prefix=SKIP
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-hot-list=%t.hot %s | lli
+
+; Block names may hold spaces, '#' or look like the number of an unnamed
+; block. Their keys escape those as "\XX", so a hot list still has one key
+; per line before the comment, and the loop of "hot #1" and "%9" is kept out
+; of the dispatcher.
+
+; PROFILE:     {"version":1,"functions":[{"name":"count","blocks":{
+; PROFILE-DAG:   "hot\\20\\231":2048
+; PROFILE-DAG:   "slow":2
+; PROFILE-DAG:   "\\259":2048
+; PROFILE-DAG:   "exit":1
+
+; HOT:      count \259  # 2048
+; HOT-NEXT: count hot\20\231  # 2048
+; HOT-NOT:  count
+
+; SKIP-LABEL: @count(
+; SKIP:       "hot #1":
+; SKIP:         br i1 %rare, label %slow, label %"%9"
+; SKIP:       slow:
+; SKIP:         br label %"%9"
+; SKIP:       "%9":
+; SKIP:         br i1 %done, label %exit, label %"hot #1"
+
+define i32 @count(i32 %n) {
+entry:
+  br label %"hot #1"
+
+"hot #1":
+  %i = phi i32 [ 0, %entry ], [ %i.next, %"%9" ]
+  %acc = phi i32 [ 1, %entry ], [ %acc.next, %"%9" ]
+  %low = and i32 %i, 1023
+  %rare = icmp eq i32 %low, 0
+  br i1 %rare, label %slow, label %"%9"
+
+slow:
+  %acc.slow = mul i32 %acc, 3
+  br label %"%9"
+
+"%9":
+  %acc.next = phi i32 [ %acc, %"hot #1" ], [ %acc.slow, %slow ]
+  %i.next = add i32 %i, 1
+  %done = icmp sge i32 %i.next, %n
+  br i1 %done, label %exit, label %"hot #1"
+
+exit:
+  ret i32 %acc.next
+}
+
+define i32 @main() {
+  %r = call i32 @count(i32 2048)
+  %ok = icmp eq i32 %r, 9
+  %ret = select i1 %ok, i32 0, i32 1
+  ret i32 %ret
+}
@@ -0,0 +1,68 @@
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-instrument %s -o %t.a.bc
+; RUN: sed -e 's/"a\.c"/"b.c"/' -e 's/@run_a/@run_b/' -e '/^declare/d' \
+; RUN:     -e '/^define i32 @main/,/^}/d' %s \
+; RUN:   | opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:       -passes="cff" -cff-instrument -o %t.b.bc
+; RUN: env CFF_PROFILE_FILE=%t.json \
+; RUN:   lli --dlopen=%shlibdir/libObfuscatorProfile%shlibext \
+; RUN:       --extra-module=%t.b.bc %t.a.bc
+; RUN: FileCheck %s --check-prefix=PROFILE < %t.json
+; RUN: obfuscator-profdata -hot-cutoff=500000 %t.json -o %t.hot
+; RUN: FileCheck %s --check-prefix=HOT < %t.hot
+
+; Two modules, built from a.c and b.c, each with a static @step. Their
+; counters are kept apart by the source file, and written out once for both
+; modules.
+
+; PROFILE:     {"version":1,"functions":[
+; PROFILE-DAG:   {"name":"a.c:step","blocks":{{{.*}}"loop":2048
+; PROFILE-DAG:   {"name":"b.c:step","blocks":{{{.*}}"loop":1024
+; PROFILE-NOT: "version"
+
+; HOT:      a.c:step latch  # 2048
+; HOT-NEXT: a.c:step loop  # 2048
+; HOT-NOT:  step
+
+source_filename = "a.c"
+
+define internal i32 @step(i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %acc = phi i32 [ 1, %entry ], [ %acc.next, %latch ]
+  %low = and i32 %i, 1023
+  %rare = icmp eq i32 %low, 0
+  br i1 %rare, label %slow, label %latch
+
+slow:
+  %acc.slow = mul i32 %acc, 3
+  br label %latch
+
+latch:
+  %acc.next = phi i32 [ %acc, %loop ], [ %acc.slow, %slow ]
+  %i.next = add i32 %i, 1
+  %done = icmp sge i32 %i.next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret i32 %acc.next
+}
+
+define i32 @run_a(i32 %n) {
+  %r = call i32 @step(i32 %n)
+  ret i32 %r
+}
+
+declare i32 @run_b(i32)
+
+define i32 @main() {
+  %a = call i32 @run_a(i32 2048)
+  %b = call i32 @run_b(i32 1024)
+  %sum = add i32 %a, %b
+  %ok = icmp eq i32 %sum, 12
+  %ret = select i1 %ok, i32 0, i32 1
+  ret i32 %ret
+}
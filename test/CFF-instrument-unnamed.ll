@@ -0,0 +1,66 @@
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-instrument %s -o %t.bc
+; RUN: env CFF_PROFILE_FILE=%t.json \
+; RUN:   lli --dlopen=%shlibdir/libObfuscatorProfile%shlibext %t.bc
+; RUN: FileCheck %s --check-prefix=PROFILE < %t.json
+; RUN: obfuscator-profdata %t.json -o %t.hot
+; RUN: FileCheck %s --check-prefix=HOT < %t.hot
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-hot-list=%t.hot -S %s | FileCheck %s --check-prefix=SKIP
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-hot-list=%t.hot %s | lli
+
+; Blocks with no name are keyed by their number, which the '#' comments of a
+; hot list leave alone: the loop of %2 and %9 is found hot and kept out of
+; the dispatcher, with its PHIs.
+
+; PROFILE:     {"version":1,"functions":[{"name":"count","blocks":{
+; PROFILE-DAG:   "%2":2048
+; PROFILE-DAG:   "%7":2
+; PROFILE-DAG:   "%9":2048
+; PROFILE-DAG:   "%13":1
+
+; HOT:      count %2  # 2048
+; HOT-NEXT: count %9  # 2048
+; HOT-NOT:  count
+
+; SKIP-LABEL: @count(
+; SKIP:       .landing:
+; SKIP-NEXT:    br label %[[LOOP:[0-9]+]]
+; SKIP:       [[LOOP]]:
+; SKIP-NEXT:    phi i32 [ %{{[0-9]+}}, %[[LATCH:[0-9]+]] ], [ 0, %.landing ]
+; SKIP-NEXT:    phi i32 [ %{{[0-9]+}}, %[[LATCH]] ], [ 1, %.landing ]
+; SKIP:       [[LATCH]]:
+; SKIP-NOT:     load
+; SKIP:         br i1 {{%.*}}, label %{{[0-9]+}}, label %[[LOOP]]
+
+define i32 @count(i32 %0) {
+  br label %2
+
+2:
+  %3 = phi i32 [ 0, %1 ], [ %11, %9 ]
+  %4 = phi i32 [ 1, %1 ], [ %10, %9 ]
+  %5 = and i32 %3, 1023
+  %6 = icmp eq i32 %5, 0
+  br i1 %6, label %7, label %9
+
+7:
+  %8 = mul i32 %4, 3
+  br label %9
+
+9:
+  %10 = phi i32 [ %4, %2 ], [ %8, %7 ]
+  %11 = add i32 %3, 1
+  %12 = icmp sge i32 %11, %0
+  br i1 %12, label %13, label %2
+
+13:
+  ret i32 %10
+}
+
+define i32 @main() {
+  %r = call i32 @count(i32 2048)
+  %ok = icmp eq i32 %r, 9
+  %ret = select i1 %ok, i32 0, i32 1
+  ret i32 %ret
+}
@@ -0,0 +1,109 @@
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-instrument -S %s | FileCheck %s
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="function(cff)" -cff-instrument %s \
+; RUN:   | opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:       -passes="cff-profile,cff-profile" -S | FileCheck %s
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-instrument %s -o %t.bc
+; RUN: env CFF_PROFILE_FILE=%t.json \
+; RUN:   lli --dlopen=%shlibdir/libObfuscatorProfile%shlibext %t.bc
+; RUN: FileCheck %s --check-prefix=PROFILE < %t.json
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-instrument -cff-dispatch=indirect %s -o %t.indirect.bc
+; RUN: env CFF_PROFILE_FILE=%t.indirect.json \
+; RUN:   lli --dlopen=%shlibdir/libObfuscatorProfile%shlibext %t.indirect.bc
+; RUN: FileCheck %s --check-prefix=PROFILE < %t.indirect.json
+; RUN: obfuscator-profdata %t.json %t.indirect.json -o %t.hot
+; RUN: FileCheck %s --check-prefix=HOT < %t.hot
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-hot-list=%t.hot -S %s | FileCheck %s --check-prefix=SKIP
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-hot-list=%t.hot %s | lli
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-instrument -cff-hot-list=%t.hot %s -o %t.skip.bc
+; RUN: env CFF_PROFILE_FILE=%t.skip.json \
+; RUN:   lli --dlopen=%shlibdir/libObfuscatorProfile%shlibext %t.skip.bc
+; RUN: FileCheck %s --check-prefix=PROFILE < %t.skip.json
+; RUN: not opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-hot-list=%t.missing -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=MISSING
+
+; -cff-instrument counts the runs of every flattened block in a relaxed
+; atomic counter, on entry to the block with either dispatch kind. The
+; counters of the module are registered from one constructor, added by "cff"
+; at the module level or by "cff-profile" after a function pipeline, and the
+; runtime writes them out from the destructor of the last module. %loop runs once per iteration, %slow once in 1024. The two
+; hottest blocks cover 99% of the runs, so obfuscator-profdata lists them,
+; and -cff-hot-list keeps their loop out of the dispatcher, where it still
+; counts the same.
+
+; CHECK-DAG:   @count.cff.counts = internal global [4 x i64] zeroinitializer
+; CHECK-DAG:   @count.cff.blocks = private constant [4 x ptr]
+; CHECK-DAG:   @count.cff.profile = internal global { ptr, ptr, ptr, ptr, i32 } { ptr null, ptr @{{.*}}, ptr @count.cff.blocks, ptr @count.cff.counts, i32 4 }
+; CHECK-DAG:   @cff.profiles = private constant [1 x ptr] [ptr @count.cff.profile]
+; CHECK-DAG:   @llvm.global_ctors = appending global [1 x { i32, ptr, ptr }] [{ i32, ptr, ptr } { i32 65535, ptr @cff.profile.init, ptr null }]
+; CHECK-DAG:   @llvm.global_dtors = appending global [1 x { i32, ptr, ptr }] [{ i32, ptr, ptr } { i32 101, ptr @__cff_profile_dump, ptr null }]
+
+; CHECK-LABEL: @count(
+; CHECK:       EntryCase:
+; CHECK-NOT:     atomicrmw
+; CHECK:         switch i32 %SwitchVar
+; CHECK:       loop:
+; CHECK-NEXT:    atomicrmw add ptr getelementptr inbounds ([4 x i64], ptr @count.cff.counts, i64 0, i64 {{[0-3]}}), i64 1 monotonic, align 8
+
+; CHECK-LABEL: define internal void @cff.profile.init()
+; CHECK-NEXT:    call void @__cff_profile_register(ptr @cff.profiles, i32 1)
+; CHECK-NEXT:    ret void
+
+; PROFILE:     {"version":1,"functions":[{"name":"count","blocks":{
+; PROFILE-DAG:   "loop":2048
+; PROFILE-DAG:   "slow":2
+; PROFILE-DAG:   "latch":2048
+; PROFILE-DAG:   "exit":1
+
+; HOT:      count latch  # 4096
+; HOT-NEXT: count loop  # 4096
+; HOT-NOT:  count
+
+; SKIP-LABEL: @count(
+; SKIP:       loop:
+; SKIP:         br i1 %rare, label %slow, label %latch
+; SKIP:       slow:
+; SKIP:         br label %latch
+; SKIP:       latch:
+; SKIP:         br i1 %done, label %exit, label %loop
+
+; MISSING: error: can't read CFF hot list '{{.*}}.missing'
+
+define i32 @count(i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %acc = phi i32 [ 1, %entry ], [ %acc.next, %latch ]
+  %low = and i32 %i, 1023
+  %rare = icmp eq i32 %low, 0
+  br i1 %rare, label %slow, label %latch
+
+slow:
+  %acc.slow = mul i32 %acc, 3
+  br label %latch
+
+latch:
+  %acc.next = phi i32 [ %acc, %loop ], [ %acc.slow, %slow ]
+  %i.next = add i32 %i, 1
+  %done = icmp sge i32 %i.next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret i32 %acc.next
+}
+
+define i32 @main() {
+  %r = call i32 @count(i32 2048)
+  %ok = icmp eq i32 %r, 9
+  %ret = select i1 %ok, i32 0, i32 1
+  ret i32 %ret
+}
@@ -0,0 +1,93 @@
+; RUN: opt -load-pass-plugin %shlibdir/libCFF%shlibext -passes="cff" -S %s \
+; RUN:   | FileCheck %s --check-prefix=IR
+; RUN: opt -load-pass-plugin %shlibdir/libCFF%shlibext -passes="cff" %s \
+; RUN:   | llc -O2 | FileCheck %s --check-prefix=ASM
+
+; test/input/if-else.c: the dispatcher cases are shuffled but contiguous, so
+; llc must still lower the dispatcher to a single jump table.
+
+target triple = "x86_64-unknown-linux-gnu"
+
+; IR-LABEL: @check_password(
+; IR:       EntryCase:
+; IR:         switch i32 %SwitchVar, label %DefaultCase [
+; IR-COUNT-14:  i32 {{[0-9]+}}, label
+; IR-NEXT:    ]
+
+; ASM-LABEL: check_password:
+; ASM:         jmpq *.LJTI0_0(,%{{.*}},8)
+; ASM:       .LJTI0_0:
+; ASM-COUNT-14: .quad .LBB0_
+define dso_local i32 @check_password(ptr noundef %passwd, i32 noundef %len) {
+entry:
+  %retval = alloca i32, align 4
+  %passwd.addr = alloca ptr, align 8
+  %len.addr = alloca i32, align 4
+  store ptr %passwd, ptr %passwd.addr, align 8
+  store i32 %len, ptr %len.addr, align 4
+  %0 = load i32, ptr %len.addr, align 4
+  %cmp = icmp ne i32 %0, 5
+  br i1 %cmp, label %if.then, label %if.end
+
+if.then:
+  store i32 0, ptr %retval, align 4
+  br label %return
+
+if.end:
+  %1 = load ptr, ptr %passwd.addr, align 8
+  %2 = load i8, ptr %1, align 1
+  %cmp1 = icmp eq i8 %2, 76
+  br i1 %cmp1, label %if.then2, label %if.end25
+
+if.then2:
+  %3 = load ptr, ptr %passwd.addr, align 8
+  %arrayidx3 = getelementptr inbounds i8, ptr %3, i64 1
+  %4 = load i8, ptr %arrayidx3, align 1
+  %cmp4 = icmp eq i8 %4, 77
+  br i1 %cmp4, label %if.then5, label %if.end24
+
+if.then5:
+  %5 = load ptr, ptr %passwd.addr, align 8
+  %arrayidx6 = getelementptr inbounds i8, ptr %5, i64 2
+  %6 = load i8, ptr %arrayidx6, align 1
+  %cmp7 = icmp eq i8 %6, 70
+  br i1 %cmp7, label %if.then8, label %if.end23
+
+if.then8:
+  %7 = load ptr, ptr %passwd.addr, align 8
+  %arrayidx9 = getelementptr inbounds i8, ptr %7, i64 3
+  %8 = load i8, ptr %arrayidx9, align 1
+  %cmp10 = icmp eq i8 %8, 65
+  br i1 %cmp10, label %if.then11, label %if.end22
+
+if.then11:
+  %9 = load ptr, ptr %passwd.addr, align 8
+  %arrayidx12 = getelementptr inbounds i8, ptr %9, i64 4
+  %10 = load i8, ptr %arrayidx12, align 1
+  %cmp13 = icmp eq i8 %10, 79
+  br i1 %cmp13, label %if.then14, label %if.end21
+
+if.then14:
+  store i32 1, ptr %retval, align 4
+  br label %return
+
+if.end21:
+  br label %if.end22
+
+if.end22:
+  br label %if.end23
+
+if.end23:
+  br label %if.end24
+
+if.end24:
+  br label %if.end25
+
+if.end25:
+  store i32 0, ptr %retval, align 4
+  br label %return
+
+return:
+  %11 = load i32, ptr %retval, align 4
+  ret i32 %11
+}
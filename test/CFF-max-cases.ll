@@ -0,0 +1,108 @@
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-max-cases=3 -S %s | FileCheck %s
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-max-cases=3 %s | lli
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-max-cases=3 -cff-phi-state %s | lli
+; RUN: echo "main jh" > %t.hot
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-max-cases=4 -cff-hot-list=%t.hot -S %s \
+; RUN:   | FileCheck %s --check-prefix=HOT
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-max-cases=4 -cff-hot-list=%t.hot %s | lli
+
+; A two-level loop nest with -cff-max-cases=3: the inner loop fits in its own
+; dispatcher, the rest of the outer loop gets a second one and the exit block a
+; third one. main returns 0 when the flattened nest still computes 6 * 7.
+
+; CHECK-LABEL: @main(
+; CHECK-COUNT-3: %SwitchState{{[0-9]*}} = alloca i32, align 4
+; CHECK-NEXT:    store i32 [[IH:[0-9]+]], ptr %[[OUTERSTATE:SwitchState[0-9]*]], align 4
+; CHECK-NEXT:    br label %[[OUTEREND:EndCase[0-9]*]]
+
+; The inner loop dispatcher
+; CHECK:       EntryCase:
+; CHECK-NEXT:    %SwitchVar = load i32, ptr %[[INNERSTATE:SwitchState[0-9]*]], align 4
+; CHECK-NEXT:    switch i32 %SwitchVar, label %DefaultCase [
+; CHECK-NEXT:      i32 [[JH:[0-9]+]], label %jh
+; CHECK-NEXT:      i32 [[JB:[0-9]+]], label %jb
+; CHECK-NEXT:    ]
+; CHECK:       jh:
+; CHECK:         br i1 %jc, label %[[TOJB:[0-9]+]], label %[[TOIL:[0-9]+]]
+; CHECK:       jb:
+; CHECK:         store i32 [[JH]], ptr %[[INNERSTATE]], align 4
+; CHECK:       [[TOJB]]:
+; CHECK-NEXT:    store i32 [[JB]], ptr %[[INNERSTATE]], align 4
+
+; The rest of the outer loop, leaving the inner loop goes through this one
+; CHECK:       EntryCase{{[0-9]+}}:
+; CHECK-NEXT:    %SwitchVar{{[0-9]+}} = load i32, ptr %[[OUTERSTATE]], align 4
+; CHECK-NEXT:    switch i32 %SwitchVar{{[0-9]+}}, label %DefaultCase{{[0-9]+}} [
+; CHECK-NEXT:      i32 [[IH]], label %ih
+; CHECK-NEXT:      i32 {{[0-9]+}}, label %ib
+; CHECK-NEXT:      i32 {{[0-9]+}}, label %il
+; CHECK-NEXT:    ]
+; CHECK:       [[TOIL]]:
+; CHECK-NEXT:    store i32 {{[0-9]+}}, ptr %[[OUTERSTATE]], align 4
+; CHECK-NEXT:    br label %[[OUTEREND]]
+
+; The exit block
+; CHECK:       EntryCase{{[0-9]+}}:
+; CHECK:         switch i32 %SwitchVar{{[0-9]+}}, label %DefaultCase{{[0-9]+}} [
+; CHECK-NEXT:      i32 {{[0-9]+}}, label %exit
+; CHECK-NEXT:    ]
+
+; With the inner loop hot, its landing block belongs to the outer loop and
+; shares its dispatcher, the exit block still gets its own.
+
+; HOT-LABEL: @main(
+; HOT:       EntryCase:
+; HOT-NEXT:    %SwitchVar = load i32
+; HOT-NEXT:    switch i32 %SwitchVar, label %DefaultCase [
+; HOT-NEXT:      i32 {{[0-9]+}}, label %ih
+; HOT-NEXT:      i32 {{[0-9]+}}, label %ib
+; HOT-NEXT:      i32 {{[0-9]+}}, label %il
+; HOT-NEXT:      i32 {{[0-9]+}}, label %jh.landing
+; HOT-NEXT:    ]
+; HOT:       EntryCase{{[0-9]+}}:
+; HOT:         switch i32 %SwitchVar{{[0-9]+}}, label %DefaultCase{{[0-9]+}} [
+; HOT-NEXT:      i32 {{[0-9]+}}, label %exit
+; HOT-NEXT:    ]
+define dso_local i32 @main() {
+entry:
+  %ret = alloca i32, align 4
+  %i = alloca i32, align 4
+  %j = alloca i32, align 4
+  store i32 0, ptr %ret, align 4
+  store i32 0, ptr %i, align 4
+  br label %ih
+ih:
+  %iv = load i32, ptr %i, align 4
+  %ic = icmp slt i32 %iv, 6
+  br i1 %ic, label %ib, label %exit
+ib:
+  store i32 0, ptr %j, align 4
+  br label %jh
+jh:
+  %jv = load i32, ptr %j, align 4
+  %jc = icmp slt i32 %jv, 7
+  br i1 %jc, label %jb, label %il
+jb:
+  %r = load i32, ptr %ret, align 4
+  %r1 = add nsw i32 %r, 1
+  store i32 %r1, ptr %ret, align 4
+  %jv1 = load i32, ptr %j, align 4
+  %jn = add nsw i32 %jv1, 1
+  store i32 %jn, ptr %j, align 4
+  br label %jh
+il:
+  %iv1 = load i32, ptr %i, align 4
+  %in = add nsw i32 %iv1, 1
+  store i32 %in, ptr %i, align 4
+  br label %ih
+exit:
+  %rv = load i32, ptr %ret, align 4
+  %ok = icmp eq i32 %rv, 42
+  %res = select i1 %ok, i32 0, i32 1
+  ret i32 %res
+}
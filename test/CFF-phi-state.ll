@@ -0,0 +1,48 @@
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-phi-state -S %s | FileCheck %s
+
+; test/input/while.c: with -cff-phi-state the dispatcher state must live in a
+; PHI in EntryCase, fed directly by every flattened block, with no stack slot.
+
+define dso_local i32 @main() #0 {
+; CHECK-LABEL: @main(
+; CHECK-NOT:     SwitchState
+; CHECK:         br label %EntryCase
+; CHECK:       EntryCase:
+; CHECK-NEXT:    [[SWVAR:%.*]] = phi i32 [ [[SWVAR]], %EndCase ], [ [[HEADERID:[0-9]+]], %0 ], [ [[SEL:%.*]], %[[HEADER:.*]] ], [ [[HEADERID]], %[[BODY:.*]] ]
+; CHECK-NEXT:    switch i32 [[SWVAR]], label %DefaultCase [
+; CHECK-NEXT:      i32 [[HEADERID]], label %[[HEADER]]
+; CHECK-NEXT:      i32 [[BODYID:[0-9]+]], label %[[BODY]]
+; CHECK-NEXT:      i32 [[EXITID:[0-9]+]], label %{{.*}}
+; CHECK-NEXT:    ]
+; CHECK:       [[HEADER]]:
+; CHECK:         [[SEL]] = select i1 {{%.*}}, i32 [[BODYID]], i32 [[EXITID]]
+; CHECK-NEXT:    br label %EntryCase
+; CHECK:       [[BODY]]:
+; CHECK:         store i32 {{%.*}}, ptr %2, align 4
+; CHECK-NEXT:    br label %EntryCase
+; CHECK:       EndCase:
+; CHECK-NEXT:    br label %EntryCase
+; CHECK-NOT:     SwitchState
+;
+  %1 = alloca i32, align 4
+  %2 = alloca i32, align 4
+  store i32 0, ptr %1, align 4
+  store i32 0, ptr %2, align 4
+  br label %3
+
+3:
+  %4 = load i32, ptr %2, align 4
+  %5 = icmp slt i32 %4, 69
+  br i1 %5, label %6, label %9
+
+6:
+  %7 = load i32, ptr %2, align 4
+  %8 = add nsw i32 %7, 1
+  store i32 %8, ptr %2, align 4
+  br label %3
+
+9:
+  %10 = load i32, ptr %2, align 4
+  ret i32 %10
+}
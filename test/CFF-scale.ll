@@ -0,0 +1,12 @@
+; Flatten a function with tens of thousands of blocks. Looking up each
+; successor's case value used to be a linear scan of the dispatcher, which
+; made this test take minutes instead of well under a second.
+; RUN: %python %S/tool/gen-blocks.py 20000 > %t.ll
+; RUN: opt -load-pass-plugin %shlibdir/libCFF%shlibext -passes="cff" -S %t.ll | FileCheck %s
+
+; CHECK-LABEL: @chain(
+; CHECK:       EntryCase:
+; CHECK-NEXT:    [[SWVAR:%.*]] = load i32, ptr %SwitchState, align 4
+; CHECK-NEXT:    switch i32 [[SWVAR]], label %DefaultCase [
+; CHECK:           i32 {{[0-9]+}}, label %exit
+; CHECK-NEXT:    ]
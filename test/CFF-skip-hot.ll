@@ -0,0 +1,135 @@
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-skip-hot -cff-hot-freq-ratio=100 -S %s \
+; RUN:   | FileCheck %s --check-prefixes=CHECK,STATIC
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="require<profile-summary>,function(cff)" -cff-skip-hot -S %s \
+; RUN:   | FileCheck %s --check-prefixes=CHECK,PGO
+
+; Two copies of a two-level loop nest. Without a profile summary both inner
+; loops run ~1000 times per entry and are left alone while the outer loops are
+; flattened. With the profile summary, @cold never runs so nothing in it is hot.
+; The dispatcher enters a kept loop through a landing block in front of its
+; header, and only the landing block is a case.
+
+; CHECK-LABEL: @hot(
+; CHECK:       EntryCase:
+; CHECK:         switch i32 %SwitchVar
+; CHECK-NOT:       label %jh{{$}}
+; CHECK:           label %jh.landing
+; CHECK-NOT:       label %jh{{$}}
+; CHECK:         ]
+; CHECK:       ih:
+; CHECK:         select i1 %ic
+; CHECK:       jh.landing:
+; CHECK-NEXT:    br label %jh
+; CHECK:       il:
+; CHECK-NOT:     br label %ih
+; CHECK:       exit:
+; CHECK:       jh:
+; CHECK-NOT:     reload
+; CHECK:         br i1 %jc, label %jb, label %il
+; CHECK:       jb:
+; CHECK-NOT:     reload
+; CHECK:         br label %jh
+define dso_local i32 @hot() !prof !15 {
+entry:
+  %ret = alloca i32, align 4
+  %i = alloca i32, align 4
+  %j = alloca i32, align 4
+  store i32 0, ptr %ret, align 4
+  store i32 0, ptr %i, align 4
+  br label %ih
+ih:
+  %iv = load i32, ptr %i, align 4
+  %ic = icmp slt i32 %iv, 2
+  br i1 %ic, label %ib, label %exit, !prof !16
+ib:
+  store i32 0, ptr %j, align 4
+  br label %jh
+jh:
+  %jv = load i32, ptr %j, align 4
+  %jc = icmp slt i32 %jv, 1000
+  br i1 %jc, label %jb, label %il, !prof !17
+jb:
+  %r = load i32, ptr %ret, align 4
+  %r1 = add nsw i32 %r, 1
+  store i32 %r1, ptr %ret, align 4
+  %jv1 = load i32, ptr %j, align 4
+  %jn = add nsw i32 %jv1, 1
+  store i32 %jn, ptr %j, align 4
+  br label %jh
+il:
+  %iv1 = load i32, ptr %i, align 4
+  %in = add nsw i32 %iv1, 1
+  store i32 %in, ptr %i, align 4
+  br label %ih
+exit:
+  %rv = load i32, ptr %ret, align 4
+  ret i32 %rv
+}
+
+; CHECK-LABEL: @cold(
+; CHECK:       EntryCase:
+; CHECK:       ih:
+; CHECK:         select i1 %ic
+; PGO:         jh:
+; PGO:           select i1 %jc
+; CHECK:       exit:
+; STATIC:      jh:
+; STATIC:        br i1 %jc, label %jb, label %il
+define dso_local i32 @cold() !prof !18 {
+entry:
+  %ret = alloca i32, align 4
+  %i = alloca i32, align 4
+  %j = alloca i32, align 4
+  store i32 0, ptr %ret, align 4
+  store i32 0, ptr %i, align 4
+  br label %ih
+ih:
+  %iv = load i32, ptr %i, align 4
+  %ic = icmp slt i32 %iv, 2
+  br i1 %ic, label %ib, label %exit, !prof !16
+ib:
+  store i32 0, ptr %j, align 4
+  br label %jh
+jh:
+  %jv = load i32, ptr %j, align 4
+  %jc = icmp slt i32 %jv, 1000
+  br i1 %jc, label %jb, label %il, !prof !17
+jb:
+  %r = load i32, ptr %ret, align 4
+  %r1 = add nsw i32 %r, 1
+  store i32 %r1, ptr %ret, align 4
+  %jv1 = load i32, ptr %j, align 4
+  %jn = add nsw i32 %jv1, 1
+  store i32 %jn, ptr %j, align 4
+  br label %jh
+il:
+  %iv1 = load i32, ptr %i, align 4
+  %in = add nsw i32 %iv1, 1
+  store i32 %in, ptr %i, align 4
+  br label %ih
+exit:
+  %rv = load i32, ptr %ret, align 4
+  ret i32 %rv
+}
+
+!llvm.module.flags = !{!0}
+!0 = !{i32 1, !"ProfileSummary", !1}
+!1 = !{!2, !3, !4, !5, !6, !7, !8, !9}
+!2 = !{!"ProfileFormat", !"InstrProf"}
+!3 = !{!"TotalCount", i64 4000}
+!4 = !{!"MaxCount", i64 2000}
+!5 = !{!"MaxInternalCount", i64 2000}
+!6 = !{!"MaxFunctionCount", i64 1}
+!7 = !{!"NumCounts", i64 6}
+!8 = !{!"NumFunctions", i64 2}
+!9 = !{!"DetailedSummary", !10}
+!10 = !{!11, !12, !13}
+!11 = !{i32 10000, i64 2000, i32 1}
+!12 = !{i32 990000, i64 2000, i32 2}
+!13 = !{i32 999999, i64 1, i32 6}
+!15 = !{!"function_entry_count", i64 1}
+!16 = !{!"branch_weights", i32 2, i32 1}
+!17 = !{!"branch_weights", i32 2000, i32 2}
+!18 = !{!"function_entry_count", i64 0}
@@ -0,0 +1,64 @@
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -S %s | FileCheck %s
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" %s | lli
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-phi-state %s | lli
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-dispatch=indirect %s | lli
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-max-cases=2 %s | lli
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-skip-hot %s | lli
+
+; Optimized IR, without allocas: CFF demotes the PHIs of the flattened blocks
+; and the values used across the dispatcher, nothing else. %n1 in the entry
+; block dominates everything, %sq and %next are only used in their own block
+; (%next through the store feeding the %i PHI), so they stay in registers. A
+; PHI used across the dispatcher gets a second slot, as with reg2mem: its
+; own slot is overwritten by the latch before the exit block reads it.
+
+; CHECK-LABEL: @sum_squares(
+; CHECK-NEXT:  entry:
+; CHECK-COUNT-5: {{%(i|acc|done|i.reload|acc.reload).reg2mem}} = alloca
+; CHECK-NEXT:    %n1 = add i32 %n, 1
+; CHECK-NOT:     phi
+; CHECK:         %sq = mul i32
+; CHECK-NEXT:    {{%.*}} = load i32
+; CHECK-NEXT:    %acc.next = add i32 %{{.*}}, %sq
+; CHECK-NEXT:    {{%.*}} = load i32
+; CHECK-NEXT:    %next = add i32 %{{.*}}, 1
+; CHECK-NEXT:    store i32 %next, ptr %i.reg2mem
+; CHECK-NOT:     phi
+; CHECK:         ret i32
+
+define dso_local i32 @sum_squares(i32 %n) {
+entry:
+  %n1 = add i32 %n, 1
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %next, %body ]
+  %acc = phi i32 [ 0, %entry ], [ %acc.next, %body ]
+  %done = icmp sge i32 %i, %n1
+  br i1 %done, label %exit, label %body
+
+body:
+  %sq = mul i32 %i, %i
+  %acc.next = add i32 %acc, %sq
+  %next = add i32 %i, 1
+  br label %loop
+
+exit:
+  %r = select i1 %done, i32 %acc, i32 -1
+  ret i32 %r
+}
+
+define dso_local i32 @main() {
+entry:
+  %s = call i32 @sum_squares(i32 9)
+  ; 0^2 + ... + 9^2
+  %ok = icmp eq i32 %s, 285
+  %ret = select i1 %ok, i32 0, i32 1
+  ret i32 %ret
+}
@@ -0,0 +1,184 @@
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -S %s | FileCheck %s
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" %s | lli
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-dispatch=indirect -S %s | FileCheck %s --check-prefix=INDIRECT
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-dispatch=indirect %s | lli
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-max-cases=2 %s | lli
+
+; Switches are fused into the dispatcher: the next state comes straight from
+; the switch condition, through a constant table when the case values are
+; dense and a chain of selects when there are a few sparse ones. Only a large
+; sparse switch still goes through trampolines, one per successor.
+
+; CHECK:       @dense.cff.lookup = private constant [6 x i32]
+; CHECK-LABEL: @dense(
+; CHECK:         [[OFF:%.*]] = sub i32 %x, -1
+; CHECK-NEXT:    [[IDX:%.*]] = zext i32 [[OFF]] to i64
+; CHECK-NEXT:    [[IN:%.*]] = icmp ult i64 [[IDX]], 6
+; CHECK-NEXT:    [[SAFE:%.*]] = select i1 [[IN]], i64 [[IDX]], i64 0
+; CHECK-NEXT:    [[GEP:%.*]] = getelementptr inbounds [6 x i32], ptr @dense.cff.lookup, i64 0, i64 [[SAFE]]
+; CHECK-NEXT:    [[ENTRY:%.*]] = load i32, ptr [[GEP]]
+; CHECK-NEXT:    [[STATE:%.*]] = select i1 [[IN]], i32 [[ENTRY]], i32 {{[0-9]+}}
+; CHECK-NEXT:    store i32 [[STATE]], ptr %SwitchState
+; CHECK-NOT:     switch i32 %x
+; CHECK-LABEL: @sparse(
+; CHECK:         [[IS1:%.*]] = icmp eq i32 %x, 1000
+; CHECK-NEXT:    [[SEL1:%.*]] = select i1 [[IS1]], i32 {{[0-9]+}}, i32 {{[0-9]+}}
+; CHECK-NEXT:    [[IS2:%.*]] = icmp eq i32 %x, -7
+; CHECK-NEXT:    [[SEL2:%.*]] = select i1 [[IS2]], i32 {{[0-9]+}}, i32 [[SEL1]]
+; CHECK-NEXT:    [[IS3:%.*]] = icmp eq i32 %x, 65536
+; CHECK-NEXT:    [[SEL3:%.*]] = select i1 [[IS3]], i32 {{[0-9]+}}, i32 [[SEL2]]
+; CHECK-NEXT:    store i32 [[SEL3]], ptr %SwitchState
+; CHECK-NOT:     switch i32 %x
+; CHECK-LABEL: @wide(
+; CHECK:         switch i32 %x, label %{{.*}} [
+; CHECK-NEXT:      i32 1, label %[[TA:[0-9]+]]
+; CHECK-NEXT:      i32 100, label %[[TB:[0-9]+]]
+; CHECK-NEXT:      i32 10000, label %[[TA]]
+; CHECK-NEXT:      i32 1000000, label %[[TB]]
+; CHECK-NEXT:      i32 100000000, label %[[TA]]
+; CHECK-NEXT:    ]
+
+; INDIRECT-LABEL: @dense(
+; INDIRECT:         [[STATE:%.*]] = select i1 {{%.*}}, i32 {{%.*}}, i32 {{[0-9]+}}
+; INDIRECT-NEXT:    [[SLOT:%.*]] = getelementptr inbounds [5 x ptr], ptr @dense.cff.table, i32 0, i32 [[STATE]]
+; INDIRECT-NEXT:    [[ENC:%.*]] = load volatile ptr, ptr [[SLOT]]
+; INDIRECT-NEXT:    [[TARGET:%.*]] = getelementptr i8, ptr [[ENC]], i64 -{{[0-9]+}}
+; INDIRECT-NEXT:    indirectbr ptr [[TARGET]], [label %{{[0-9a-z.]+}}, label %{{[0-9a-z.]+}}, label %{{[0-9a-z.]+}}]
+; INDIRECT-NOT:     switch i32 %x
+; INDIRECT-LABEL: @sparse(
+
+define dso_local i32 @dense(i32 noundef %x) {
+entry:
+  %r = alloca i32, align 4
+  br label %sw
+
+sw:
+  switch i32 %x, label %sw.default [
+    i32 -1, label %sw.a
+    i32 0, label %sw.b
+    i32 2, label %sw.a
+    i32 4, label %sw.b
+  ]
+
+sw.a:
+  store i32 10, ptr %r, align 4
+  br label %sw.end
+
+sw.b:
+  store i32 20, ptr %r, align 4
+  br label %sw.end
+
+sw.default:
+  store i32 30, ptr %r, align 4
+  br label %sw.end
+
+sw.end:
+  %v = load i32, ptr %r, align 4
+  ret i32 %v
+}
+
+define dso_local i32 @sparse(i32 noundef %x) {
+entry:
+  %r = alloca i32, align 4
+  br label %sw
+
+sw:
+  switch i32 %x, label %sw.default [
+    i32 1000, label %sw.a
+    i32 -7, label %sw.b
+    i32 65536, label %sw.a
+  ]
+
+sw.a:
+  store i32 10, ptr %r, align 4
+  br label %sw.end
+
+sw.b:
+  store i32 20, ptr %r, align 4
+  br label %sw.end
+
+sw.default:
+  store i32 30, ptr %r, align 4
+  br label %sw.end
+
+sw.end:
+  %v = load i32, ptr %r, align 4
+  ret i32 %v
+}
+
+define dso_local i32 @wide(i32 noundef %x) {
+entry:
+  %r = alloca i32, align 4
+  br label %sw
+
+sw:
+  switch i32 %x, label %sw.default [
+    i32 1, label %sw.a
+    i32 100, label %sw.b
+    i32 10000, label %sw.a
+    i32 1000000, label %sw.b
+    i32 100000000, label %sw.a
+  ]
+
+sw.a:
+  store i32 10, ptr %r, align 4
+  br label %sw.end
+
+sw.b:
+  store i32 20, ptr %r, align 4
+  br label %sw.end
+
+sw.default:
+  store i32 30, ptr %r, align 4
+  br label %sw.end
+
+sw.end:
+  %v = load i32, ptr %r, align 4
+  ret i32 %v
+}
+
+define dso_local i32 @main() {
+entry:
+  %d0 = call i32 @dense(i32 -1)
+  %d1 = call i32 @dense(i32 0)
+  %d2 = call i32 @dense(i32 1)
+  %d3 = call i32 @dense(i32 4)
+  %d4 = call i32 @dense(i32 5)
+  %d5 = call i32 @dense(i32 -2)
+  %s0 = call i32 @sparse(i32 65536)
+  %s1 = call i32 @sparse(i32 -7)
+  %s2 = call i32 @sparse(i32 0)
+  %w0 = call i32 @wide(i32 100000000)
+  %w1 = call i32 @wide(i32 1000000)
+  %w2 = call i32 @wide(i32 2)
+  %cd0 = icmp eq i32 %d0, 10
+  %cd1 = icmp eq i32 %d1, 20
+  %cd2 = icmp eq i32 %d2, 30
+  %cd3 = icmp eq i32 %d3, 20
+  %cd4 = icmp eq i32 %d4, 30
+  %cd5 = icmp eq i32 %d5, 30
+  %cs0 = icmp eq i32 %s0, 10
+  %cs1 = icmp eq i32 %s1, 20
+  %cs2 = icmp eq i32 %s2, 30
+  %cw0 = icmp eq i32 %w0, 10
+  %cw1 = icmp eq i32 %w1, 20
+  %cw2 = icmp eq i32 %w2, 30
+  %a0 = and i1 %cd0, %cd1
+  %a1 = and i1 %a0, %cd2
+  %a2 = and i1 %a1, %cd3
+  %a3 = and i1 %a2, %cd4
+  %a4 = and i1 %a3, %cd5
+  %a5 = and i1 %a4, %cs0
+  %a6 = and i1 %a5, %cs1
+  %a7 = and i1 %a6, %cs2
+  %a8 = and i1 %a7, %cw0
+  %a9 = and i1 %a8, %cw1
+  %a10 = and i1 %a9, %cw2
+  %ret = select i1 %a10, i32 0, i32 1
+  ret i32 %ret
+}
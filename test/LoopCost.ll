@@ -0,0 +1,124 @@
+; RUN: opt -load-pass-plugin %shlibdir/libCFGPrinter%shlibext \
+; RUN:   -passes="print<loop-cost>" -disable-output %s 2>&1 | FileCheck %s
+; RUN: opt -load-pass-plugin %shlibdir/libCFGPrinter%shlibext \
+; RUN:   -passes="dot-loop-cost" -disable-output %s 2>&1 | FileCheck %s --check-prefix=DOT
+; RUN: opt -load-pass-plugin %shlibdir/libCFGPrinter%shlibext \
+; RUN:   -passes="print<cfg>" -disable-output %s 2>&1 | FileCheck %s --check-prefix=CFG
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-max-loop-trips=100 -S %s | FileCheck %s --check-prefix=SKIP
+; RUN: opt -load %shlibdir/libCFF%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="cff" -cff-max-loop-trips=1000 -S %s | FileCheck %s --check-prefix=FLAT
+
+; LoopCostAnalysis gives the depth, size, shape and trip counts of every
+; loop, in preorder. The trip counts of @nest are constants, the one of
+; @count only comes from its branch weights. The cost is the number of
+; instructions run per entry of the loop: 17 times the 5 instructions of
+; %outer and the 40 of %inner for the outer loop. @irregular leaves from the middle
+; of its body, which neither print<cfg> nor the cost choke on.
+; -cff-max-loop-trips keeps innermost loops running more iterations than
+; that out of the dispatcher.
+
+; CHECK:      {"function":"nest","loops":[
+; CHECK-SAME:   {"header":"%outer","parent":null,"depth":1,"blocks":3,"instructions":10,"shape":"for/while","tripCount":17,"maxTripCount":17,"estimatedTripCount":0,"cost":765},
+; CHECK-SAME:   {"header":"%inner","parent":"%outer","depth":2,"blocks":1,"instructions":5,"shape":"for/while","tripCount":8,"maxTripCount":8,"estimatedTripCount":0,"cost":40}]}
+; CHECK:      {"function":"irregular","loops":[{"header":"%header",{{.*}}"shape":"irregular","tripCount":0,
+; CHECK:      {"function":"count","loops":[{"header":"%loop",{{.*}}"shape":"do-while",{{.*}}"estimatedTripCount":128,"cost":1408}]}
+
+; DOT:      digraph "Loops of nest" {
+; DOT:        Loop0 [label="{%outer|depth 1, 3 blocks, 10 instructions|for/while|trips 17|cost 765}"];
+; DOT-NEXT:   Func -> Loop0;
+; DOT-NEXT:   Loop1 [label="{%inner|depth 2, 1 blocks, 5 instructions|for/while|trips 8|cost 40}"];
+; DOT-NEXT:   Loop0 -> Loop1;
+
+; CFG-LABEL: for function 'nest'
+; CFG-NEXT:  for/while loop: %outer.done = icmp eq i32 %i, 16
+; CFG-NEXT:  for/while loop: %inner.done = icmp eq i32 %j.next, 8
+; CFG-LABEL: for function 'irregular'
+; CFG-NEXT:  irregular loop: Loop at depth 1 containing
+; CFG-LABEL: for function 'count'
+; CFG-NEXT:  do-while loop: %done = icmp sge i32 %i.next, %n
+
+; SKIP-LABEL: @count(
+; SKIP:       loop:
+; SKIP:         br i1 %rare, label %slow, label %latch
+; SKIP:       latch:
+; SKIP:         br i1 %done, label %exit, label %loop
+
+; FLAT-LABEL: @count(
+; FLAT:       loop:
+; FLAT-NOT:     br i1
+; FLAT:       latch:
+; FLAT-NOT:     br i1
+; FLAT:       exit:
+
+define void @nest(ptr %p) {
+entry:
+  br label %outer
+
+outer:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %outer.latch ]
+  %outer.done = icmp eq i32 %i, 16
+  br i1 %outer.done, label %exit, label %inner
+
+inner:
+  %j = phi i32 [ 0, %outer ], [ %j.next, %inner ]
+  store i32 %j, ptr %p
+  %j.next = add i32 %j, 1
+  %inner.done = icmp eq i32 %j.next, 8
+  br i1 %inner.done, label %outer.latch, label %inner
+
+outer.latch:
+  %i.next = add i32 %i, 1
+  br label %outer
+
+exit:
+  ret void
+}
+
+define i32 @irregular(ptr %p) {
+entry:
+  br label %header
+
+header:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %i.next = add i32 %i, 1
+  br label %body
+
+body:
+  %x = load i32, ptr %p
+  %stop = icmp eq i32 %x, %i
+  br i1 %stop, label %exit, label %latch
+
+latch:
+  br label %header
+
+exit:
+  ret i32 %i
+}
+
+define i32 @count(i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %acc = phi i32 [ 1, %entry ], [ %acc.next, %latch ]
+  %low = and i32 %i, 1023
+  %rare = icmp eq i32 %low, 0
+  br i1 %rare, label %slow, label %latch
+
+slow:
+  %acc.slow = mul i32 %acc, 3
+  br label %latch
+
+latch:
+  %acc.next = phi i32 [ %acc, %loop ], [ %acc.slow, %slow ]
+  %i.next = add i32 %i, 1
+  %done = icmp sge i32 %i.next, %n
+  br i1 %done, label %exit, label %loop, !prof !0
+
+exit:
+  ret i32 %acc.next
+}
+
+!0 = !{!"branch_weights", i32 1, i32 127}
@@ -0,0 +1,60 @@
+; RUN: opt -load %shlibdir/libMBASub%shlibext -load-pass-plugin %shlibdir/libMBASub%shlibext -passes="mba-sub" -S %s | FileCheck %s --check-prefix=ALL
+; RUN: opt -load %shlibdir/libMBASub%shlibext -load-pass-plugin %shlibdir/libMBASub%shlibext -passes="mba-sub" -mba-budget=4 -S %s | FileCheck %s --check-prefix=COLD
+; RUN: opt -load %shlibdir/libMBASub%shlibext -load-pass-plugin %shlibdir/libMBASub%shlibext -passes="mba-sub" -mba-max-growth=25 -S %s | FileCheck %s --check-prefix=COLD
+; RUN: opt -load %shlibdir/libMBASub%shlibext -load-pass-plugin %shlibdir/libMBASub%shlibext -passes="mba-sub" -mba-budget=4 -mba-max-growth=15 -S %s | FileCheck %s --check-prefix=ONE
+; RUN: opt -load %shlibdir/libMBASub%shlibext -load-pass-plugin %shlibdir/libMBASub%shlibext -passes="mba-sub" -mba-budget=4 %s | lli
+
+; Each sub rewrite costs two extra instructions. The 16 instruction function
+; has room for two of them with a budget of 4 or 25% growth: they go to the
+; subs of the entry and exit blocks, the one of the loop body is kept. With
+; the smaller of both budgets (15% of 16 = 2) only the entry sub is rewritten,
+; the first of the two equally cold blocks.
+
+define i32 @sum(i32 %n, i32 %k) {
+; ALL-LABEL: @sum(
+; ALL-NOT:     sub
+;
+; COLD-LABEL: @sum(
+; COLD:       entry:
+; COLD-NOT:     sub
+; COLD:       loop:
+; COLD:         sub i32 %acc, %k
+; COLD:       exit:
+; COLD-NOT:     sub
+;
+; ONE-LABEL: @sum(
+; ONE:        entry:
+; ONE-NOT:      sub
+; ONE:        loop:
+; ONE:          sub i32 %acc, %k
+; ONE:        exit:
+; ONE:          sub i32 %sum, 1
+entry:
+  %start = sub i32 %n, %k
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi i32 [ %start, %entry ], [ %acc.next, %loop ]
+  %step = sub i32 %acc, %k
+  %acc.next = add i32 %step, %i
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  %sum = phi i32 [ %acc.next, %loop ]
+  %r = sub i32 %sum, 1
+  %x = xor i32 %r, 0
+  %y = or i32 %x, 0
+  %z = and i32 %y, -1
+  %w = add i32 %z, 0
+  ret i32 %w
+}
+
+define i32 @main() {
+  %r = call i32 @sum(i32 10, i32 2)
+  %c = icmp ne i32 %r, 32
+  %ret = zext i1 %c to i32
+  ret i32 %ret
+}
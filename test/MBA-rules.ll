@@ -0,0 +1,177 @@
+; RUN: opt -load-pass-plugin %shlibdir/libMBASub%shlibext -passes="mba" -S %s | FileCheck %s
+; RUN: opt -load-pass-plugin %shlibdir/libMBASub%shlibext -passes="mba<mul;xor>" -S %s | FileCheck %s --check-prefix=SUBSET
+; RUN: opt -load-pass-plugin %shlibdir/libMBASub%shlibext -passes="mba" %s | lli
+; RUN: opt -load-pass-plugin %shlibdir/libMBASub%shlibext -passes="mba<add;mul>" %s | lli
+
+; Every rule rewrites its opcode once, the instructions it creates are not
+; rewritten again, and main() returns 0 only if each rewrite still computes
+; the original value.
+
+define i32 @f_add(i32 %a, i32 %b) {
+; CHECK-LABEL: @f_add(
+; CHECK-NEXT:    [[X:%.*]] = xor i32 [[A:%.*]], [[B:%.*]]
+; CHECK-NEXT:    [[N:%.*]] = and i32 [[A]], [[B]]
+; CHECK-NEXT:    [[S:%.*]] = shl i32 [[N]], 1
+; CHECK-NEXT:    [[R:%.*]] = add i32 [[X]], [[S]]
+; CHECK-NEXT:    ret i32 [[R]]
+;
+; SUBSET-LABEL: @f_add(
+; SUBSET-NEXT:    add nsw i32
+  %r = add nsw i32 %a, %b
+  ret i32 %r
+}
+
+define i8 @f_sub(i8 %a, i8 %b) {
+; CHECK-LABEL: @f_sub(
+; CHECK-NEXT:    [[N:%.*]] = xor i8 [[B:%.*]], -1
+; CHECK-NEXT:    [[T:%.*]] = add i8 [[A:%.*]], [[N]]
+; CHECK-NEXT:    [[R:%.*]] = add i8 [[T]], 1
+; CHECK-NEXT:    ret i8 [[R]]
+;
+  %r = sub i8 %a, %b
+  ret i8 %r
+}
+
+define i32 @f_xor(i32 %a, i32 %b) {
+; CHECK-LABEL: @f_xor(
+; CHECK-NEXT:    [[O:%.*]] = or i32 [[A:%.*]], [[B:%.*]]
+; CHECK-NEXT:    [[N:%.*]] = and i32 [[A]], [[B]]
+; CHECK-NEXT:    [[R:%.*]] = sub i32 [[O]], [[N]]
+; CHECK-NEXT:    [[NOT:%.*]] = xor i32 [[R]], -1
+; CHECK-NEXT:    ret i32 [[NOT]]
+;
+; SUBSET-LABEL: @f_xor(
+; SUBSET-NEXT:    or i32
+; SUBSET-NEXT:    and i32
+; SUBSET-NEXT:    sub i32
+; SUBSET-NEXT:    xor i32 {{.*}}, -1
+  %r = xor i32 %a, %b
+  %not = xor i32 %r, -1
+  ret i32 %not
+}
+
+define i32 @f_and(i32 %a, i32 %b) {
+; CHECK-LABEL: @f_and(
+; CHECK-NEXT:    [[S:%.*]] = add i32 [[A:%.*]], [[B:%.*]]
+; CHECK-NEXT:    [[O:%.*]] = or i32 [[A]], [[B]]
+; CHECK-NEXT:    [[R:%.*]] = sub i32 [[S]], [[O]]
+; CHECK-NEXT:    ret i32 [[R]]
+;
+  %r = and i32 %a, %b
+  ret i32 %r
+}
+
+define i64 @f_or(i64 %a, i64 %b) {
+; CHECK-LABEL: @f_or(
+; CHECK-NEXT:    [[X:%.*]] = xor i64 [[A:%.*]], [[B:%.*]]
+; CHECK-NEXT:    [[N:%.*]] = and i64 [[A]], [[B]]
+; CHECK-NEXT:    [[R:%.*]] = add i64 [[X]], [[N]]
+; CHECK-NEXT:    ret i64 [[R]]
+;
+  %r = or i64 %a, %b
+  ret i64 %r
+}
+
+; 10 = 0b1010
+define i32 @f_mul10(i32 %a) {
+; CHECK-LABEL: @f_mul10(
+; CHECK-NEXT:    [[S1:%.*]] = shl i32 [[A:%.*]], 1
+; CHECK-NEXT:    [[S3:%.*]] = shl i32 [[A]], 3
+; CHECK-NEXT:    [[R:%.*]] = add i32 [[S1]], [[S3]]
+; CHECK-NEXT:    ret i32 [[R]]
+;
+; SUBSET-LABEL: @f_mul10(
+; SUBSET-NEXT:    shl i32
+; SUBSET-NEXT:    shl i32
+; SUBSET-NEXT:    add i32
+  %r = mul i32 %a, 10
+  ret i32 %r
+}
+
+; -3 has 31 bits set, 3 only two
+define i32 @f_mul_neg3(i32 %a) {
+; CHECK-LABEL: @f_mul_neg3(
+; CHECK-NEXT:    [[S1:%.*]] = shl i32 [[A:%.*]], 1
+; CHECK-NEXT:    [[T:%.*]] = add i32 [[A]], [[S1]]
+; CHECK-NEXT:    [[R:%.*]] = sub i32 0, [[T]]
+; CHECK-NEXT:    ret i32 [[R]]
+;
+  %r = mul i32 -3, %a
+  ret i32 %r
+}
+
+; 0x57 has more terms than the rule allows, a variable factor has no rule
+define i32 @f_mul_kept(i32 %a, i32 %b) {
+; CHECK-LABEL: @f_mul_kept(
+; CHECK-NEXT:    [[M:%.*]] = mul i32 [[A:%.*]], 87
+; CHECK-NEXT:    [[R:%.*]] = mul i32 [[M]], [[B:%.*]]
+; CHECK-NEXT:    ret i32 [[R]]
+;
+  %m = mul i32 %a, 87
+  %r = mul i32 %m, %b
+  ret i32 %r
+}
+
+; A factor of 1 or -1 is left alone, and %x keeps its name
+define i32 @f_mul_one(i32 %a, i32 %b) {
+; CHECK-LABEL: @f_mul_one(
+; CHECK-NEXT:    %x = lshr i32 %a, %b
+; CHECK-NEXT:    %one = mul i32 %x, 1
+; CHECK-NEXT:    %minus = mul i32 %x, -1
+; CHECK-NEXT:    %r = lshr i32 %one, %minus
+; CHECK-NEXT:    ret i32 %r
+;
+  %x = lshr i32 %a, %b
+  %one = mul i32 %x, 1
+  %minus = mul i32 %x, -1
+  %r = lshr i32 %one, %minus
+  ret i32 %r
+}
+
+define i32 @main() {
+entry:
+  %add = call i32 @f_add(i32 -7, i32 123456)
+  %c.add = icmp ne i32 %add, 123449
+  br i1 %c.add, label %fail, label %check.sub
+
+check.sub:
+  %sub = call i8 @f_sub(i8 5, i8 100)
+  %c.sub = icmp ne i8 %sub, -95
+  br i1 %c.sub, label %fail, label %check.xor
+
+check.xor:
+  %xor = call i32 @f_xor(i32 u0xF0F0F0F0, i32 u0x0FF00FF0)
+  %c.xor = icmp ne i32 %xor, u0x00FF00FF
+  br i1 %c.xor, label %fail, label %check.and
+
+check.and:
+  %and = call i32 @f_and(i32 u0xF0F0F0F0, i32 u0x0FF00FF0)
+  %c.and = icmp ne i32 %and, u0x00F000F0
+  br i1 %c.and, label %fail, label %check.or
+
+check.or:
+  %or = call i64 @f_or(i64 -4294967296, i64 u0x12345678)
+  %c.or = icmp ne i64 %or, u0xFFFFFFFF12345678
+  br i1 %c.or, label %fail, label %check.mul
+
+check.mul:
+  %mul10 = call i32 @f_mul10(i32 -12345)
+  %c.mul10 = icmp ne i32 %mul10, -123450
+  br i1 %c.mul10, label %fail, label %check.mul.neg
+
+check.mul.neg:
+  %mul.neg3 = call i32 @f_mul_neg3(i32 7)
+  %c.mul.neg3 = icmp ne i32 %mul.neg3, -21
+  br i1 %c.mul.neg3, label %fail, label %check.mul.kept
+
+check.mul.kept:
+  %mul.kept = call i32 @f_mul_kept(i32 3, i32 -1)
+  %c.mul.kept = icmp ne i32 %mul.kept, -261
+  br i1 %c.mul.kept, label %fail, label %pass
+
+pass:
+  ret i32 0
+
+fail:
+  ret i32 1
+}
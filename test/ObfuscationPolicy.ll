@@ -0,0 +1,157 @@
+; RUN: printf 'ex* all\nexact none\nglob_* cff  # only flattened\n\nlocked none\n' > %t.policy
+; RUN: opt -load %shlibdir/libObfuscatorPass%shlibext -load-pass-plugin %shlibdir/libObfuscatorPass%shlibext \
+; RUN:   -passes="print<obf-policy>" -obf-policy=%t.policy -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=POLICY
+; RUN: opt -load %shlibdir/libObfuscatorPass%shlibext -load-pass-plugin %shlibdir/libObfuscatorPass%shlibext \
+; RUN:   -passes="mba,cff" -obf-policy=%t.policy -S %s | FileCheck %s
+; RUN: opt -load %shlibdir/libObfuscatorPass%shlibext -load-pass-plugin %shlibdir/libObfuscatorPass%shlibext \
+; RUN:   -passes="mba,cff" -obf-policy=%t.policy %s | lli
+; RUN: opt -load %shlibdir/libMBASub%shlibext -load %shlibdir/libCFF%shlibext \
+; RUN:   -load-pass-plugin %shlibdir/libMBASub%shlibext -load-pass-plugin %shlibdir/libCFF%shlibext \
+; RUN:   -passes="mba,cff" -obf-policy=%t.policy -S %s | FileCheck %s
+; RUN: opt -load %shlibdir/libObfuscatorPass%shlibext -load-pass-plugin %shlibdir/libObfuscatorPass%shlibext \
+; RUN:   -passes="cff" -disable-output %s 2>&1 | FileCheck %s --check-prefix=WARN
+; RUN: printf 'glob_* cff,sub\n' > %t.bad
+; RUN: not opt -load %shlibdir/libObfuscatorPass%shlibext -load-pass-plugin %shlibdir/libObfuscatorPass%shlibext \
+; RUN:   -passes="cff" -obf-policy=%t.bad -disable-output %s 2>&1 | FileCheck %s --check-prefix=BAD
+
+; Annotations win over the policy file, the first matching rule of the file
+; wins and functions matched by nothing get every obfuscation. The plugins of
+; the single passes share one policy, so they can be loaded together. A
+; malformed annotation is ignored with a warning.
+
+; POLICY: hot: none
+; POLICY: crypt: mba
+; POLICY: glob_sum: cff
+; POLICY: exact: cff,mba,opaque,bcf
+; POLICY: locked: none
+; POLICY: warning: ignoring annotation 'obf=nonee' of typo
+; POLICY: typo: cff,mba,opaque,bcf
+; POLICY: main: cff,mba,opaque,bcf
+
+; WARN: warning: ignoring annotation 'obf=nonee' of typo: expected 'obf=<cff,mba|all|none>'
+
+; CHECK-LABEL: @hot(
+; CHECK-NOT:     SwitchVar
+; CHECK:         %s = add nsw i32 %a, %b
+; CHECK-LABEL: @crypt(
+; CHECK-NOT:     SwitchVar
+; CHECK-NOT:     = add nsw i32 %a, %b
+; CHECK:         ret i32
+; CHECK-LABEL: @glob_sum(
+; CHECK:         switch i32 %SwitchVar
+; CHECK:         %s = add nsw i32 %a, %b
+; CHECK-LABEL: @exact(
+; CHECK:         switch i32 %SwitchVar
+; CHECK-NOT:     = add nsw i32 %a, %b
+; CHECK-LABEL: @locked(
+; CHECK-NOT:     SwitchVar
+; CHECK:         %s = add nsw i32 %a, %b
+
+; BAD: {{.*}}.bad:1: expected '<name or glob> <cff,mba|all|none>'
+
+@.str = private unnamed_addr constant [9 x i8] c"obf=none\00", section "llvm.metadata"
+@.str.1 = private unnamed_addr constant [8 x i8] c"obf=mba\00", section "llvm.metadata"
+@.str.2 = private unnamed_addr constant [9 x i8] c"policy.c\00", section "llvm.metadata"
+@.str.3 = private unnamed_addr constant [10 x i8] c"obf=nonee\00", section "llvm.metadata"
+@llvm.global.annotations = appending global [3 x { ptr, ptr, ptr, i32, ptr }] [{ ptr, ptr, ptr, i32, ptr } { ptr @hot, ptr @.str, ptr @.str.2, i32 1, ptr null }, { ptr, ptr, ptr, i32, ptr } { ptr @crypt, ptr @.str.1, ptr @.str.2, i32 8, ptr null }, { ptr, ptr, ptr, i32, ptr } { ptr @typo, ptr @.str.3, ptr @.str.2, i32 15, ptr null }], section "llvm.metadata"
+
+define dso_local i32 @hot(i32 %a, i32 %b) {
+entry:
+  %r = alloca i32, align 4
+  %c = icmp sgt i32 %a, 0
+  br i1 %c, label %then, label %end
+
+then:
+  %s = add nsw i32 %a, %b
+  store i32 %s, ptr %r, align 4
+  br label %end
+
+end:
+  %v = load i32, ptr %r, align 4
+  ret i32 %v
+}
+
+define dso_local i32 @crypt(i32 %a, i32 %b) {
+entry:
+  %r = alloca i32, align 4
+  %c = icmp sgt i32 %a, 0
+  br i1 %c, label %then, label %end
+
+then:
+  %s = add nsw i32 %a, %b
+  store i32 %s, ptr %r, align 4
+  br label %end
+
+end:
+  %v = load i32, ptr %r, align 4
+  ret i32 %v
+}
+
+define dso_local i32 @glob_sum(i32 %a, i32 %b) {
+entry:
+  %r = alloca i32, align 4
+  %c = icmp sgt i32 %a, 0
+  br i1 %c, label %then, label %end
+
+then:
+  %s = add nsw i32 %a, %b
+  store i32 %s, ptr %r, align 4
+  br label %end
+
+end:
+  %v = load i32, ptr %r, align 4
+  ret i32 %v
+}
+
+define dso_local i32 @exact(i32 %a, i32 %b) {
+entry:
+  %r = alloca i32, align 4
+  %c = icmp sgt i32 %a, 0
+  br i1 %c, label %then, label %end
+
+then:
+  %s = add nsw i32 %a, %b
+  store i32 %s, ptr %r, align 4
+  br label %end
+
+end:
+  %v = load i32, ptr %r, align 4
+  ret i32 %v
+}
+
+define dso_local i32 @locked(i32 %a, i32 %b) {
+entry:
+  %r = alloca i32, align 4
+  %c = icmp sgt i32 %a, 0
+  br i1 %c, label %then, label %end
+
+then:
+  %s = add nsw i32 %a, %b
+  store i32 %s, ptr %r, align 4
+  br label %end
+
+end:
+  %v = load i32, ptr %r, align 4
+  ret i32 %v
+}
+
+define dso_local i32 @typo(i32 %a) {
+entry:
+  ret i32 %a
+}
+
+define dso_local i32 @main() {
+entry:
+  %h = call i32 @hot(i32 1, i32 2)
+  %c = call i32 @crypt(i32 1, i32 2)
+  %g = call i32 @glob_sum(i32 1, i32 2)
+  %e = call i32 @exact(i32 1, i32 2)
+  %l = call i32 @locked(i32 1, i32 2)
+  %hc = add i32 %h, %c
+  %ge = add i32 %g, %e
+  %sum = add i32 %hc, %ge
+  %all = add i32 %sum, %l
+  %ret = sub i32 %all, 15
+  ret i32 %ret
+}
@@ -0,0 +1,32 @@
+; RUN: opt -load-pass-plugin %shlibdir/libObfuscatorPass%shlibext \
+; RUN:   -passes="print<cfg>,mba-sub,cff,print<opcode-counter>" -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s
+
+; One plugin load registers every pipeline name.
+
+; CHECK-LABEL: Printing analysis 'CFG' for function 'main':
+; CHECK-NEXT:  for/while loop: {{.*}}%c = icmp sgt i32 %v, 0
+; CHECK-LABEL: Printing analysis 'OpcodeCounter Pass' for function 'main':
+; CHECK-DAG:   switch 1
+; CHECK-DAG:   select 1
+; CHECK-DAG:   add 2
+; CHECK-NOT:   sub
+; CHECK:       -------------------------------------------------
+define dso_local i32 @main() {
+entry:
+  %ret = alloca i32, align 4
+  store i32 69, ptr %ret, align 4
+  br label %header
+header:
+  %v = load i32, ptr %ret, align 4
+  %c = icmp sgt i32 %v, 0
+  br i1 %c, label %body, label %exit
+body:
+  %v1 = load i32, ptr %ret, align 4
+  %d = sub nsw i32 %v1, 1
+  store i32 %d, ptr %ret, align 4
+  br label %header
+exit:
+  %r = load i32, ptr %ret, align 4
+  ret i32 %r
+}
@@ -0,0 +1,84 @@
+; RUN: opt -load-pass-plugin %shlibdir/libObfuscatorPass%shlibext \
+; RUN:   -passes="mba,cff,opaque,bcf" -pass-remarks="cff|mba-sub|opaque|bcf" \
+; RUN:   -pass-remarks-missed="cff|mba-sub|opaque|bcf" -disable-output %s 2>&1 \
+; RUN:   | FileCheck %s
+; RUN: opt -load-pass-plugin %shlibdir/libObfuscatorPass%shlibext \
+; RUN:   -passes="cff" -pass-remarks-output=%t.yaml -disable-output %s
+; RUN: FileCheck %s --check-prefix=YAML < %t.yaml
+
+; Every pass reports what it did to each function, with the instruction
+; count before and after, and why it left a function alone.
+
+; CHECK: remark: {{.*}} rewrote 3 instructions of count_up, 0 over budget; 13 to 21 instructions
+; CHECK: remark: {{.*}} flattened 4 blocks of count_up into 1 dispatchers, keeping 0 hot blocks; 21 to {{[0-9]+}} instructions
+; CHECK: remark: {{.*}} inserted {{[0-9]+}} opaque predicates in count_up, {{[0-9]+}} over budget; {{[0-9]+}} to {{[0-9]+}} instructions
+; CHECK: remark: {{.*}} inserted bogus control flow in {{[0-9]+}} blocks of count_up, {{[0-9]+}} over budget; {{[0-9]+}} to {{[0-9]+}} instructions, {{[0-9]+}} of them in junk blocks
+; CHECK: remark: {{.*}} rewrote 1 instructions of tiny, 0 over budget; 2 to 4 instructions
+; CHECK: remark: {{.*}} tiny not flattened: too small, at most one block past the entry
+; CHECK: remark: {{.*}} no opaque predicates in tiny: 0 candidate branches, 0 over budget
+; CHECK: remark: {{.*}} no bogus control flow in tiny: 0 candidate blocks, 0 over budget
+; CHECK: remark: {{.*}} no MBA in throws: no candidate instructions
+; CHECK: remark: {{.*}} throws not flattened: has invokes or landing pads
+
+; YAML:      --- !Passed
+; YAML-NEXT: Pass:            cff
+; YAML-NEXT: Name:            Flattened
+; YAML-NEXT: Function:        count_up
+; YAML-NEXT: Args:
+; YAML:        - Blocks:          '4'
+; YAML:        - InstsBefore:     '13'
+; YAML:        - InstsAfter:      '{{[0-9]+}}'
+; YAML:      --- !Missed
+; YAML-NEXT: Pass:            cff
+; YAML-NEXT: Name:            TooSmall
+; YAML-NEXT: Function:        tiny
+; YAML:      --- !Missed
+; YAML-NEXT: Pass:            cff
+; YAML-NEXT: Name:            ExceptionHandling
+; YAML-NEXT: Function:        throws
+
+define i32 @count_up(i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %acc = phi i32 [ 0, %entry ], [ %acc.next, %latch ]
+  %odd = and i32 %i, 1
+  %is.odd = icmp ne i32 %odd, 0
+  br i1 %is.odd, label %add, label %latch
+
+add:
+  %sum = add i32 %acc, %i
+  br label %latch
+
+latch:
+  %acc.next = phi i32 [ %acc, %loop ], [ %sum, %add ]
+  %i.next = add i32 %i, 1
+  %done = icmp sge i32 %i.next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret i32 %acc.next
+}
+
+define i32 @tiny(i32 %a, i32 %b) {
+  %d = sub i32 %a, %b
+  ret i32 %d
+}
+
+declare void @may_throw()
+declare i32 @__gxx_personality_v0(...)
+
+define void @throws() personality ptr @__gxx_personality_v0 {
+entry:
+  invoke void @may_throw()
+          to label %ok unwind label %lpad
+
+ok:
+  ret void
+
+lpad:
+  %lp = landingpad { ptr, i32 } cleanup
+  resume { ptr, i32 } %lp
+}
@@ -0,0 +1,128 @@
+; RUN: opt -load %shlibdir/libOpaquePredicate%shlibext -load-pass-plugin %shlibdir/libOpaquePredicate%shlibext -passes="opaque" -S %s | FileCheck %s
+; RUN: opt -load %shlibdir/libOpaquePredicate%shlibext -load-pass-plugin %shlibdir/libOpaquePredicate%shlibext -passes="opaque" -opaque-budget=4 -S %s | FileCheck %s --check-prefix=SMALL
+; RUN: opt -load %shlibdir/libOpaquePredicate%shlibext -load-pass-plugin %shlibdir/libOpaquePredicate%shlibext -passes="opaque" -opaque-budget=0 -S %s | FileCheck %s --check-prefix=ALL
+; RUN: opt -load %shlibdir/libOpaquePredicate%shlibext -load-pass-plugin %shlibdir/libOpaquePredicate%shlibext -passes="opaque" -opaque-budget=0 %s | lli
+; RUN: opt -load %shlibdir/libOpaquePredicate%shlibext -load-pass-plugin %shlibdir/libOpaquePredicate%shlibext -passes="function(opaque),default<O2>" -opaque-budget=0 -S %s | FileCheck %s --check-prefix=O2
+
+; A predicate on two operands costs 5 instructions, on one 2. The default
+; budget of 8 per call covers two-operand predicates in the blocks running
+; at most once per call, not the one in the loop. A budget of 4 goes to the
+; coldest block first and leaves room for a one-operand predicate only.
+; The never-taken edge goes to a later block whose dominator dominates the
+; branch (%more to %less), or to a shared return. The predicates are built
+; on values the blocks compute, so -O2 can't fold them away.
+
+; CHECK-LABEL: @clamp_sum(
+; CHECK:       negative:
+; CHECK-NEXT:    %abs = sub i32 0, %n
+; CHECK-NEXT:    [[X:%.*]] = freeze i32 %abs
+; CHECK-NEXT:    [[SQ:%.*]] = mul i32 [[X]], [[X]]
+; CHECK-NEXT:    [[Y:%.*]] = freeze i32 %n
+; CHECK-NEXT:    [[YSQ:%.*]] = mul i32 [[Y]], [[Y]]
+; CHECK-NEXT:    [[SCALED:%.*]] = mul i32 [[YSQ]], {{-?[0-9]+}}
+; CHECK-NEXT:    [[RHS:%.*]] = sub i32 [[SCALED]], {{-?[0-9]+}}
+; CHECK-NEXT:    [[P:%.*]] = icmp {{eq|ne}} i32 [[SQ]], [[RHS]]
+; CHECK-NEXT:    br i1 [[P]], label %{{.*}}, label %{{.*}}, !prof
+; CHECK:       loop.preheader:
+; CHECK:         br i1 {{.*}}, !prof
+; CHECK:       even:
+; CHECK-NEXT:    %acc.even = add i32 %acc, %i
+; CHECK-NEXT:    br label %latch
+; CHECK:       OpaqueExit:
+; CHECK-NEXT:    ret i32 0
+; CHECK-LABEL: @pick(
+; CHECK:       less:
+; CHECK:         br i1 {{.*}}, !prof
+; CHECK:       more:
+; CHECK:         br i1 %{{.*}}, label %{{join|less}}, label %{{join|less}}, !prof
+
+; SMALL-LABEL: @clamp_sum(
+; SMALL:       negative:
+; SMALL-COUNT-3: mul i32
+; SMALL:       loop.preheader:
+; SMALL-NEXT:    %m = phi
+; SMALL-NEXT:    [[X:%.*]] = freeze i32 %m
+; SMALL-NEXT:    [[SQ:%.*]] = mul i32 [[X]], [[X]]
+; SMALL-NEXT:    [[P:%.*]] = icmp {{eq|ne}} i32 [[SQ]], {{-?[0-9]+}}
+; SMALL-NEXT:    br i1 [[P]], label %{{.*}}, label %{{.*}}, !prof
+; SMALL:       even:
+; SMALL-NEXT:    %acc.even = add i32 %acc, %i
+; SMALL-NEXT:    br label %latch
+
+; ALL-LABEL: @clamp_sum(
+; ALL:       even:
+; ALL-NEXT:    %acc.even = add i32 %acc, %i
+; ALL:         br i1 {{.*}}, !prof
+; ALL:       latch:
+
+; O2-LABEL: @clamp_sum(
+; O2:         mul i32
+; O2:         br i1 {{.*}}, !prof
+; O2-LABEL: @pick(
+; O2:         mul i32
+; O2:         br i1 {{.*}}, !prof
+
+define i32 @clamp_sum(i32 %n, i32 %lo) {
+entry:
+  %neg = icmp slt i32 %n, 0
+  br i1 %neg, label %negative, label %loop.preheader
+
+negative:
+  %abs = sub i32 0, %n
+  br label %loop.preheader
+
+loop.preheader:
+  %m = phi i32 [ %abs, %negative ], [ %n, %entry ]
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %loop.preheader ], [ %i.next, %latch ]
+  %acc = phi i32 [ 0, %loop.preheader ], [ %acc.next, %latch ]
+  %odd = and i32 %i, 1
+  %even.i = icmp eq i32 %odd, 0
+  br i1 %even.i, label %even, label %latch
+
+even:
+  %acc.even = add i32 %acc, %i
+  br label %latch
+
+latch:
+  %acc.next = phi i32 [ %acc, %loop ], [ %acc.even, %even ]
+  %i.next = add i32 %i, 1
+  %done = icmp sge i32 %i.next, %m
+  br i1 %done, label %exit, label %loop
+
+exit:
+  %r = add i32 %acc.next, %lo
+  ret i32 %r
+}
+
+define i32 @pick(i32 %a, i32 %b) {
+entry:
+  %lt = icmp slt i32 %a, %b
+  br i1 %lt, label %less, label %more
+
+less:
+  %d1 = sub i32 %b, %a
+  br label %join
+
+more:
+  %d2 = sub i32 %a, %b
+  br label %join
+
+join:
+  %d = phi i32 [ %d1, %less ], [ %d2, %more ]
+  ret i32 %d
+}
+
+define i32 @main() {
+  %s = call i32 @clamp_sum(i32 -10, i32 1)
+  %p = call i32 @pick(i32 3, i32 10)
+  %q = call i32 @pick(i32 10, i32 3)
+  %t = add i32 %p, %q
+  %ok1 = icmp eq i32 %s, 21
+  %ok2 = icmp eq i32 %t, 14
+  %ok = and i1 %ok1, %ok2
+  %ret = select i1 %ok, i32 0, i32 1
+  ret i32 %ret
+}
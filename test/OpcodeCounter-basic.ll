@@ -6,11 +6,11 @@ define dso_local i32 @foo(i32 noundef %0) #0 {
 ; CHECK-NEXT:  =================================================
 ; CHECK-NEXT:  OPCODE #TIMES USED
 ; CHECK-NEXT:  -------------------------------------------------
-; CHECK-NEXT:  load 1
 ; CHECK-NEXT:  ret 1
+; CHECK-NEXT:  mul 1
 ; CHECK-NEXT:  alloca 1
+; CHECK-NEXT:  load 1
 ; CHECK-NEXT:  store 1
-; CHECK-NEXT:  mul 1
 ; CHECK-NEXT:  -------------------------------------------------
 ;
   %2 = alloca i32, align 4
@@ -25,12 +25,12 @@ define dso_local i32 @bar(i32 noundef %0, i32 noundef %1) #0 {
 ; CHECK-NEXT:  =================================================
 ; CHECK-NEXT:  OPCODE #TIMES USED
 ; CHECK-NEXT:  -------------------------------------------------
-; CHECK-NEXT:  load 2
-; CHECK-NEXT:  add 1
 ; CHECK-NEXT:  ret 1
+; CHECK-NEXT:  add 1
+; CHECK-NEXT:  mul 1
 ; CHECK-NEXT:  alloca 2
+; CHECK-NEXT:  load 2
 ; CHECK-NEXT:  store 2
-; CHECK-NEXT:  mul 1
 ; CHECK-NEXT:  call 1
 ; CHECK-NEXT:  -------------------------------------------------
 ;
@@ -51,12 +51,12 @@ define dso_local i32 @fez(i32 noundef %0, i32 noundef %1, i32 noundef %2) #0 {
 ; CHECK-NEXT:  =================================================
 ; CHECK-NEXT:  OPCODE #TIMES USED
 ; CHECK-NEXT:  -------------------------------------------------
-; CHECK-NEXT:  load 4
-; CHECK-NEXT:  add 2
 ; CHECK-NEXT:  ret 1
+; CHECK-NEXT:  add 2
+; CHECK-NEXT:  mul 2
 ; CHECK-NEXT:  alloca 3
+; CHECK-NEXT:  load 4
 ; CHECK-NEXT:  store 3
-; CHECK-NEXT:  mul 2
 ; CHECK-NEXT:  call 1
 ; CHECK-NEXT:  -------------------------------------------------
 ;
@@ -83,10 +83,10 @@ define dso_local i32 @main(i32 noundef %0, ptr noundef %1) #0 {
 ; CHECK-NEXT:  =================================================
 ; CHECK-NEXT:  OPCODE #TIMES USED
 ; CHECK-NEXT:  -------------------------------------------------
-; CHECK-NEXT:  load 9
-; CHECK-NEXT:  add 3
 ; CHECK-NEXT:  ret 1
+; CHECK-NEXT:  add 3
 ; CHECK-NEXT:  alloca 5
+; CHECK-NEXT:  load 9
 ; CHECK-NEXT:  store 8
 ; CHECK-NEXT:  call 3
 ; CHECK-NEXT:  -------------------------------------------------
@@ -0,0 +1,31 @@
+; RUN: opt -load %shlibdir/libOpcodeCounter%shlibext -load-pass-plugin %shlibdir/libOpcodeCounter%shlibext -passes="print<opcode-counter-module>" -disable-output %s | FileCheck %s
+; RUN: opt -load %shlibdir/libOpcodeCounter%shlibext -load-pass-plugin %shlibdir/libOpcodeCounter%shlibext -passes="print<opcode-counter-module>" -opcode-counter-threads=1 -disable-output %s | FileCheck %s
+; RUN: opt -load %shlibdir/libObfuscatorPass%shlibext -load-pass-plugin %shlibdir/libObfuscatorPass%shlibext -passes="print<opcode-counter-module>,function(mba-sub),print<opcode-counter-module>" -disable-output %s | FileCheck %s --check-prefixes=CHECK,MBA
+
+; The declaration is not counted, every defined function is, whichever thread
+; it lands on
+; CHECK: {"module":"{{.*}}OpcodeCounter-module.ll","functions":3,"instructions":11,"opcodes":{"ret":3,"add":2,"sub":2,"mul":1,"call":3}}
+; After mba-sub each sub is an add of an xor plus one
+; MBA-NEXT: {"module":"{{.*}}OpcodeCounter-module.ll","functions":3,"instructions":15,"opcodes":{"ret":3,"add":6,"mul":1,"xor":2,"call":3}}
+
+declare i32 @ext(i32)
+
+define i32 @foo(i32 %a, i32 %b) {
+  %1 = sub i32 %a, %b
+  %2 = call i32 @ext(i32 %1)
+  ret i32 %2
+}
+
+define i32 @bar(i32 %a, i32 %b) {
+  %1 = add i32 %a, %b
+  %2 = sub i32 %1, %b
+  %3 = call i32 @foo(i32 %2, i32 %a)
+  ret i32 %3
+}
+
+define i32 @main() {
+  %1 = call i32 @bar(i32 3, i32 4)
+  %2 = mul i32 %1, 2
+  %3 = add i32 %2, -6
+  ret i32 %3
+}
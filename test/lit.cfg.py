@@ -5,6 +5,7 @@
 
 import os
 import platform
+import sys
 
 import lit.formats
 from lit.llvm import llvm_config
@@ -55,9 +56,14 @@ llvm_config.add_tool_substitutions(tool_substitutions)
 
 # The list of tools required for testing - prepend them with the path specified
 # during configuration (i.e. LT_LLVM_TOOLS_DIR/bin)
-tools = ["opt", "lli", "not", "FileCheck", "clang"]
+tools = ["opt", "llc", "lli", "not", "FileCheck", "clang"]
 llvm_config.add_tool_substitutions(tools, config.llvm_tools_dir)
 
+# The drivers built by this project (tools/)
+obfuscator_tools = ["obfuscator-opt", "obfuscator-split", "obfuscator-profdata"]
+llvm_config.add_tool_substitutions(obfuscator_tools, config.obfuscator_tools_dir)
+
 # Add site-specific substitutions.
 config.substitutions.append(('%shlibext', config.llvm_shlib_ext))
 config.substitutions.append(('%shlibdir', config.llvm_shlib_dir))
+config.substitutions.append(('%python', sys.executable))
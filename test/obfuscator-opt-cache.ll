@@ -0,0 +1,116 @@
+; RUN: rm -rf %t.cache
+; RUN: opt -passes=verify %s -o %t.bc
+; RUN: obfuscator-opt -passes="mba,cff" -cff-dispatch=indirect -cache-dir=%t.cache \
+; RUN:   -cache-stats -S %t.bc -o %t.cold.ll 2>&1 | FileCheck %s --check-prefix=COLD
+; RUN: obfuscator-opt -passes="mba,cff" -cff-dispatch=indirect -cache-dir=%t.cache \
+; RUN:   -cache-stats -S %t.bc -o %t.warm.ll 2>&1 | FileCheck %s --check-prefix=WARM
+; RUN: diff %t.cold.ll %t.warm.ll
+; RUN: FileCheck %s < %t.warm.ll
+; RUN: lli %t.warm.ll
+
+; Another output format misses the output but hits every function.
+; RUN: obfuscator-opt -passes="mba,cff" -cff-dispatch=indirect -cache-dir=%t.cache \
+; RUN:   -cache-stats %t.bc -o %t.warm.bc 2>&1 | FileCheck %s --check-prefix=FORMAT
+; RUN: opt -S %t.warm.bc -o - | FileCheck %s
+
+; Another pass option misses, so does a rebuilt obfuscator-opt (here the
+; same one with a byte appended).
+; RUN: obfuscator-opt -passes="mba,cff" -cache-dir=%t.cache -cache-stats -S %t.bc \
+; RUN:   -o /dev/null 2>&1 | FileCheck %s --check-prefix=OPTION
+; RUN: cp obfuscator-opt %t.tool && printf x >> %t.tool
+; RUN: %t.tool -passes="mba,cff" -cff-dispatch=indirect -cache-dir=%t.cache \
+; RUN:   -cache-stats -S %t.bc -o /dev/null 2>&1 | FileCheck %s --check-prefix=OPTION
+
+; An edited function misses, but only that one. The input path is the module
+; identifier, which salts the RNG, so the edited module takes the place of
+; the original one.
+; RUN: sed 's/add nsw i32 %old, 3/add nsw i32 %old, 5/' %s \
+; RUN:   | opt -passes=verify -o %t.bc
+; RUN: obfuscator-opt -passes="mba,cff" -cff-dispatch=indirect -cache-dir=%t.cache \
+; RUN:   -cache-stats -S %t.bc -o %t.edit.ll 2>&1 | FileCheck %s --check-prefix=EDIT
+; RUN: obfuscator-opt -passes="mba,cff" -cff-dispatch=indirect -S %t.bc \
+; RUN:   -o %t.fresh.ll
+; RUN: diff %t.fresh.ll %t.edit.ll
+; RUN: FileCheck %s < %t.edit.ll
+; RUN: not lli %t.edit.ll
+
+; An unchanged input is a copy of the output stored the first time. A hit on
+; a function puts back the obfuscated body, its dispatch table and the named
+; struct it uses, and the output is the same as without the cache.
+
+; COLD:   cache: 0 hits, 3 misses
+; WARM:   cache: module hit
+; FORMAT: cache: 3 hits, 0 misses
+; OPTION: cache: 0 hits, 3 misses
+; EDIT:   cache: 2 hits, 1 misses
+
+; CHECK: %struct.pair = type { i32, i32 }
+; CHECK-NOT: %struct.pair.
+; CHECK: @counter = internal global i32 0
+; CHECK: @sum_pair.cff.table = private constant
+; CHECK: @bump.cff.table = private constant
+; CHECK-LABEL: define dso_local i32 @sum_pair(
+; CHECK:         getelementptr inbounds %struct.pair, ptr %p
+; CHECK:         indirectbr
+; CHECK-LABEL: define internal i32 @bump(
+; CHECK:         load i32, ptr @counter
+; CHECK:         indirectbr
+
+source_filename = "cache.c"
+
+%struct.pair = type { i32, i32 }
+
+@counter = internal global i32 0
+
+define dso_local i32 @sum_pair(ptr %p) {
+entry:
+  %a.addr = getelementptr inbounds %struct.pair, ptr %p, i32 0, i32 0
+  %b.addr = getelementptr inbounds %struct.pair, ptr %p, i32 0, i32 1
+  %a = load i32, ptr %a.addr, align 4
+  %b = load i32, ptr %b.addr, align 4
+  %neg = icmp slt i32 %a, 0
+  br i1 %neg, label %swap, label %add
+
+swap:
+  %d = sub nsw i32 %b, %a
+  ret i32 %d
+
+add:
+  %s = add nsw i32 %a, %b
+  ret i32 %s
+}
+
+define internal i32 @bump(i32 %n) {
+entry:
+  %old = load i32, ptr @counter, align 4
+  %big = icmp sgt i32 %n, 10
+  br i1 %big, label %more, label %done
+
+more:
+  %new = add nsw i32 %old, 3
+  store i32 %new, ptr @counter, align 4
+  br label %done
+
+done:
+  %r = load i32, ptr @counter, align 4
+  ret i32 %r
+}
+
+define dso_local i32 @main() {
+entry:
+  %p = alloca %struct.pair, align 4
+  %a.addr = getelementptr inbounds %struct.pair, ptr %p, i32 0, i32 0
+  %b.addr = getelementptr inbounds %struct.pair, ptr %p, i32 0, i32 1
+  store i32 6, ptr %a.addr, align 4
+  store i32 5, ptr %b.addr, align 4
+  %s = call i32 @sum_pair(ptr %p)
+  %c = call i32 @bump(i32 %s)
+  %ok = icmp eq i32 %c, 3
+  br i1 %ok, label %pass, label %fail
+
+pass:
+  ret i32 0
+
+fail:
+  ret i32 1
+}
@@ -0,0 +1,103 @@
+; RUN: opt -passes=verify %s -o %t.bc
+; RUN: obfuscator-opt -passes="cff" -func="count*" -S %t.bc -o - | FileCheck %s
+; RUN: obfuscator-opt -passes="function(cff)" -func="count*" -mmap=false -S %t.bc -o - \
+; RUN:   | FileCheck %s
+; RUN: obfuscator-opt -passes="mba,cff" %t.bc -o %t.all.bc
+; RUN: lli %t.all.bc
+; RUN: obfuscator-opt -passes="function(mba),function(cff)" %t.bc -o %t.split.bc
+; RUN: lli %t.split.bc
+; RUN: obfuscator-opt -passes="function(mba),function(cff)" -func="count*" -S %t.bc -o - \
+; RUN:   | FileCheck %s
+; RUN: not obfuscator-opt -passes="print<opcode-counter-module>" %t.bc -o /dev/null 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=ERROR
+; RUN: obfuscator-opt -passes="mba,cff" -func="count*" -time-trace \
+; RUN:   -time-trace-granularity=0 -time-trace-file=%t.json %t.bc -o /dev/null
+; RUN: FileCheck %s --check-prefix=TRACE < %t.json
+
+; Only the functions matching -func are loaded and flattened, the others are
+; written back as they were read. Each "function(...)" of -passes is unwrapped
+; and module passes are rejected. -time-trace records each selected function,
+; the passes run on it and their phases.
+
+; CHECK-LABEL: define internal i32 @square(
+; CHECK-NOT:     SwitchVar
+; CHECK:         ret i32
+; CHECK-LABEL: define dso_local i32 @count_up(
+; CHECK:         switch i32 %SwitchVar
+; CHECK-LABEL: define dso_local i32 @main(
+; CHECK-NOT:     SwitchVar
+; CHECK:         ret i32
+
+; ERROR: obfuscator-opt: unknown function pass 'print<opcode-counter-module>'
+
+; TRACE-DAG: "name":"MBASub","args":{"detail":"count_up"}
+; TRACE-DAG: "name":"ControlFlowFlattening","args":{"detail":"count_up"}
+; TRACE-DAG: "name":"CFFDemotePHIs"
+; TRACE-DAG: "name":"ObfuscateFunction","args":{"detail":"count_up"}
+
+define internal i32 @square(i32 %x) {
+entry:
+  %r = alloca i32, align 4
+  %neg = icmp slt i32 %x, 0
+  br i1 %neg, label %flip, label %done
+
+flip:
+  %y = sub i32 0, %x
+  store i32 %y, ptr %r, align 4
+  br label %mul
+
+done:
+  store i32 %x, ptr %r, align 4
+  br label %mul
+
+mul:
+  %v = load i32, ptr %r, align 4
+  %sq = mul i32 %v, %v
+  ret i32 %sq
+}
+
+define dso_local i32 @count_up(i32 %n) {
+entry:
+  %i = alloca i32, align 4
+  store i32 0, ptr %i, align 4
+  br label %loop
+
+loop:
+  %iv = load i32, ptr %i, align 4
+  %c = icmp slt i32 %iv, %n
+  br i1 %c, label %body, label %exit
+
+body:
+  %next = add i32 %iv, 1
+  store i32 %next, ptr %i, align 4
+  br label %loop
+
+exit:
+  %r = load i32, ptr %i, align 4
+  ret i32 %r
+}
+
+define dso_local i32 @main() {
+entry:
+  %ok = alloca i32, align 4
+  %s = call i32 @square(i32 -7)
+  %c = call i32 @count_up(i32 10)
+  %s.ok = icmp eq i32 %s, 49
+  br i1 %s.ok, label %check.count, label %fail
+
+check.count:
+  %c.ok = icmp eq i32 %c, 10
+  br i1 %c.ok, label %pass, label %fail
+
+pass:
+  store i32 0, ptr %ok, align 4
+  br label %exit
+
+fail:
+  store i32 1, ptr %ok, align 4
+  br label %exit
+
+exit:
+  %r = load i32, ptr %ok, align 4
+  ret i32 %r
+}
@@ -0,0 +1,87 @@
+; RUN: obfuscator-split -passes="function(cff)" -partitions=3 -j1 -S %s -o %t.j1.ll
+; RUN: obfuscator-split -passes="function(cff)" -partitions=3 -j3 -S %s -o %t.j3.ll
+; RUN: diff %t.j1.ll %t.j3.ll
+; RUN: FileCheck %s < %t.j1.ll
+; RUN: lli %t.j1.ll
+; RUN: not obfuscator-split -passes="no-such-pass" %s -o /dev/null 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=ERROR
+
+; The partitions are obfuscated on their own threads and linked back: the
+; output doesn't depend on the thread count, every function is flattened,
+; keeps its linkage and its place in the module.
+
+; CHECK:       define internal i32 @square(
+; CHECK:         switch i32 %SwitchVar
+; CHECK:       define dso_local i32 @count(
+; CHECK:         switch i32 %SwitchVar
+; CHECK:       define dso_local i32 @main(
+; CHECK:         switch i32 %SwitchVar
+
+; ERROR: error: partition 0: unknown pass name 'no-such-pass'
+
+define internal i32 @square(i32 %x) {
+entry:
+  %r = alloca i32, align 4
+  %neg = icmp slt i32 %x, 0
+  br i1 %neg, label %flip, label %done
+
+flip:
+  %y = sub i32 0, %x
+  store i32 %y, ptr %r, align 4
+  br label %mul
+
+done:
+  store i32 %x, ptr %r, align 4
+  br label %mul
+
+mul:
+  %v = load i32, ptr %r, align 4
+  %sq = mul i32 %v, %v
+  ret i32 %sq
+}
+
+define dso_local i32 @count(i32 %n) {
+entry:
+  %i = alloca i32, align 4
+  store i32 0, ptr %i, align 4
+  br label %loop
+
+loop:
+  %iv = load i32, ptr %i, align 4
+  %c = icmp slt i32 %iv, %n
+  br i1 %c, label %body, label %exit
+
+body:
+  %next = add i32 %iv, 1
+  store i32 %next, ptr %i, align 4
+  br label %loop
+
+exit:
+  %r = load i32, ptr %i, align 4
+  ret i32 %r
+}
+
+define dso_local i32 @main() {
+entry:
+  %ok = alloca i32, align 4
+  %s = call i32 @square(i32 -7)
+  %c = call i32 @count(i32 10)
+  %s.ok = icmp eq i32 %s, 49
+  br i1 %s.ok, label %check.count, label %fail
+
+check.count:
+  %c.ok = icmp eq i32 %c, 10
+  br i1 %c.ok, label %pass, label %fail
+
+pass:
+  store i32 0, ptr %ok, align 4
+  br label %exit
+
+fail:
+  store i32 1, ptr %ok, align 4
+  br label %exit
+
+exit:
+  %r = load i32, ptr %ok, align 4
+  ret i32 %r
+}
@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+"""Emit a synthetic -O0 style function with a long chain of basic blocks.
+
+Every block loads a counter, bumps it and conditionally branches either to the
+next block or to the exit block, which gives the flattening dispatcher one case
+per generated block.
+
+With <blocks-per-loop>, the chain is cut into consecutive loops of that many
+blocks (header, body blocks, latch), each running %n times.
+
+Usage: gen-blocks.py <num-blocks> [<blocks-per-loop>]
+"""
+
+import sys
+
+
+def emit_chain(out, num_blocks):
+    for i in range(num_blocks):
+        succ = "bb%d" % (i + 1) if i + 1 < num_blocks else "exit"
+        out.append("bb%d:" % i)
+        out.append("  %%v%d = load i32, ptr %%ret, align 4" % i)
+        out.append("  %%a%d = add nsw i32 %%v%d, %d" % (i, i, i))
+        out.append("  store i32 %%a%d, ptr %%ret, align 4" % i)
+        out.append("  %%c%d = icmp slt i32 %%a%d, %%n" % (i, i))
+        out.append("  br i1 %%c%d, label %%%s, label %%exit" % (i, succ))
+
+
+def emit_loops(out, num_blocks, blocks_per_loop):
+    num_loops = max(1, num_blocks // blocks_per_loop)
+    for l in range(num_loops):
+        succ = "h%d" % (l + 1) if l + 1 < num_loops else "exit"
+        out.append("h%d:" % l)
+        out.append("  %%iv%d = load i32, ptr %%i, align 4" % l)
+        out.append("  %%ic%d = icmp slt i32 %%iv%d, %%n" % (l, l))
+        out.append("  br i1 %%ic%d, label %%b%d_0, label %%x%d" % (l, l, l))
+        for b in range(blocks_per_loop - 2):
+            name = "%d_%d" % (l, b)
+            next_body = "b%d_%d" % (l, b + 1)
+            if b + 1 == blocks_per_loop - 2:
+                next_body = "latch%d" % l
+            out.append("b%s:" % name)
+            out.append("  %%v%s = load i32, ptr %%ret, align 4" % name)
+            out.append("  %%a%s = add i32 %%v%s, %d" % (name, name, b + 1))
+            out.append("  store i32 %%a%s, ptr %%ret, align 4" % name)
+            out.append("  %%m%s = and i32 %%a%s, 1" % (name, name))
+            out.append("  %%c%s = icmp eq i32 %%m%s, 0" % (name, name))
+            out.append("  br i1 %%c%s, label %%%s, label %%latch%d"
+                       % (name, next_body, l))
+        out.append("latch%d:" % l)
+        out.append("  %%lv%d = load i32, ptr %%i, align 4" % l)
+        out.append("  %%in%d = add nsw i32 %%lv%d, 1" % (l, l))
+        out.append("  store i32 %%in%d, ptr %%i, align 4" % l)
+        out.append("  br label %%h%d" % l)
+        out.append("x%d:" % l)
+        out.append("  store i32 0, ptr %i, align 4")
+        out.append("  br label %%%s" % succ)
+
+
+def main():
+    num_blocks = int(sys.argv[1]) if len(sys.argv) > 1 else 10000
+    blocks_per_loop = int(sys.argv[2]) if len(sys.argv) > 2 else 0
+
+    out = []
+    out.append("define dso_local i32 @chain(i32 noundef %n) {")
+    out.append("entry:")
+    out.append("  %ret = alloca i32, align 4")
+    out.append("  %i = alloca i32, align 4")
+    out.append("  store i32 0, ptr %ret, align 4")
+    out.append("  store i32 0, ptr %i, align 4")
+    if blocks_per_loop > 2:
+        out.append("  br label %h0")
+        emit_loops(out, num_blocks, blocks_per_loop)
+    else:
+        out.append("  br label %bb0")
+        emit_chain(out, num_blocks)
+    out.append("exit:")
+    out.append("  %r = load i32, ptr %ret, align 4")
+    out.append("  ret i32 %r")
+    out.append("}")
+
+    sys.stdout.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,481 @@
+#include "FunctionCache.hpp"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/Sequence.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Attributes.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/TypeFinder.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+namespace llvm {
+
+/// Bump when the layout of the entries or of the key changes
+static constexpr const char *CacheVersion = "obfuscator-cache-4";
+
+namespace {
+
+/**
+ * @brief Maps the named structs of a parsed entry to the ones of the module
+ * it is loaded into
+ * @note Parsing bitcode always creates fresh named structs, and since the
+ * context already has the names it suffixes them with ".<N>"
+ */
+class EntryTypeRemapper : public ValueMapTypeRemapper {
+public:
+  /**
+   * @return false if a struct of Entry has no counterpart of the same layout
+   */
+  bool init(Module &Entry) {
+    TypeFinder Structs;
+    Structs.run(Entry, /*onlyNamed=*/false);
+
+    SmallVector<std::pair<StructType *, StructType *>, 8> Pairs;
+    for (StructType *Fresh : Structs) {
+      if (Fresh->isLiteral()) {
+        continue;
+      }
+
+      StringRef Name = Fresh->getName();
+      size_t Dot = Name.rfind('.');
+      if (Dot == StringRef::npos || !all_of(Name.drop_front(Dot + 1), isDigit)) {
+        return false;
+      }
+      StructType *Existing =
+          StructType::getTypeByName(Entry.getContext(), Name.take_front(Dot));
+      if (Existing == nullptr) {
+        return false;
+      }
+      Mapped[Fresh] = Existing;
+      Pairs.emplace_back(Fresh, Existing);
+    }
+    HasFreshStructs = !Pairs.empty();
+
+    return all_of(Pairs, [&](const auto &Pair) {
+      StructType *Fresh = Pair.first;
+      StructType *Existing = Pair.second;
+      if (Fresh->isOpaque() || Existing->isOpaque()) {
+        return Fresh->isOpaque() == Existing->isOpaque();
+      }
+      return Fresh->isPacked() == Existing->isPacked() &&
+             Fresh->getNumElements() == Existing->getNumElements() &&
+             all_of(seq(0u, Fresh->getNumElements()), [&](unsigned Index) {
+               return remapType(Fresh->getElementType(Index)) ==
+                      Existing->getElementType(Index);
+             });
+    });
+  }
+
+  bool needsRemap() const { return HasFreshStructs; }
+
+  Type *remapType(Type *Ty) override {
+    auto It = Mapped.find(Ty);
+    if (It != Mapped.end()) {
+      return It->second;
+    }
+
+    Type *Result = Ty;
+    if (auto *STy = dyn_cast<StructType>(Ty); STy && STy->isLiteral()) {
+      SmallVector<Type *, 8> Elements;
+      for (Type *Element : STy->elements()) {
+        Elements.push_back(remapType(Element));
+      }
+      Result = StructType::get(Ty->getContext(), Elements, STy->isPacked());
+    } else if (auto *ATy = dyn_cast<ArrayType>(Ty)) {
+      Result = ArrayType::get(remapType(ATy->getElementType()),
+                              ATy->getNumElements());
+    } else if (auto *VTy = dyn_cast<VectorType>(Ty)) {
+      Result = VectorType::get(remapType(VTy->getElementType()),
+                               VTy->getElementCount());
+    } else if (auto *FTy = dyn_cast<FunctionType>(Ty)) {
+      SmallVector<Type *, 8> Params;
+      for (Type *Param : FTy->params()) {
+        Params.push_back(remapType(Param));
+      }
+      Result = FunctionType::get(remapType(FTy->getReturnType()), Params,
+                                 FTy->isVarArg());
+    }
+
+    Mapped[Ty] = Result;
+    return Result;
+  }
+
+private:
+  DenseMap<Type *, Type *> Mapped;
+  bool HasFreshStructs = false;
+};
+
+} // namespace
+
+/**
+ * @brief Attributes with their types (byval, sret...) remapped, which
+ * RemapInstruction leaves as they are
+ */
+static AttributeList remapAttributes(LLVMContext &Ctx, AttributeList Attrs,
+                                     unsigned NumArgs,
+                                     ValueMapTypeRemapper &Remapper) {
+  auto RemapSet = [&](AttributeSet Set) {
+    SmallVector<Attribute, 8> Remapped;
+    for (Attribute Attr : Set) {
+      if (Attr.isTypeAttribute() && Attr.getValueAsType() != nullptr) {
+        Attr = Attribute::get(Ctx, Attr.getKindAsEnum(),
+                              Remapper.remapType(Attr.getValueAsType()));
+      }
+      Remapped.push_back(Attr);
+    }
+    return AttributeSet::get(Ctx, Remapped);
+  };
+
+  SmallVector<AttributeSet, 8> Params;
+  for (unsigned ArgNo = 0; ArgNo < NumArgs; ++ArgNo) {
+    Params.push_back(RemapSet(Attrs.getParamAttrs(ArgNo)));
+  }
+  return AttributeList::get(Ctx, RemapSet(Attrs.getFnAttrs()),
+                            RemapSet(Attrs.getRetAttrs()), Params);
+}
+
+/**
+ * @brief Clone Func into a module of its own, with declarations of the
+ * globals it references, or definitions for the ones in Defined
+ * @return nullptr if Func references an unnamed global, which couldn't be
+ * found again when loading
+ */
+static std::unique_ptr<Module>
+extractFunction(const Function &Func, ArrayRef<GlobalVariable *> Defined) {
+  const Module &Src = *Func.getParent();
+  auto M = std::make_unique<Module>(Src.getModuleIdentifier(),
+                                    Func.getContext());
+  M->setSourceFileName(Src.getSourceFileName());
+  M->setDataLayout(Src.getDataLayout());
+  M->setTargetTriple(Src.getTargetTriple());
+
+  // The profile summary is a module flag and -cff-skip-hot depends on it
+  SmallVector<Module::ModuleFlagEntry, 8> Flags;
+  Src.getModuleFlagsMetadata(Flags);
+  for (const Module::ModuleFlagEntry &Flag : Flags) {
+    M->addModuleFlag(Flag.Behavior, Flag.Key->getString(), Flag.Val);
+  }
+
+  ValueToValueMapTy VMap;
+  Function *NewFunc =
+      Function::Create(Func.getFunctionType(), Func.getLinkage(),
+                       Func.getAddressSpace(), Func.getName(), M.get());
+  VMap[&Func] = NewFunc;
+  for (const auto &[Arg, NewArg] : zip(Func.args(), NewFunc->args())) {
+    NewArg.setName(Arg.getName());
+    VMap[&Arg] = &NewArg;
+  }
+
+  SmallPtrSet<const Constant *, 32> Visited;
+  SmallVector<const Constant *, 32> Worklist;
+  auto Visit = [&](const Value *V) {
+    const auto *C = dyn_cast_or_null<Constant>(V);
+    if (C != nullptr && Visited.insert(C).second) {
+      Worklist.push_back(C);
+    }
+  };
+  for (const Instruction &Inst : instructions(Func)) {
+    for (const Value *Op : Inst.operands()) {
+      Visit(Op);
+    }
+  }
+  if (Func.hasPersonalityFn()) {
+    Visit(Func.getPersonalityFn());
+  }
+  if (Func.hasPrefixData()) {
+    Visit(Func.getPrefixData());
+  }
+  if (Func.hasPrologueData()) {
+    Visit(Func.getPrologueData());
+  }
+
+  // Defined globals come first and in order, loading appends them as they are
+  for (const GlobalVariable *Var : Defined) {
+    auto *NewVar = new GlobalVariable(
+        *M, Var->getValueType(), Var->isConstant(), Var->getLinkage(),
+        /*Initializer=*/nullptr, Var->getName());
+    NewVar->copyAttributesFrom(Var);
+    // e.g. the tag CFFProfileRegistration looks for
+    NewVar->copyMetadata(Var, /*Offset=*/0);
+    VMap[Var] = NewVar;
+    Visit(Var->getInitializer());
+  }
+
+  while (!Worklist.empty()) {
+    const Constant *C = Worklist.pop_back_val();
+    const auto *GV = dyn_cast<GlobalValue>(C);
+    if (GV == nullptr) {
+      for (const Value *Op : C->operands()) {
+        Visit(Op);
+      }
+      continue;
+    }
+    if (GV == &Func || VMap.count(GV)) {
+      continue;
+    }
+    if (!GV->hasName()) {
+      return nullptr;
+    }
+
+    if (auto *FTy = dyn_cast<FunctionType>(GV->getValueType())) {
+      Function *Decl =
+          Function::Create(FTy, GlobalValue::ExternalLinkage,
+                           GV->getAddressSpace(), GV->getName(), M.get());
+      if (const auto *Callee = dyn_cast<Function>(GV)) {
+        Decl->setCallingConv(Callee->getCallingConv());
+        Decl->setAttributes(Callee->getAttributes());
+      }
+      VMap[GV] = Decl;
+    } else {
+      VMap[GV] = new GlobalVariable(
+          *M, GV->getValueType(), /*isConstant=*/false,
+          GlobalValue::ExternalLinkage, /*Initializer=*/nullptr, GV->getName(),
+          /*InsertBefore=*/nullptr, GlobalValue::NotThreadLocal,
+          GV->getAddressSpace());
+    }
+  }
+
+  SmallVector<ReturnInst *, 4> Returns;
+  CloneFunctionInto(NewFunc, &Func, VMap,
+                    CloneFunctionChangeType::GlobalChanges, Returns);
+  for (const GlobalVariable *Var : Defined) {
+    cast<GlobalVariable>(VMap[Var])->setInitializer(
+        MapValue(Var->getInitializer(), VMap));
+  }
+
+  return M;
+}
+
+Expected<std::string> FunctionCache::getBuildID(const char *Argv0) {
+  // Any function of the executable will do where argv[0] isn't enough
+  void *Addr = reinterpret_cast<void *>(&FunctionCache::getBuildID);
+  std::string Path = sys::fs::getMainExecutable(Argv0, Addr);
+  if (Path.empty()) {
+    return createStringError(inconvertibleErrorCode(),
+                             "can't find the executable");
+  }
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer =
+      MemoryBuffer::getFile(Path, /*IsText=*/false,
+                            /*RequiresNullTerminator=*/false);
+  if (!Buffer) {
+    return createFileError(Path, Buffer.getError());
+  }
+  return toHex(SHA1::hash(arrayRefFromStringRef((*Buffer)->getBuffer())),
+               /*LowerCase=*/true);
+}
+
+std::string FunctionCache::getPath(StringRef Key, StringRef Extension) const {
+  SmallString<128> Path(Dir);
+  sys::path::append(Path, Key + Extension);
+  return std::string(Path);
+}
+
+Error FunctionCache::write(StringRef Path,
+                           function_ref<void(raw_ostream &)> Writer) const {
+  // Renaming is atomic, readers never see a partial entry
+  Expected<sys::fs::TempFile> Temp =
+      sys::fs::TempFile::create(Path + ".%%%%%%.tmp");
+  if (!Temp) {
+    return Temp.takeError();
+  }
+
+  raw_fd_ostream OS(Temp->FD, /*shouldClose=*/false);
+  Writer(OS);
+  OS.flush();
+  if (OS.has_error()) {
+    std::error_code EC = OS.error();
+    OS.clear_error();
+    return joinErrors(errorCodeToError(EC), Temp->discard());
+  }
+
+  return Temp->keep(Path);
+}
+
+std::optional<std::string> FunctionCache::getKey(const Function &Func,
+                                                 unsigned Policy) const {
+  // Debug info would have to be merged back, typed pointers remapped
+  if (Func.getSubprogram() != nullptr ||
+      Func.getContext().supportsTypedPointers()) {
+    return std::nullopt;
+  }
+
+  std::unique_ptr<Module> Input = extractFunction(Func, {});
+  if (!Input) {
+    return std::nullopt;
+  }
+
+  SmallString<0> Data;
+  raw_svector_ostream OS(Data);
+  OS << CacheVersion << '\n'
+     << LLVM_VERSION_STRING << '\n'
+     << BuildID << '\n'
+     << Options << '\n'
+     << Func.getParent()->getModuleIdentifier() << '\n'
+     << Policy << '\n';
+  // Not bitcode, see the class comment
+  Input->print(OS, /*AAW=*/nullptr);
+
+  return toHex(SHA1::hash(arrayRefFromStringRef(Data)), /*LowerCase=*/true);
+}
+
+bool FunctionCache::load(StringRef Key, Function &Func) const {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer =
+      MemoryBuffer::getFile(getPath(Key, ".bc"));
+  if (!Buffer) {
+    return false;
+  }
+
+  // A truncated or foreign file is a miss, it gets overwritten
+  LLVMContext &Ctx = Func.getContext();
+  Expected<std::unique_ptr<Module>> Entry =
+      parseBitcodeFile((*Buffer)->getMemBufferRef(), Ctx);
+  if (!Entry) {
+    consumeError(Entry.takeError());
+    return false;
+  }
+
+  Function *Cached = (*Entry)->getFunction(Func.getName());
+  if (Cached == nullptr || Cached->isDeclaration() ||
+      Cached->arg_size() != Func.arg_size()) {
+    return false;
+  }
+
+  EntryTypeRemapper Remapper;
+  if (!Remapper.init(**Entry)) {
+    return false;
+  }
+
+  // Resolve everything before touching Func, a miss must leave it alone
+  Module &M = *Func.getParent();
+  SmallVector<std::pair<GlobalValue *, GlobalValue *>, 16> Resolved;
+  SmallVector<GlobalVariable *, 4> Created;
+  for (GlobalValue &GV : (*Entry)->global_values()) {
+    if (&GV == Cached) {
+      continue;
+    }
+
+    if (!GV.isDeclaration()) {
+      auto *Var = dyn_cast<GlobalVariable>(&GV);
+      if (Var == nullptr ||
+          Remapper.remapType(Var->getValueType()) != Var->getValueType()) {
+        return false;
+      }
+      Created.push_back(Var);
+      continue;
+    }
+
+    GlobalValue *Existing = M.getNamedValue(GV.getName());
+    if (Existing == nullptr && isa<Function>(GV) &&
+        cast<Function>(GV).isIntrinsic()) {
+      // The pipeline may call intrinsics the input didn't
+      Existing = Function::Create(
+          cast<FunctionType>(Remapper.remapType(GV.getValueType())),
+          GlobalValue::ExternalLinkage, GV.getName(), M);
+      cast<Function>(Existing)->setAttributes(
+          cast<Function>(GV).getAttributes());
+    }
+    if (Existing == nullptr || Existing->getType() != GV.getType()) {
+      return false;
+    }
+    Resolved.emplace_back(&GV, Existing);
+  }
+
+  // The entry is thrown away, so its body is moved rather than cloned and
+  // its globals are replaced by the ones of M. Blocks keep their
+  // blockaddresses: replacing Cached rekeys them to Func
+  for (BasicBlock &BB : Func) {
+    BB.dropAllReferences();
+  }
+  while (!Func.empty()) {
+    Func.begin()->eraseFromParent();
+  }
+  Func.getBasicBlockList().splice(Func.end(), Cached->getBasicBlockList());
+  for (auto [Arg, NewArg] : zip(Cached->args(), Func.args())) {
+    Arg.replaceAllUsesWith(&NewArg);
+  }
+  for (auto [GV, Existing] : Resolved) {
+    GV->replaceAllUsesWith(Existing);
+  }
+  Cached->replaceAllUsesWith(&Func);
+  for (GlobalVariable *Var : Created) {
+    Var->removeFromParent();
+    M.getGlobalList().push_back(Var);
+  }
+
+  if (!Remapper.needsRemap()) {
+    Func.setAttributes(Cached->getAttributes());
+    return true;
+  }
+
+  // Nothing but types changes, values map to themselves
+  ValueToValueMapTy Identity;
+  for (Instruction &Inst : instructions(Func)) {
+    RemapInstruction(&Inst, Identity,
+                     RF_IgnoreMissingLocals | RF_NoModuleLevelChanges,
+                     &Remapper);
+    if (auto *Call = dyn_cast<CallBase>(&Inst)) {
+      Call->setAttributes(remapAttributes(Ctx, Call->getAttributes(),
+                                          Call->arg_size(), Remapper));
+    }
+  }
+  Func.setAttributes(
+      remapAttributes(Ctx, Cached->getAttributes(), Func.arg_size(), Remapper));
+
+  return true;
+}
+
+Error FunctionCache::store(StringRef Key, const Function &Func,
+                           ArrayRef<GlobalVariable *> Created) const {
+  std::unique_ptr<Module> Entry = extractFunction(Func, Created);
+  if (!Entry) {
+    return Error::success();
+  }
+
+  return write(getPath(Key, ".bc"),
+               [&](raw_ostream &OS) { WriteBitcodeToFile(*Entry, OS); });
+}
+
+std::string FunctionCache::getModuleKey(StringRef ModuleID, StringRef Input,
+                                        StringRef Selection) const {
+  SmallString<0> Data;
+  raw_svector_ostream OS(Data);
+  OS << CacheVersion << '\n'
+     << LLVM_VERSION_STRING << '\n'
+     << BuildID << '\n'
+     << Options << '\n'
+     << ModuleID << '\n'
+     << Selection << '\n'
+     << Input;
+
+  return toHex(SHA1::hash(arrayRefFromStringRef(Data)), /*LowerCase=*/true);
+}
+
+std::unique_ptr<MemoryBuffer> FunctionCache::loadModule(StringRef Key) const {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer =
+      MemoryBuffer::getFile(getPath(Key, ".out"), /*IsText=*/false,
+                            /*RequiresNullTerminator=*/false);
+  return Buffer ? std::move(*Buffer) : nullptr;
+}
+
+Error FunctionCache::storeModule(StringRef Key, StringRef Output) const {
+  return write(getPath(Key, ".out"), [&](raw_ostream &OS) { OS << Output; });
+}
+
+} // namespace llvm
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <memory>
+#include <optional>
+#include <string>
+
+namespace llvm {
+
+/**
+ * @brief On-disk cache of obfuscated functions, addressed by content
+ *
+ * An entry is a bitcode module of its own holding the obfuscated function,
+ * declarations of the globals it references and definitions of the globals
+ * the pipeline created for it, stored as <dir>/<key>.bc. The key is a SHA-1
+ * of such a module built from the function before the pipeline, together
+ * with the module identifier (the RNG salt), the obfuscation policy of the
+ * function, a fingerprint of the options and the build of the tool. The
+ * module is hashed as printed IR: its bitcode would carry every metadata
+ * kind of the context, which grows as functions are obfuscated and loaded.
+ *
+ * A whole output module can be stored as well, as <dir>/<key>.out, keyed by
+ * the bytes of the input: an unchanged module is then copied without even
+ * being parsed.
+ *
+ * Entries are written to a temporary file and renamed, so compile jobs
+ * sharing a directory only ever see complete entries, and two jobs storing
+ * the same key store the same bytes.
+ */
+class FunctionCache {
+public:
+  /**
+   * @param BuildID Identifies the build of the tool, see getBuildID()
+   * @param Options Whatever besides the function changes the output, e.g.
+   * the pipeline and the pass options
+   */
+  FunctionCache(StringRef Dir, StringRef BuildID, StringRef Options)
+      : Dir(Dir), BuildID(BuildID), Options(Options) {}
+
+  /**
+   * @brief SHA-1 of the running executable
+   *
+   * The passes are linked in, so any change to them changes the executable.
+   * LLVM itself may be a shared library: its version is part of the keys.
+   */
+  static Expected<std::string> getBuildID(const char *Argv0);
+
+  /**
+   * @return std::nullopt if Func can't be cached: it has debug info, uses
+   * typed pointers or references an unnamed global
+   */
+  std::optional<std::string> getKey(const Function &Func,
+                                    unsigned Policy) const;
+
+  /**
+   * @brief Replace the body of Func with the one of entry Key
+   * @return false, leaving Func alone, if there is no usable entry
+   */
+  bool load(StringRef Key, Function &Func) const;
+
+  /**
+   * @brief Store Func, after the pipeline, as entry Key
+   * @param Created The globals the pipeline created for Func
+   */
+  Error store(StringRef Key, const Function &Func,
+              ArrayRef<GlobalVariable *> Created) const;
+
+  /**
+   * @param Selection Whatever besides the options picks the functions to
+   * transform and the output format
+   */
+  std::string getModuleKey(StringRef ModuleID, StringRef Input,
+                           StringRef Selection) const;
+
+  /**
+   * @return nullptr if there is no output for Key
+   */
+  std::unique_ptr<MemoryBuffer> loadModule(StringRef Key) const;
+
+  Error storeModule(StringRef Key, StringRef Output) const;
+
+private:
+  std::string getPath(StringRef Key, StringRef Extension) const;
+
+  /// Write an entry through a temporary file
+  Error write(StringRef Path, function_ref<void(raw_ostream &)> Writer) const;
+
+  std::string Dir;
+  std::string BuildID;
+  std::string Options;
+};
+
+} // namespace llvm
@@ -0,0 +1,412 @@
+/**
+ * @file obfuscator-opt.cpp
+ * @brief Run a function pipeline on the selected functions of a bitcode
+ * file, loading only those
+ *
+ * The passes are linked in, so there is no plugin to load, and the input is
+ * read lazily (mapped by default): only the functions matching -func are
+ * materialized, the pipeline runs on them one at a time and their analyses
+ * are dropped right after. The other functions are only materialized to be
+ * written back, unchanged and unverified. The bitcode writer needs every
+ * body, so the peak memory is still that of the whole module: what the lazy
+ * loading saves is running the pipeline, and its analyses, on the others.
+ *
+ * The pipeline is a function pipeline, e.g. "mba,cff" or "function(mba,cff)".
+ * Module passes are not supported since they would need every function.
+ *
+ * With -cache-dir, an input already obfuscated once with the same options
+ * and policy is copied from the cache instead, and so is every function of
+ * an edited input that is itself unchanged (see FunctionCache.hpp).
+ *
+ * With -time-trace, the time spent on each function and in each pass is
+ * written in the Chrome trace format of clang -ftime-trace.
+ *
+ * Usage: obfuscator-opt -passes=<pipeline> [-func=<glob>]... [-cache-dir=<dir>]
+ *        <input> -o <output>
+ */
+
+#include "ControlFlowFlattening.hpp"
+#include "ObfuscationPolicy.hpp"
+#include "ObfuscatorPass.hpp"
+#include "FunctionCache.hpp"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/GlobPattern.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/WithColor.h"
+#include <memory>
+#include <optional>
+#include <string>
+
+using namespace llvm;
+
+static cl::opt<std::string> InputFilename(cl::Positional,
+                                          cl::desc("<input bitcode or IR>"),
+                                          cl::init("-"));
+
+static cl::opt<std::string> OutputFilename("o", cl::desc("Output filename"),
+                                           cl::value_desc("filename"),
+                                           cl::init("-"));
+
+static cl::opt<std::string>
+    PassPipeline("passes", cl::Required,
+                 cl::desc("Function pipeline run on every selected function, "
+                          "e.g. 'mba,cff'"));
+
+static cl::list<std::string>
+    FunctionGlobs("func", cl::CommaSeparated, cl::value_desc("glob"),
+                  cl::desc("Only materialize and transform the functions "
+                           "matching one of these globs (default: all)"));
+
+static cl::opt<bool> UseMmap("mmap", cl::init(true),
+                             cl::desc("Map the input file instead of reading "
+                                      "it"));
+
+static cl::opt<bool> OutputAssembly("S",
+                                    cl::desc("Write LLVM IR instead of "
+                                             "bitcode"));
+
+static cl::opt<bool> DisableVerify("disable-verify",
+                                   cl::desc("Don't verify the transformed "
+                                            "functions"));
+
+static cl::opt<std::string>
+    CacheDir("cache-dir", cl::value_desc("directory"),
+             cl::desc("Reuse and store obfuscated functions in this "
+                      "directory, which concurrent jobs may share"));
+
+static cl::opt<bool> CacheStats("cache-stats",
+                                cl::desc("Print the cache hits and misses"));
+
+static cl::opt<bool> TimeTrace("time-trace",
+                               cl::desc("Write a trace of the time spent on "
+                                        "each function and in each pass"));
+
+static cl::opt<unsigned> TimeTraceGranularity(
+    "time-trace-granularity", cl::init(500),
+    cl::desc("Minimum time, in microseconds, of the events in the trace"));
+
+static cl::opt<std::string>
+    TimeTraceFile("time-trace-file", cl::value_desc("filename"),
+                  cl::desc("Where to write the trace (default: "
+                           "<output>.time-trace)"));
+
+/**
+ * @brief Writes the -time-trace trace when main returns, whichever way
+ */
+class TimeTracer {
+public:
+  explicit TimeTracer(StringRef ProgramName) {
+    if (TimeTrace) {
+      timeTraceProfilerInitialize(TimeTraceGranularity, ProgramName);
+    }
+  }
+
+  ~TimeTracer() {
+    if (!TimeTrace) {
+      return;
+    }
+    if (Error Err = timeTraceProfilerWrite(TimeTraceFile, OutputFilename)) {
+      WithColor::warning() << "can't write the time trace: "
+                           << toString(std::move(Err)) << "\n";
+    }
+    timeTraceProfilerCleanup();
+  }
+};
+
+/**
+ * @return true if every parenthesis of Text is closed after it is opened
+ */
+static bool isBalanced(StringRef Text) {
+  int Depth = 0;
+  for (char C : Text) {
+    Depth += C == '(' ? 1 : C == ')' ? -1 : 0;
+    if (Depth < 0) {
+      return false;
+    }
+  }
+  return Depth == 0;
+}
+
+/**
+ * @brief The text of -passes as a function pipeline, without the
+ * "function(...)" opt needs around each of its top-level elements, e.g.
+ * "function(mba),function(cff)" becomes "mba,cff"
+ */
+static std::string getFunctionPipeline() {
+  StringRef Pipeline = PassPipeline;
+  SmallVector<StringRef, 4> Elements;
+  int Depth = 0;
+  size_t Start = 0;
+  for (size_t I = 0, E = Pipeline.size(); I < E; ++I) {
+    if (Pipeline[I] == '(') {
+      ++Depth;
+    } else if (Pipeline[I] == ')') {
+      --Depth;
+    } else if (Pipeline[I] == ',' && Depth == 0) {
+      Elements.push_back(Pipeline.slice(Start, I));
+      Start = I + 1;
+    }
+  }
+  Elements.push_back(Pipeline.drop_front(Start));
+
+  for (StringRef &Element : Elements) {
+    // Only when its parentheses enclose the whole element
+    StringRef Inner = Element;
+    if (Inner.consume_front("function(") && Inner.consume_back(")") &&
+        isBalanced(Inner)) {
+      Element = Inner;
+    }
+  }
+  return join(Elements, ",");
+}
+
+/**
+ * @brief The command line minus what doesn't change the obfuscated code: the
+ * input and the options of this tool other than -passes
+ * @note Any pass option, e.g. -cff-dispatch or -obf-policy, changes the key
+ */
+static std::string getOptionsFingerprint(ArrayRef<const char *> Args) {
+  static const StringRef ToolOptions[] = {
+      "o", "S", "func", "mmap", "disable-verify", "cache-dir", "cache-stats",
+      "time-trace", "time-trace-granularity", "time-trace-file"};
+  static const StringRef ValueOptions[] = {
+      "o", "func", "cache-dir", "time-trace-granularity", "time-trace-file"};
+
+  std::string Fingerprint;
+  for (size_t Index = 1; Index < Args.size(); ++Index) {
+    StringRef Arg = Args[Index];
+    if (Arg == InputFilename) {
+      continue;
+    }
+
+    StringRef Name = Arg.ltrim('-').split('=').first;
+    if (Arg.startswith("-") && is_contained(ToolOptions, Name)) {
+      // "-o <file>" rather than "-o=<file>"
+      if (!Arg.contains('=') && is_contained(ValueOptions, Name)) {
+        ++Index;
+      }
+      continue;
+    }
+    Fingerprint += Arg;
+    Fingerprint += '\0';
+  }
+  return Fingerprint;
+}
+
+int main(int Argc, char **Argv) {
+  InitLLVM X(Argc, Argv);
+  cl::ParseCommandLineOptions(Argc, Argv,
+                              "obfuscate the selected functions of a module");
+  ExitOnError ExitOnErr("obfuscator-opt: ");
+  TimeTracer Tracer(Argv[0]);
+
+  SmallVector<GlobPattern, 4> Globs;
+  for (const std::string &Glob : FunctionGlobs) {
+    Globs.push_back(ExitOnErr(GlobPattern::create(Glob)));
+  }
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer =
+      InputFilename == "-"
+          ? MemoryBuffer::getSTDIN()
+          : MemoryBuffer::getFile(InputFilename, /*IsText=*/false,
+                                  /*RequiresNullTerminator=*/true,
+                                  /*IsVolatile=*/!UseMmap);
+  if (!Buffer) {
+    WithColor::error(errs(), Argv[0])
+        << InputFilename << ": " << Buffer.getError().message() << "\n";
+    return 1;
+  }
+
+  std::optional<FunctionCache> Cache;
+  std::string ModuleKey;
+  if (!CacheDir.empty()) {
+    if (std::error_code EC = sys::fs::create_directories(CacheDir)) {
+      WithColor::error(errs(), Argv[0])
+          << CacheDir << ": " << EC.message() << "\n";
+      return 1;
+    }
+    Expected<std::string> BuildID = FunctionCache::getBuildID(Argv[0]);
+    if (!BuildID) {
+      WithColor::error(errs(), Argv[0])
+          << "can't identify the build for the cache: "
+          << toString(BuildID.takeError()) << "\n";
+      return 1;
+    }
+    // The hot list isn't on the command line but changes the output
+    std::string Options = getOptionsFingerprint(makeArrayRef(Argv, Argc));
+    Options += '\0';
+    Options += getCFFHotListText();
+    Cache.emplace(CacheDir, *BuildID, Options);
+
+    // The policy file isn't part of the input but changes the output
+    std::string Selection = join(FunctionGlobs, ",");
+    Selection += '\0';
+    Selection += OutputAssembly ? 'S' : 'B';
+    Selection += '\0';
+    Selection += getObfuscationPolicyText();
+    ModuleKey = Cache->getModuleKey((*Buffer)->getBufferIdentifier(),
+                                    (*Buffer)->getBuffer(), Selection);
+
+    if (std::unique_ptr<MemoryBuffer> Output = Cache->loadModule(ModuleKey)) {
+      std::error_code EC;
+      ToolOutputFile Out(OutputFilename, EC,
+                         OutputAssembly ? sys::fs::OF_Text : sys::fs::OF_None);
+      if (EC) {
+        WithColor::error(errs(), Argv[0]) << EC.message() << "\n";
+        return 1;
+      }
+      Out.os() << Output->getBuffer();
+      Out.keep();
+      if (CacheStats) {
+        errs() << "cache: module hit\n";
+      }
+      return 0;
+    }
+  }
+
+  // Bitcode function bodies stay in the buffer until materialized, textual
+  // IR is parsed in full
+  LLVMContext Ctx;
+  SMDiagnostic Diag;
+  std::unique_ptr<Module> M = getLazyIRModule(std::move(*Buffer), Diag, Ctx);
+  if (!M) {
+    Diag.print(Argv[0], errs());
+    return 1;
+  }
+
+  SmallVector<Function *, 16> Selected;
+  for (Function &Func : *M) {
+    if (Func.isDeclaration()) {
+      continue;
+    }
+    if (Globs.empty() || any_of(Globs, [&](const GlobPattern &Glob) {
+          return Glob.match(Func.getName());
+        })) {
+      ExitOnErr(Func.materialize());
+      Selected.push_back(&Func);
+    }
+  }
+
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+
+  PassBuilder PB;
+  registerObfuscatorPasses(PB);
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  FunctionPassManager FPM;
+  ExitOnErr(PB.parsePassPipeline(FPM, getFunctionPipeline()));
+
+  unsigned Hits = 0;
+  unsigned Misses = 0;
+
+  for (Function *Func : Selected) {
+    TimeTraceScope TimeScope("ObfuscateFunction", Func->getName());
+    std::optional<std::string> Key;
+    if (Cache) {
+      Key = Cache->getKey(
+          *Func, FAM.getResult<ObfuscationPolicyAnalysis>(*Func).getEnabled());
+      if (Key && Cache->load(*Key, *Func)) {
+        FAM.clear(*Func, Func->getName());
+        ++Hits;
+        continue;
+      }
+      ++Misses;
+    }
+
+    // Globals the pipeline creates are appended, entries keep them
+    GlobalVariable *LastGlobal =
+        M->global_empty() ? nullptr : &M->getGlobalList().back();
+    size_t NumFunctions = M->size();
+
+    FPM.run(*Func, FAM);
+    FAM.clear(*Func, Func->getName());
+
+    if (!DisableVerify && verifyFunction(*Func, &errs())) {
+      WithColor::error(errs(), Argv[0])
+          << "broken function after the pipeline: " << Func->getName()
+          << "\n";
+      return 1;
+    }
+
+    // Functions created by the pipeline would have to be cached too
+    if (Key && M->size() == NumFunctions) {
+      SmallVector<GlobalVariable *, 4> Created;
+      auto First = LastGlobal ? std::next(LastGlobal->getIterator())
+                              : M->global_begin();
+      for (GlobalVariable &Var : make_range(First, M->global_end())) {
+        Created.push_back(&Var);
+      }
+      if (Error Err = Cache->store(*Key, *Func, Created)) {
+        WithColor::warning(errs(), Argv[0])
+            << "can't cache " << Func->getName() << ": "
+            << toString(std::move(Err)) << "\n";
+      }
+    }
+  }
+
+  if (CacheStats) {
+    errs() << "cache: " << Hits << " hits, " << Misses << " misses\n";
+  }
+
+  // The module-level half of -cff-instrument, which a function pipeline lacks
+  CFFProfileRegistration().run(*M, MAM);
+
+  // Every body is needed to write the module back, see the file comment
+  ExitOnErr(M->materializeAll());
+
+  std::error_code EC;
+  ToolOutputFile Out(OutputFilename, EC,
+                     OutputAssembly ? sys::fs::OF_Text : sys::fs::OF_None);
+  if (EC) {
+    WithColor::error(errs(), Argv[0]) << EC.message() << "\n";
+    return 1;
+  }
+
+  auto WriteModule = [&](raw_ostream &OS) {
+    if (OutputAssembly) {
+      M->print(OS, nullptr);
+    } else {
+      WriteBitcodeToFile(*M, OS);
+    }
+  };
+
+  if (Cache) {
+    SmallString<0> Output;
+    raw_svector_ostream OS(Output);
+    WriteModule(OS);
+    Out.os() << Output;
+    if (Error Err = Cache->storeModule(ModuleKey, Output)) {
+      WithColor::warning(errs(), Argv[0])
+          << "can't cache the output: " << toString(std::move(Err)) << "\n";
+    }
+  } else {
+    WriteModule(Out.os());
+  }
+  Out.keep();
+
+  return 0;
+}
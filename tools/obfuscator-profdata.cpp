@@ -0,0 +1,162 @@
+/**
+ * @file obfuscator-profdata.cpp
+ * @brief Turn the dispatch counts of -cff-instrument into a -cff-hot-list
+ *
+ * The profiles written by runtime/CFFProfile.c are summed function by
+ * function, a static one told apart by its source file, and the blocks
+ * dispatched the most are listed until they cover -hot-cutoff of all the
+ * dispatches. Building with -cff-hot-list on the result keeps those blocks,
+ * and their innermost loops, out of the dispatcher.
+ *
+ * The output has one '<function> <block>' per line, hottest first, with the
+ * count in a comment.
+ *
+ * Usage: obfuscator-profdata [-hot-cutoff=<ppm>] <profile>... -o <hot list>
+ */
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/WithColor.h"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace llvm;
+
+static cl::list<std::string> InputFilenames(cl::Positional, cl::OneOrMore,
+                                            cl::desc("<profile>..."));
+
+static cl::opt<std::string> OutputFilename("o", cl::desc("Output filename"),
+                                           cl::value_desc("filename"),
+                                           cl::init("-"));
+
+static cl::opt<unsigned> HotCutoff(
+    "hot-cutoff", cl::init(990000),
+    cl::desc("List the hottest blocks until they cover this share (in parts "
+             "per million) of the dispatches, like -cff-hot-cutoff"));
+
+/**
+ * @brief Add the counts of the profile in Text to Counts, keyed by function
+ * then block
+ */
+static Error addProfile(StringRef Text,
+                        StringMap<StringMap<uint64_t>> &Counts) {
+  Expected<json::Value> Root = json::parse(Text);
+  if (!Root) {
+    return Root.takeError();
+  }
+
+  const json::Object *Profile = Root->getAsObject();
+  auto Version = Profile != nullptr ? Profile->getInteger("version") : None;
+  if (!Version || *Version != 1) {
+    return createStringError(inconvertibleErrorCode(),
+                             "not a version 1 CFF profile");
+  }
+
+  const json::Array *Functions = Profile->getArray("functions");
+  if (Functions == nullptr) {
+    return createStringError(inconvertibleErrorCode(), "no functions");
+  }
+
+  for (const json::Value &Function : *Functions) {
+    const json::Object *Entry = Function.getAsObject();
+    auto Name = Entry != nullptr ? Entry->getString("name") : None;
+    const json::Object *Blocks =
+        Entry != nullptr ? Entry->getObject("blocks") : nullptr;
+    if (!Name || Blocks == nullptr) {
+      return createStringError(inconvertibleErrorCode(),
+                               "function without a name or blocks");
+    }
+
+    StringMap<uint64_t> &FuncCounts = Counts[*Name];
+    for (const auto &[Block, Count] : *Blocks) {
+      auto Value = Count.getAsUINT64();
+      if (!Value) {
+        return createStringError(inconvertibleErrorCode(),
+                                 "bad count for " + *Name + " " +
+                                     StringRef(Block));
+      }
+      FuncCounts[StringRef(Block)] += *Value;
+    }
+  }
+
+  return Error::success();
+}
+
+int main(int Argc, char **Argv) {
+  InitLLVM X(Argc, Argv);
+  cl::ParseCommandLineOptions(Argc, Argv,
+                              "CFF dispatch counts to a -cff-hot-list");
+
+  StringMap<StringMap<uint64_t>> Counts;
+  for (const std::string &Filename : InputFilenames) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> Buffer =
+        MemoryBuffer::getFileOrSTDIN(Filename, /*IsText=*/true);
+    if (!Buffer) {
+      WithColor::error(errs(), Argv[0])
+          << Filename << ": " << Buffer.getError().message() << "\n";
+      return 1;
+    }
+
+    if (Error Err = addProfile((*Buffer)->getBuffer(), Counts)) {
+      WithColor::error(errs(), Argv[0])
+          << Filename << ": " << toString(std::move(Err)) << "\n";
+      return 1;
+    }
+  }
+
+  struct HotBlock {
+    StringRef Function;
+    StringRef Block;
+    uint64_t Count;
+  };
+
+  std::vector<HotBlock> Blocks;
+  uint64_t Total = 0;
+  for (const auto &FuncCounts : Counts) {
+    for (const auto &BlockCount : FuncCounts.second) {
+      if (BlockCount.second != 0) {
+        Blocks.push_back(
+            {FuncCounts.first(), BlockCount.first(), BlockCount.second});
+        Total += BlockCount.second;
+      }
+    }
+  }
+
+  // StringMap iterates in no particular order, ties are broken by name
+  std::sort(Blocks.begin(), Blocks.end(),
+            [](const HotBlock &LHS, const HotBlock &RHS) {
+              return std::make_tuple(RHS.Count, LHS.Function, LHS.Block) <
+                     std::make_tuple(LHS.Count, RHS.Function, RHS.Block);
+            });
+
+  std::error_code EC;
+  ToolOutputFile Out(OutputFilename, EC, sys::fs::OF_Text);
+  if (EC) {
+    WithColor::error(errs(), Argv[0]) << EC.message() << "\n";
+    return 1;
+  }
+
+  // Up to the block that makes the listed ones cover the cutoff
+  uint64_t Covered = 0;
+  for (const HotBlock &Hot : Blocks) {
+    if (static_cast<double>(Covered) >= Total * (HotCutoff / 1000000.0)) {
+      break;
+    }
+    Out.os() << Hot.Function << " " << Hot.Block << "  # " << Hot.Count
+             << "\n";
+    Covered += Hot.Count;
+  }
+
+  Out.keep();
+  return 0;
+}
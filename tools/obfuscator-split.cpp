@@ -0,0 +1,233 @@
+/**
+ * @file obfuscator-split.cpp
+ * @brief Run an obfuscation pipeline over a module split into partitions, one
+ * LLVMContext per partition, on a thread pool
+ *
+ * The module is split with SplitModule into a fixed number of partitions,
+ * each one is serialized and handed to a task that parses it into its own
+ * LLVMContext, runs the pipeline and serializes the result. The partitions
+ * are then linked back in partition order and the functions are put back in
+ * their original order, so the output only depends on the input, the
+ * pipeline and -partitions, never on -j or on scheduling.
+ *
+ * Every pass of this project seeds its RNG from the function name and the
+ * module identifier, which the partitions keep, so a function is obfuscated
+ * the same way as by opt on the whole module. Module passes only see their
+ * partition.
+ *
+ * Usage: obfuscator-split -passes=<pipeline> [-partitions=N] [-jN]
+ *        <input> -o <output>
+ */
+
+#include "ControlFlowFlattening.hpp"
+#include "ObfuscatorPass.hpp"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<std::string> InputFilename(cl::Positional,
+                                          cl::desc("<input bitcode or IR>"),
+                                          cl::init("-"));
+
+static cl::opt<std::string> OutputFilename("o", cl::desc("Output filename"),
+                                           cl::value_desc("filename"),
+                                           cl::init("-"));
+
+static cl::opt<std::string>
+    PassPipeline("passes", cl::Required,
+                 cl::desc("Pipeline run on every partition, as for opt "
+                          "-passes, e.g. 'function(mba,cff)'"));
+
+static cl::opt<unsigned> Partitions(
+    "partitions", cl::init(32),
+    cl::desc("Number of partitions, capped by the number of defined "
+             "functions. The output depends on it, unlike -j"));
+
+static cl::opt<unsigned>
+    Threads("j", cl::init(0), cl::Prefix,
+            cl::desc("Threads running the partitions (0 = all hardware "
+                     "threads)"));
+
+static cl::opt<bool> OutputAssembly("S",
+                                    cl::desc("Write LLVM IR instead of "
+                                             "bitcode"));
+
+static cl::opt<bool> DisableVerify("disable-verify",
+                                   cl::desc("Don't verify the partitions "
+                                            "after the pipeline"));
+
+/**
+ * @brief One partition, as bitcode on the way in and on the way out
+ */
+struct Partition {
+  SmallVector<char, 0> Input;
+  SmallVector<char, 0> Output;
+  std::string Error;
+};
+
+/**
+ * @brief Parse P.Input into a fresh LLVMContext, run the pipeline on it and
+ * serialize the result into P.Output
+ * @note Runs on a pool thread: only touches P and its own context
+ */
+static void obfuscatePartition(Partition &P, StringRef ModuleID) {
+  LLVMContext Ctx;
+  Expected<std::unique_ptr<Module>> M = parseBitcodeFile(
+      MemoryBufferRef(StringRef(P.Input.data(), P.Input.size()), ModuleID),
+      Ctx);
+  if (!M) {
+    P.Error = toString(M.takeError());
+    return;
+  }
+
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+
+  PassBuilder PB;
+  registerObfuscatorPasses(PB);
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  ModulePassManager MPM;
+  if (Error Err = PB.parsePassPipeline(MPM, PassPipeline)) {
+    P.Error = toString(std::move(Err));
+    return;
+  }
+  // Registers the counters of -cff-instrument when "function(cff)" didn't
+  MPM.addPass(CFFProfileRegistration());
+  MPM.run(**M, MAM);
+
+  if (!DisableVerify) {
+    std::string Message;
+    raw_string_ostream OS(Message);
+    if (verifyModule(**M, &OS)) {
+      P.Error = "broken module after the pipeline: " + OS.str();
+      return;
+    }
+  }
+
+  raw_svector_ostream OS(P.Output);
+  WriteBitcodeToFile(**M, OS);
+}
+
+/**
+ * @brief Move the definitions of M back to the order of Order, the names of
+ * the functions of the input module
+ * @note The linker appends each partition in turn, which groups functions by
+ * partition. Functions the pipeline created keep their place at the end
+ */
+static void restoreFunctionOrder(Module &M, ArrayRef<std::string> Order) {
+  auto &Functions = M.getFunctionList();
+  for (const std::string &Name : Order) {
+    if (Function *Func = M.getFunction(Name)) {
+      Functions.splice(Functions.end(), Functions, Func->getIterator());
+    }
+  }
+}
+
+int main(int Argc, char **Argv) {
+  InitLLVM X(Argc, Argv);
+  cl::ParseCommandLineOptions(Argc, Argv,
+                              "parallel obfuscation through module splitting");
+  ExitOnError ExitOnErr("obfuscator-split: ");
+
+  LLVMContext Ctx;
+  SMDiagnostic Diag;
+  std::unique_ptr<Module> M = parseIRFile(InputFilename, Diag, Ctx);
+  if (!M) {
+    Diag.print(Argv[0], errs());
+    return 1;
+  }
+
+  std::string ModuleID = M->getModuleIdentifier();
+  std::vector<std::string> FunctionOrder;
+  unsigned NumDefined = 0;
+  for (const Function &Func : *M) {
+    FunctionOrder.push_back(Func.getName().str());
+    NumDefined += !Func.isDeclaration();
+  }
+
+  // Locals stay in the partition of their users, so no symbol has to be
+  // externalized and every linkage survives the round trip
+  std::vector<Partition> Parts;
+  SplitModule(
+      *M, std::max(1u, std::min(Partitions.getValue(), NumDefined)),
+      [&](std::unique_ptr<Module> MPart) {
+        raw_svector_ostream OS(Parts.emplace_back().Input);
+        WriteBitcodeToFile(*MPart, OS);
+      },
+      /*PreserveLocals=*/true);
+  M.reset();
+
+  ThreadPool Pool(hardware_concurrency(Threads));
+  for (Partition &P : Parts) {
+    Pool.async([&P, &ModuleID] { obfuscatePartition(P, ModuleID); });
+  }
+  Pool.wait();
+
+  auto Linked = std::make_unique<Module>(ModuleID, Ctx);
+  Linker L(*Linked);
+  for (size_t Index = 0; Index < Parts.size(); ++Index) {
+    Partition &P = Parts[Index];
+    if (!P.Error.empty()) {
+      WithColor::error(errs(), Argv[0])
+          << "partition " << Index << ": " << P.Error << "\n";
+      return 1;
+    }
+
+    std::unique_ptr<Module> MPart = ExitOnErr(parseBitcodeFile(
+        MemoryBufferRef(StringRef(P.Output.data(), P.Output.size()),
+                        ModuleID),
+        Ctx));
+    if (L.linkInModule(std::move(MPart))) {
+      WithColor::error(errs(), Argv[0])
+          << "can't link partition " << Index << "\n";
+      return 1;
+    }
+    P = Partition();
+  }
+  restoreFunctionOrder(*Linked, FunctionOrder);
+
+  std::error_code EC;
+  ToolOutputFile Out(OutputFilename, EC,
+                     OutputAssembly ? sys::fs::OF_Text : sys::fs::OF_None);
+  if (EC) {
+    WithColor::error(errs(), Argv[0]) << EC.message() << "\n";
+    return 1;
+  }
+
+  if (OutputAssembly) {
+    Linked->print(Out.os(), nullptr);
+  } else {
+    WriteBitcodeToFile(*Linked, Out.os());
+  }
+  Out.keep();
+
+  return 0;
+}